@@ -0,0 +1,412 @@
+#ifdef _WINDOWS
+#define _CRTDBG_MAP_ALLOC
+#include <crtdbg.h>
+#endif
+#define _POSIX_C_SOURCE 200809L
+#include "cjson.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>   /* getrusage() */
+#endif
+
+/* cjson.c is compiled into this target with CJSON_MALLOC/CJSON_REALLOC/CJSON_FREE
+ * pointing here, so every allocation made by the library is counted. */
+static size_t bench_allocs = 0;
+
+void* bench_malloc(size_t size) {
+    bench_allocs++;
+    return malloc(size);
+}
+
+void* bench_realloc(void* p, size_t size) {
+    bench_allocs++;
+    return realloc(p, size);
+}
+
+void bench_free(void* p) {
+    free(p);
+}
+
+// ============================
+// ========== corpus ==========
+// ============================
+
+typedef struct {
+    char* buffer;
+    size_t size, top;
+} bench_buffer;
+
+typedef struct {
+    const char* name;
+    char** docs;            /* NUL-terminated JSON documents */
+    size_t count, bytes;    /* documents, total length */
+} bench_corpus;
+
+static unsigned long long bench_seed = 88172645463325252ULL;
+
+static unsigned long long bench_random() {
+    bench_seed ^= bench_seed << 13;  /* xorshift64, fixed seed so corpora are reproducible */
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+static double bench_uniform(double lo, double hi) {
+    return lo + (hi - lo) * (double)(bench_random() >> 11) / 9007199254740992.0;
+}
+
+static void bench_printf(bench_buffer* b, const char* format, ...) {
+    va_list args;
+    int n;
+    for (;;) {
+        va_start(args, format);
+        n = vsnprintf(b->buffer + b->top, b->size - b->top, format, args);
+        va_end(args);
+        if (n >= 0 && b->top + n < b->size)
+            break;
+        b->size = b->size ? b->size * 2 : 4096;
+        b->buffer = (char*)realloc(b->buffer, b->size);
+    }
+    b->top += n;
+}
+
+static void bench_add(bench_corpus* corpus, bench_buffer* b) {
+    corpus->docs = (char**)realloc(corpus->docs, (corpus->count + 1) * sizeof(char*));
+    corpus->docs[corpus->count++] = b->buffer;
+    corpus->bytes += b->top;
+    b->buffer = NULL;
+    b->size = b->top = 0;
+}
+
+/* Polygons of long coordinate pairs, shaped like canada.json. */
+static void bench_make_numbers(bench_corpus* corpus) {
+    bench_buffer b = {NULL, 0, 0};
+    bench_printf(&b, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+        "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+    for (int ring = 0; ring < 40; ring++) {
+        bench_printf(&b, ring ? ",[" : "[");
+        for (int i = 0; i < 2800; i++)
+            bench_printf(&b, "%s[%.15g,%.15g]", i ? "," : "", bench_uniform(-141.0, -52.0), bench_uniform(41.0, 83.0));
+        bench_printf(&b, "]");
+    }
+    bench_printf(&b, "]}}]}");
+    bench_add(corpus, &b);
+}
+
+/* Messages mixing ASCII, raw UTF-8, \u escapes, surrogate pairs and control escapes. */
+static void bench_make_strings(bench_corpus* corpus) {
+    static const char* pieces[] = {
+        "hello", " ", "world", "\\n", "\\t", "\\\"quoted\\\"", "\\\\", "caf\xc3\xa9", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+        "\\u00e9", "\\u65e5\\u672c", "\\ud83d\\ude00", "\xf0\x9f\x98\x80", "/", "\\/", "0123456789"
+    };
+    bench_buffer b = {NULL, 0, 0};
+    bench_printf(&b, "[");
+    for (int i = 0; i < 6000; i++) {
+        bench_printf(&b, "%s{\"id\":\"user-%d\",\"text\":\"", i ? "," : "", i);
+        for (int j = 0, n = 8 + (int)(bench_random() % 40); j < n; j++)
+            bench_printf(&b, "%s", pieces[bench_random() % (sizeof(pieces) / sizeof(pieces[0]))]);
+        bench_printf(&b, "\",\"lang\":\"%s\"}", bench_random() % 2 ? "en" : "ja");
+    }
+    bench_printf(&b, "]");
+    bench_add(corpus, &b);
+}
+
+/* Alternating arrays and objects, a few thousand levels deep. */
+static void bench_make_nested(bench_corpus* corpus) {
+    bench_buffer b = {NULL, 0, 0};
+    const int depth = 2000;
+    for (int i = 0; i < depth; i++)
+        bench_printf(&b, i % 2 ? "{\"k%d\":1,\"v\":" : "[%d,", i);
+    bench_printf(&b, "null");
+    for (int i = depth - 1; i >= 0; i--)
+        bench_printf(&b, i % 2 ? "}" : "]");
+    bench_add(corpus, &b);
+}
+
+/* One object with many members, e.g. a large lookup table. */
+static void bench_make_wide(bench_corpus* corpus) {
+    bench_buffer b = {NULL, 0, 0};
+    bench_printf(&b, "{");
+    for (int i = 0; i < 20000; i++) {
+        if (bench_random() % 2)
+            bench_printf(&b, "%s\"key_%08d\":%d", i ? "," : "", i, (int)(bench_random() % 100000));
+        else
+            bench_printf(&b, "%s\"key_%08d\":\"value %d\"", i ? "," : "", i, i);
+    }
+    bench_printf(&b, "}");
+    bench_add(corpus, &b);
+}
+
+/* Many small request-sized documents. */
+static void bench_make_small(bench_corpus* corpus) {
+    for (int i = 0; i < 20000; i++) {
+        bench_buffer b = {NULL, 0, 0};
+        bench_printf(&b, "{\"id\":%d,\"method\":\"%s\",\"ok\":%s,\"score\":%.6g,\"tags\":[\"a\",\"b\"],\"user\":{\"name\":\"n%d\",\"age\":%d}}",
+            i, bench_random() % 2 ? "get" : "put", bench_random() % 2 ? "true" : "false", bench_uniform(0, 1),
+            i, (int)(bench_random() % 90));
+        bench_add(corpus, &b);
+    }
+}
+
+static void bench_corpus_free(bench_corpus* corpus) {
+    for (size_t i = 0; i < corpus->count; i++)
+        free(corpus->docs[i]);
+    free(corpus->docs);
+}
+
+// ===========================
+// ========== bench ==========
+// ===========================
+
+enum { BENCH_PARSE, BENCH_STRINGIFY, BENCH_COPY, BENCH_EQUAL, BENCH_FREE, BENCH_OPS };
+static const char* bench_op_names[BENCH_OPS] = {"parse", "stringify", "copy", "equal", "free"};
+
+typedef struct {
+    double mb_per_s;
+    double ns_per_doc;
+    double allocs_per_doc;
+    long peak_rss_kb;
+} bench_result;
+
+static double bench_now() {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static long bench_peak_rss_kb() {
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  /* bytes on macOS */
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/* Runs op over the whole corpus until min_time has passed, timing only op itself. */
+static bench_result bench_run(const bench_corpus* corpus, int op, double min_time) {
+    bench_result r;
+    cjson_value* values = (cjson_value*)malloc(corpus->count * sizeof(cjson_value));
+    cjson_value* copies = (cjson_value*)malloc(corpus->count * sizeof(cjson_value));
+    double elapsed = 0;
+    size_t rounds = 0, allocs = 0;
+
+    for (size_t i = 0; i < corpus->count; i++) {
+        cjson_init(&values[i]);
+        cjson_init(&copies[i]);
+        if (cjson_parse(&values[i], corpus->docs[i]) != CJSON_PARSE_OK) {
+            fprintf(stderr, "cjson_bench: corpus %s does not parse\n", corpus->name);
+            exit(2);
+        }
+        if (op == BENCH_EQUAL)
+            cjson_copy(&copies[i], &values[i]);
+    }
+
+    do {
+        double start;
+        size_t start_allocs;
+        if (op == BENCH_FREE)
+            for (size_t i = 0; i < corpus->count; i++)
+                cjson_copy(&copies[i], &values[i]);
+        start_allocs = bench_allocs;
+        start = bench_now();
+        for (size_t i = 0; i < corpus->count; i++) {
+            switch (op) {
+                case BENCH_PARSE:
+                    cjson_parse(&copies[i], corpus->docs[i]);
+                    break;
+                case BENCH_STRINGIFY:
+                    free(cjson_stringify(&values[i], NULL));
+                    break;
+                case BENCH_COPY:
+                    cjson_copy(&copies[i], &values[i]);
+                    break;
+                case BENCH_EQUAL:
+                    if (!cjson_is_equal(&values[i], &copies[i]))
+                        exit(2);
+                    break;
+                case BENCH_FREE:
+                    cjson_free(&copies[i]);
+                    break;
+            }
+        }
+        elapsed += bench_now() - start;
+        allocs += bench_allocs - start_allocs;
+        rounds++;
+        if (op == BENCH_PARSE || op == BENCH_COPY)
+            for (size_t i = 0; i < corpus->count; i++)
+                cjson_free(&copies[i]);
+    } while (elapsed < min_time);
+
+    for (size_t i = 0; i < corpus->count; i++) {
+        cjson_free(&values[i]);
+        cjson_free(&copies[i]);
+    }
+    free(values);
+    free(copies);
+
+    r.mb_per_s = corpus->bytes * rounds / elapsed / (1024.0 * 1024.0);
+    r.ns_per_doc = elapsed * 1e9 / (corpus->count * rounds);
+    r.allocs_per_doc = (double)allocs / (corpus->count * rounds);
+    r.peak_rss_kb = bench_peak_rss_kb();
+    return r;
+}
+
+/* Finds the baseline's mb_per_s for corpus/op, or returns a negative number. */
+static double bench_baseline(cjson_value* baseline, const char* corpus, const char* op) {
+    cjson_value* results;
+    if (cjson_get_type(baseline) != CJSON_OBJECT
+        || (results = cjson_find_object_value(baseline, "results", 7)) == NULL || cjson_get_type(results) != CJSON_ARRAY)
+        return -1;
+    for (size_t i = 0; i < cjson_get_array_size(results); i++) {
+        cjson_value* e = cjson_get_array_element(results, i);
+        cjson_value *c, *o, *m;
+        if (cjson_get_type(e) == CJSON_OBJECT
+            && (c = cjson_find_object_value(e, "corpus", 6)) != NULL && cjson_get_type(c) == CJSON_STRING
+            && (o = cjson_find_object_value(e, "op", 2)) != NULL && cjson_get_type(o) == CJSON_STRING
+            && (m = cjson_find_object_value(e, "mb_per_s", 8)) != NULL && cjson_get_type(m) == CJSON_NUMBER
+            && strcmp(cjson_get_string(c), corpus) == 0 && strcmp(cjson_get_string(o), op) == 0)
+            return cjson_get_number(m);
+    }
+    return -1;
+}
+
+static void bench_usage() {
+    fprintf(stderr,
+        "usage: cjson_bench [options]\n"
+        "  --json             print results as JSON\n"
+        "  --save FILE        also write the JSON results to FILE, for use as a baseline\n"
+        "  --baseline FILE    compare MB/s against a saved run, exit 1 on regressions\n"
+        "  --threshold PCT    slowdown counted as a regression (default 5)\n"
+        "  --min-time SEC     minimum measured time per corpus and operation (default 0.2)\n"
+        "  --filter NAME      only run corpora or operations whose name contains NAME\n");
+}
+
+int main(int argc, char* argv[]) {
+    void (*makers[])(bench_corpus*) = {bench_make_numbers, bench_make_strings, bench_make_nested, bench_make_wide, bench_make_small};
+    const char* names[] = {"numbers", "strings", "nested", "wide", "small"};
+    const char *save = NULL, *baseline_path = NULL, *filter = NULL;
+    int json = 0, regressions = 0;
+    double threshold = 5, min_time = 0.2;
+    cjson_value baseline;
+    cjson_writer w;
+    const char* out;
+    size_t len;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            save = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else {
+            bench_usage();
+            return 2;
+        }
+    }
+
+    cjson_init(&baseline);
+    if (baseline_path && cjson_parse_file(&baseline, baseline_path, 0) != CJSON_PARSE_OK) {
+        fprintf(stderr, "cjson_bench: cannot read baseline %s\n", baseline_path);
+        return 2;
+    }
+
+    cjson_writer_init(&w);
+    cjson_write_begin_object(&w);
+    cjson_write_key(&w, "results", 7);
+    cjson_write_begin_array(&w);
+    if (!json)
+        printf("%-8s %-10s %10s %12s %11s %12s %12s\n", "corpus", "op", "MB/s", "ns/doc", "allocs/doc", "peak RSS KB", "vs baseline");
+
+    for (size_t c = 0; c < sizeof(makers) / sizeof(makers[0]); c++) {
+        bench_corpus corpus = {names[c], NULL, 0, 0};
+        makers[c](&corpus);
+        for (int op = 0; op < BENCH_OPS; op++) {
+            bench_result r;
+            double base;
+            char change[32] = "";
+            if (filter && !strstr(corpus.name, filter) && !strstr(bench_op_names[op], filter))
+                continue;
+            r = bench_run(&corpus, op, min_time);
+            base = baseline_path ? bench_baseline(&baseline, corpus.name, bench_op_names[op]) : -1;
+            if (base > 0) {
+                double pct = (r.mb_per_s / base - 1) * 100;
+                int regressed = pct < -threshold;
+                regressions += regressed;
+                snprintf(change, sizeof(change), "%+.1f%%%s", pct, regressed ? " !!" : "");
+            }
+
+            cjson_write_begin_object(&w);
+            cjson_write_key(&w, "corpus", 6);
+            cjson_write_string(&w, corpus.name, strlen(corpus.name));
+            cjson_write_key(&w, "op", 2);
+            cjson_write_string(&w, bench_op_names[op], strlen(bench_op_names[op]));
+            cjson_write_key(&w, "bytes", 5);
+            cjson_write_int(&w, (long long)corpus.bytes);
+            cjson_write_key(&w, "docs", 4);
+            cjson_write_int(&w, (long long)corpus.count);
+            cjson_write_key(&w, "mb_per_s", 8);
+            cjson_write_number(&w, r.mb_per_s);
+            cjson_write_key(&w, "ns_per_doc", 10);
+            cjson_write_number(&w, r.ns_per_doc);
+            cjson_write_key(&w, "allocs_per_doc", 14);
+            cjson_write_number(&w, r.allocs_per_doc);
+            cjson_write_key(&w, "peak_rss_kb", 11);
+            cjson_write_int(&w, r.peak_rss_kb);
+            if (base > 0) {
+                cjson_write_key(&w, "baseline_mb_per_s", 17);
+                cjson_write_number(&w, base);
+            }
+            cjson_write_end_object(&w);
+
+            if (!json) {
+                printf("%-8s %-10s %10.1f %12.0f %11.1f %12ld %12s\n", corpus.name, bench_op_names[op],
+                    r.mb_per_s, r.ns_per_doc, r.allocs_per_doc, r.peak_rss_kb, change);
+                fflush(stdout);
+            }
+        }
+        bench_corpus_free(&corpus);
+    }
+
+    cjson_write_end_array(&w);
+    cjson_write_key(&w, "regressions", 11);
+    cjson_write_int(&w, regressions);
+    cjson_write_end_object(&w);
+    out = cjson_writer_get_string(&w, &len);
+    if (json)
+        printf("%s\n", out);
+    if (save) {
+        FILE* fp = fopen(save, "wb");
+        if (fp == NULL || fwrite(out, 1, len, fp) != len) {
+            fprintf(stderr, "cjson_bench: cannot write %s\n", save);
+            regressions = -1;
+        }
+        if (fp)
+            fclose(fp);
+    }
+    if (!json && regressions > 0)
+        printf("%d regression(s) beyond %.1f%%\n", regressions, threshold);
+    cjson_writer_free(&w);
+    cjson_free(&baseline);
+    return regressions != 0 ? (regressions < 0 ? 2 : 1) : 0;
+}
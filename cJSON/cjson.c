@@ -1,3 +1,4 @@
+#define _FILE_OFFSET_BITS 64    /* off_t and fstat() cover files over 2 GB on 32-bit systems */
 #ifdef _WINDOWS
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
@@ -9,35 +10,109 @@
 #include <stdio.h>   /* sprintf() */
 #include <stdlib.h>  /* NULL, malloc(), realloc(), free(), strtod() */
 #include <string.h>  /* memcpy() */
+#include <stdint.h>  /* uint32_t, uint64_t */
+#include <limits.h>  /* LLONG_MAX, IOV_MAX */
+#ifdef _WIN32
+#include <io.h>      /* _write() */
+#define write(fd, buf, n) _write(fd, buf, (unsigned int)(n))
+#include <windows.h> /* GetSystemInfo(), WaitForSingleObject() */
+#include <process.h> /* _beginthreadex() */
+#else
+#include <pthread.h> /* pthread_create() */
+#include <sys/uio.h> /* writev() */
+#include <unistd.h>  /* write(), sysconf() */
+#include <fcntl.h>   /* open(), posix_fadvise() */
+#include <sys/mman.h>  /* mmap(), posix_madvise() */
+#include <sys/stat.h>  /* fstat() */
+#endif
 
 // ============================
 // ========== buffer ==========
 // ============================
 
+/* Every heap allocation goes through these. A build may define CJSON_MALLOC, CJSON_REALLOC
+ * and CJSON_FREE as names of its own functions, e.g. to count allocations. */
+#ifdef CJSON_MALLOC
+void* CJSON_MALLOC(size_t size);
+void* CJSON_REALLOC(void* p, size_t size);
+void CJSON_FREE(void* p);
+#else
+#define CJSON_MALLOC  malloc
+#define CJSON_REALLOC realloc
+#define CJSON_FREE    free
+#endif
+
+#if defined(_MSC_VER)
+#define CJSON_THREAD_LOCAL __declspec(thread)
+#else
+#define CJSON_THREAD_LOCAL __thread
+#endif
+
+/* With CJSON_STATS defined, the heap helpers below keep per-thread counters; without it
+ * they are plain calls to the allocator and the counters stay zero. Sizes are passed in by
+ * the callers, which all know them, so no allocation carries a hidden size header. */
+#ifdef CJSON_STATS
+static CJSON_THREAD_LOCAL cjson_stats cjson_thread_stats;
+
+static void cjson_stats_grow(size_t old, size_t size) {
+    cjson_stats* s = &cjson_thread_stats;
+    s->bytes_live += (long long)size - (long long)old;
+    if (s->bytes_live > s->bytes_peak)
+        s->bytes_peak = s->bytes_live;
+}
+
+#define CJSON_STATS_ALLOC(size)         (cjson_thread_stats.allocs++, cjson_stats_grow(0, size))
+#define CJSON_STATS_REALLOC(old, size)  (cjson_thread_stats.reallocs++, cjson_stats_grow(old, size))
+#define CJSON_STATS_FREE(size)          (cjson_thread_stats.frees++, cjson_thread_stats.bytes_live -= (long long)(size))
+#define CJSON_STATS_STACK(top) \
+    do { if ((top) > cjson_thread_stats.stack_peak) cjson_thread_stats.stack_peak = (top); } while(0)
+#else
+#define CJSON_STATS_ALLOC(size)         ((void)0)
+#define CJSON_STATS_REALLOC(old, size)  ((void)0)
+#define CJSON_STATS_FREE(size)          ((void)0)
+#define CJSON_STATS_STACK(top)          ((void)0)
+#endif
+
+static void* cjson_heap_alloc(size_t size) {
+    CJSON_STATS_ALLOC(size);
+    return CJSON_MALLOC(size);
+}
+
+/* A NULL p counts as a fresh allocation. */
+static void* cjson_heap_realloc(void* p, size_t old, size_t size) {
+    if (p == NULL)
+        CJSON_STATS_ALLOC(size);
+    else
+        CJSON_STATS_REALLOC(old, size);
+    return CJSON_REALLOC(p, size);
+}
+
+static void cjson_heap_free(void* p, size_t size) {
+    if (p != NULL)
+        CJSON_STATS_FREE(size);
+    CJSON_FREE(p);
+}
+
 const static int CJSON_PARSE_BUFFER_INIT_SIZE = 256;
 const static int CJSON_PARSE_STRINGIFY_INIT_SIZE = 256;
 
 #define PUTC(c, ch)         do { *(char*)cjson_context_push(c, sizeof(char)) = (ch); } while(0)
 #define PUTS(c, s, len)     memcpy(cjson_context_push(c, len), s, len)
 
-typedef struct {
-    const char* json;
-    char* buffer;
-    size_t size, top;
-} cjson_context;
-
 static void* cjson_context_push(cjson_context* c, size_t size) {
     void* ret;
     assert(size > 0);
     if (c->top + size >= c->size) {
+        size_t old = c->buffer != NULL ? c->size : 0;
         if (c->size == 0)
             c->size = CJSON_PARSE_BUFFER_INIT_SIZE;
         while (c->top + size >= c->size)
             c->size += c->size >> 1;  /* c->size * 1.5 */
-        c->buffer = (char*)realloc(c->buffer, c->size);
+        c->buffer = (char*)cjson_heap_realloc(c->buffer, old, c->size);
     }
     ret = c->buffer + c->top;
     c->top += size;
+    CJSON_STATS_STACK(c->top);
     return ret;
 }
 
@@ -50,20 +125,639 @@ static void cjson_context_push_str(cjson_context* c, const char* s, const int le
     memcpy(cjson_context_push(c, len), s, len);
 }
 
+/* Hands the buffer over to the caller, who releases it with free(). */
+static char* cjson_context_detach(cjson_context* c) {
+    CJSON_STATS_FREE(c->size);
+    return c->buffer;
+}
+
 static void* cjson_context_pop(cjson_context* c, size_t size) {
     assert(c->top >= size);
     return c->buffer + (c->top -= size);
 }
 
+// =============================
+// ========== storage ==========
+// =============================
+
+#if defined(_MSC_VER) && defined(_WIN64)
+#include <intrin.h>
+#define CJSON_ATOMIC_ADD(p, n)  ((size_t)_InterlockedExchangeAdd64((volatile __int64*)(p), (__int64)(n)) + (n))
+#define CJSON_ATOMIC_LOAD(p)    (*(volatile size_t*)(p))
+#define CJSON_ATOMIC_STORE(p, n) (*(volatile size_t*)(p) = (n))
+#define CJSON_ATOMIC_CAS(p, old, n) ((size_t)_InterlockedCompareExchange64((volatile __int64*)(p), (__int64)(n), (__int64)(old)) == (old))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define CJSON_ATOMIC_ADD(p, n)  ((size_t)_InterlockedExchangeAdd((volatile long*)(p), (long)(n)) + (n))
+#define CJSON_ATOMIC_LOAD(p)    (*(volatile size_t*)(p))
+#define CJSON_ATOMIC_STORE(p, n) (*(volatile size_t*)(p) = (n))
+#define CJSON_ATOMIC_CAS(p, old, n) ((size_t)_InterlockedCompareExchange((volatile long*)(p), (long)(n), (long)(old)) == (old))
+#else
+#define CJSON_ATOMIC_ADD(p, n)  __atomic_add_fetch((p), (n), __ATOMIC_ACQ_REL)
+#define CJSON_ATOMIC_LOAD(p)    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define CJSON_ATOMIC_STORE(p, n) __atomic_store_n((p), (n), __ATOMIC_RELEASE)
+#define CJSON_ATOMIC_CAS(p, old, n) __sync_bool_compare_and_swap((p), (old), (n))
+#endif
+
+/* Strings, keys and container elements live in blocks prefixed by a reference count,
+ * so that cjson_copy_shared() can share them between trees until one side writes. */
+typedef struct {
+    size_t refs;
+    size_t hash;    /* cached cjson_hash() of the contents, 0 if unknown; odd otherwise */
+    size_t written; /* cjson_write_clock when the contents were last written, see cjson_touch() */
+#ifdef CJSON_STATS
+    size_t size;    /* bytes requested, header included */
+#endif
+#ifdef CJSON_POOL
+    cjson_pool_class* pool; /* size class the block was taken from, NULL if it came from the heap */
+#endif
+} cjson_block;
+
+#define CJSON_BLOCK(p) ((cjson_block*)(p) - 1)
+
+/* Ticks once per cjson_stringify_cached() call. A container whose block was stamped before the
+ * tick of a call has not been written since, nor has anything below it: a write below goes through
+ * writable pointers handed out by every container on its way down, and handing one out stamps. */
+static size_t cjson_write_clock = 1;
+
+#define CJSON_POOL_MIN_SIZE 32      /* smallest class; each next one is twice as big */
+#define CJSON_POOL_SLAB_SIZE 65536
+
+#ifdef CJSON_POOL
+
+static CJSON_THREAD_LOCAL cjson_pool* cjson_thread_pool;
+
+/* Block of at least size bytes, header included, from the pool bound to this thread: a freed one
+ * of its class if any, else carved from the newest slab. NULL if no pool is bound or size is too big. */
+static cjson_block* cjson_pool_take(size_t size) {
+    cjson_pool* p = cjson_thread_pool;
+    cjson_pool_class* c;
+    cjson_block* b;
+    int i = 0;
+    if (p == NULL)
+        return NULL;
+    while (i < CJSON_POOL_CLASSES && p->classes[i].size < size)
+        i++;
+    if (i == CJSON_POOL_CLASSES)
+        return NULL;
+    c = &p->classes[i];
+    if ((b = (cjson_block*)c->free) != NULL) {
+        c->free = *(void**)b;
+        p->reused++;
+    }
+    else {
+        if (p->left < c->size) {    /* the rest of the slab is left unused */
+            void** slab = (void**)cjson_heap_alloc(CJSON_POOL_SLAB_SIZE);
+            *slab = p->slabs;
+            p->slabs = slab;
+            p->next = (char*)slab + CJSON_POOL_MIN_SIZE;   /* past the link, keeping blocks aligned */
+            p->left = CJSON_POOL_SLAB_SIZE - CJSON_POOL_MIN_SIZE;
+        }
+        b = (cjson_block*)p->next;
+        p->next += c->size;
+        p->left -= c->size;
+        p->carved++;
+    }
+    c->live++;
+    b->pool = c;
+    return b;
+}
+#endif
+
+void cjson_pool_init(cjson_pool* p) {
+    assert(p != NULL);
+    memset(p, 0, sizeof(cjson_pool));
+    for (int i = 0; i < CJSON_POOL_CLASSES; i++)
+        p->classes[i].size = (size_t)CJSON_POOL_MIN_SIZE << i;
+}
+
+void cjson_pool_free(cjson_pool* p) {
+    assert(p != NULL);
+#ifdef CJSON_POOL
+    assert(cjson_thread_pool != p && "pool is still bound");
+    for (int i = 0; i < CJSON_POOL_CLASSES; i++)
+        assert(p->classes[i].live == 0 && "documents using the pool must be freed first");
+    while (p->slabs != NULL) {
+        void* next = *(void**)p->slabs;
+        cjson_heap_free(p->slabs, CJSON_POOL_SLAB_SIZE);
+        p->slabs = next;
+    }
+#endif
+    cjson_pool_init(p);
+}
+
+void cjson_pool_bind(cjson_pool* p) {
+#ifdef CJSON_POOL
+    cjson_thread_pool = p;
+#else
+    (void)p;
+#endif
+}
+
+static void* cjson_block_alloc(size_t size) {
+    cjson_block* b;
+#ifdef CJSON_POOL
+    if ((b = cjson_pool_take(sizeof(cjson_block) + size)) == NULL) {
+        b = (cjson_block*)cjson_heap_alloc(sizeof(cjson_block) + size);
+        b->pool = NULL;
+    }
+#else
+    b = (cjson_block*)cjson_heap_alloc(sizeof(cjson_block) + size);
+#endif
+    b->refs = 1;
+    b->hash = 0;
+    b->written = CJSON_ATOMIC_LOAD(&cjson_write_clock);
+#ifdef CJSON_STATS
+    b->size = sizeof(cjson_block) + size;
+#endif
+    return b + 1;
+}
+
+#ifdef CJSON_STATS
+#define CJSON_BLOCK_SIZE(b) ((b)->size)
+#else
+#define CJSON_BLOCK_SIZE(b) ((void)(b), (size_t)0)
+#endif
+
+static void cjson_block_free(void* p) {
+    if (p == NULL)
+        return;
+#ifdef CJSON_POOL
+    if (CJSON_BLOCK(p)->pool != NULL) {  /* back onto its class's free list */
+        cjson_pool_class* c = CJSON_BLOCK(p)->pool;
+        c->live--;
+        *(void**)CJSON_BLOCK(p) = c->free;
+        c->free = CJSON_BLOCK(p);
+        return;
+    }
+#endif
+    cjson_heap_free(CJSON_BLOCK(p), CJSON_BLOCK_SIZE(CJSON_BLOCK(p)));
+}
+
+static void* cjson_block_realloc(void* p, size_t size) {
+    cjson_block* b;
+    if (p == NULL)
+        return size > 0 ? cjson_block_alloc(size) : NULL;
+    assert(CJSON_BLOCK(p)->refs == 1 && "shared storage must be unshared before resizing");
+    if (size == 0) {
+        cjson_block_free(p);
+        return NULL;
+    }
+#ifdef CJSON_POOL
+    if (CJSON_BLOCK(p)->pool != NULL) {
+        size_t old = CJSON_BLOCK(p)->pool->size - sizeof(cjson_block);
+        void* q;
+        if (size <= old)    /* still fits its class */
+            return p;
+        q = cjson_block_alloc(size);
+        memcpy(q, p, old);
+        CJSON_BLOCK(q)->hash = CJSON_BLOCK(p)->hash;
+        cjson_block_free(p);
+        return q;
+    }
+#endif
+    b = (cjson_block*)cjson_heap_realloc(CJSON_BLOCK(p), CJSON_BLOCK_SIZE(CJSON_BLOCK(p)), sizeof(cjson_block) + size);
+#ifdef CJSON_STATS
+    b->size = sizeof(cjson_block) + size;
+#endif
+    return b + 1;
+}
+
+static void cjson_block_retain(const void* p) {
+    if (p)
+        CJSON_ATOMIC_ADD(&CJSON_BLOCK(p)->refs, 1);
+}
+
+/* Drops a reference; returns non-zero if it was the last one, in which case the
+ * caller releases what the block refers to and then calls cjson_block_free(). */
+static int cjson_block_unref(const void* p) {
+    if (p == NULL || CJSON_ATOMIC_LOAD(&CJSON_BLOCK(p)->refs) == 1)
+        return 1;   /* sole owner, nobody else can race with us */
+    return CJSON_ATOMIC_ADD(&CJSON_BLOCK(p)->refs, (size_t)-1) == 0;
+}
+
+static int cjson_block_is_shared(const void* p) {
+    return p != NULL && CJSON_ATOMIC_LOAD(&CJSON_BLOCK(p)->refs) > 1;
+}
+
+static char* cjson_string_dup(const char* s, size_t len) {
+    char* p = (char*)cjson_block_alloc(len + 1);
+    if (len)
+        memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+static void cjson_string_release(char* s) {
+    if (cjson_block_unref(s))
+        cjson_block_free(s);
+}
+
+static size_t cjson_hash_mix(size_t h) {
+    unsigned long long x = h;  /* splitmix64 finalizer */
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (size_t)x;
+}
+
+static size_t cjson_hash_bytes(const char* s, size_t len) {
+    unsigned long long h = 0xCBF29CE484222325ULL ^ len, w;
+    for (; len >= 8; s += 8, len -= 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ cjson_hash_mix((size_t)w)) * 0x100000001B3ULL;
+    }
+    for (; len > 0; s++, len--)
+        h = (h ^ (unsigned char)*s) * 0x100000001B3ULL;
+    return cjson_hash_mix((size_t)h);
+}
+
+/* Byte-wise key order, a prefix first. */
+static int cjson_key_compare(const char* a, size_t alen, const char* b, size_t blen) {
+    int ret = memcmp(a, b, alen < blen ? alen : blen);
+    return ret != 0 ? ret : (alen > blen) - (alen < blen);
+}
+
+/* Hash of a string or key as cached in its block; never 0, which marks "not computed". */
+static size_t cjson_hash_key(const char* s, size_t len) {
+    size_t h = cjson_hash_bytes(s, len);
+    return h != 0 ? h : 1;
+}
+
+/* A raw number is the literal as a string, followed at the next 8-byte boundary by
+ * its decoded value once cjson_get_number() has been called. */
+typedef struct {
+    size_t state;   /* CJSON_RAW_PENDING, CJSON_RAW_DECODING or CJSON_RAW_READY */
+    double num;
+} cjson_raw_cache;
+
+enum { CJSON_RAW_PENDING, CJSON_RAW_DECODING, CJSON_RAW_READY };
+
+#define CJSON_RAW_TEXT_SIZE(len)    (((len) + 8) & ~(size_t)7)
+#define CJSON_RAW_CACHE(s, len)     ((cjson_raw_cache*)((s) + CJSON_RAW_TEXT_SIZE(len)))
+
+static char* cjson_raw_dup(const char* s, size_t len) {
+    char* p = (char*)cjson_block_alloc(CJSON_RAW_TEXT_SIZE(len) + sizeof(cjson_raw_cache));
+    memcpy(p, s, len);
+    p[len] = '\0';
+    CJSON_RAW_CACHE(p, len)->state = CJSON_RAW_PENDING;
+    return p;
+}
+
+/* Storage forms a value can take besides the one its type implies, kept in cjson_value.form
+ * so that the type field and cjson_get_type() keep reporting the plain type. */
+enum {
+    CJSON_RAW_NUMBER = CJSON_OBJECT + 1,    /* a CJSON_NUMBER kept as its literal in data.str */
+    CJSON_NUMBER_ARRAY,     /* a CJSON_ARRAY of numbers packed as double[] in data.nums */
+    CJSON_FROZEN_OBJECT     /* a CJSON_OBJECT with members sorted by key, see cjson_freeze() */
+};
+
+/* The form if v has one, else its type: what switches over the layout of data look at. */
+#define CJSON_FORM(v) ((v)->form != 0 ? (int)(v)->form : (int)(v)->type)
+
+#define CJSON_IS_ARRAY(v)  ((v)->type == CJSON_ARRAY)
+#define CJSON_IS_OBJECT(v) ((v)->type == CJSON_OBJECT)
+#define CJSON_IS_CONTAINER(v) (CJSON_FORM(v) == CJSON_ARRAY || CJSON_IS_OBJECT(v))  /* holds cjson_values, unlike a packed array */
+
+/* Heap block owned by v, NULL for scalars and empty containers. */
+static void* cjson_storage(const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_STRING: return v->data.str.s;
+        case CJSON_RAW_NUMBER: return v->data.str.s;
+        case CJSON_ARRAY:  return v->data.arr.elem;
+        case CJSON_NUMBER_ARRAY: return v->data.nums.elem;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT: return v->data.obj.memb;
+        default: return NULL;
+    }
+}
+
+/* Adds a reference to the storage owned by v, which is about to be duplicated bitwise. */
+static void cjson_retain(const cjson_value* v) {
+    cjson_block_retain(cjson_storage(v));
+}
+
+/* Gives v exclusive ownership of its elements or members before they are modified.
+ * Only the top level is copied; children become shared between the old and new storage. */
+static void cjson_unshare(cjson_value* v) {
+    if (CJSON_FORM(v) == CJSON_ARRAY && cjson_block_is_shared(v->data.arr.elem)) {
+        cjson_value* old = v->data.arr.elem;
+        cjson_value* e = (cjson_value*)cjson_block_alloc(v->data.arr.capacity * sizeof(cjson_value));
+        memcpy(e, old, v->data.arr.size * sizeof(cjson_value));
+        for (size_t i = 0; i < v->data.arr.size; ++i)
+            cjson_retain(&e[i]);
+        v->data.arr.elem = e;
+        if (cjson_block_unref(old)) {
+            for (size_t i = 0; i < v->data.arr.size; ++i)
+                cjson_free(&old[i]);
+            cjson_block_free(old);
+        }
+    }
+    else if (CJSON_IS_OBJECT(v) && cjson_block_is_shared(v->data.obj.memb)) {
+        cjson_member* old = v->data.obj.memb;
+        cjson_member* m = (cjson_member*)cjson_block_alloc(v->data.obj.capacity * sizeof(cjson_member));
+        memcpy(m, old, v->data.obj.size * sizeof(cjson_member));
+        for (size_t i = 0; i < v->data.obj.size; ++i) {
+            cjson_block_retain(m[i].k);
+            cjson_retain(&m[i].v);
+        }
+        v->data.obj.memb = m;
+        if (cjson_block_unref(old)) {
+            for (size_t i = 0; i < v->data.obj.size; ++i) {
+                cjson_string_release(old[i].k);
+                cjson_free(&old[i].v);
+            }
+            cjson_block_free(old);
+        }
+    }
+    else if (v->form == CJSON_NUMBER_ARRAY && cjson_block_is_shared(v->data.nums.elem)) {
+        double* old = v->data.nums.elem;
+        v->data.nums.elem = (double*)cjson_block_alloc(v->data.nums.capacity * sizeof(double));
+        memcpy(v->data.nums.elem, old, v->data.nums.size * sizeof(double));
+        if (cjson_block_unref(old))
+            cjson_block_free(old);
+    }
+}
+
+/* Prepares v for a write, or for handing out a pointer to a child the caller may write through:
+ * unshares its storage, stamps it and drops the cached hash. Writes through such a pointer after a
+ * later cjson_hash() or cjson_stringify_cached() go unseen, hence fetching pointers again after one. */
+static void cjson_touch(cjson_value* v) {
+    void* storage;
+    cjson_unshare(v);
+    if ((storage = cjson_storage(v)) == NULL)
+        return;
+    CJSON_BLOCK(storage)->written = CJSON_ATOMIC_LOAD(&cjson_write_clock);
+    CJSON_BLOCK(storage)->hash = 0;
+}
+
+/* Packs n values into v, which must be null, if they are all numbers; returns 0 otherwise. */
+static int cjson_pack(cjson_value* v, const cjson_value* e, size_t n) {
+    double* nums;
+    if (n == 0)
+        return 0;
+    for (size_t i = 0; i < n; ++i)
+        if (CJSON_FORM(&e[i]) != CJSON_NUMBER)
+            return 0;
+    nums = (double*)cjson_block_alloc(n * sizeof(double));
+    for (size_t i = 0; i < n; ++i)
+        nums[i] = e[i].data.num;
+    v->data.nums.elem = nums;
+    v->data.nums.size = v->data.nums.capacity = n;
+    v->type = CJSON_ARRAY;
+    v->form = CJSON_NUMBER_ARRAY;
+    return 1;
+}
+
+/* Turns a packed array into a generic one before its elements are handed out or changed. */
+static void cjson_unpack(cjson_value* v) {
+    double* nums;
+    cjson_value* e;
+    if (v->form != CJSON_NUMBER_ARRAY)
+        return;
+    nums = v->data.nums.elem;
+    e = v->data.nums.capacity > 0 ? (cjson_value*)cjson_block_alloc(v->data.nums.capacity * sizeof(cjson_value)) : NULL;
+    for (size_t i = 0; i < v->data.nums.size; ++i) {
+        cjson_init(&e[i]);
+        e[i].type = CJSON_NUMBER;
+        e[i].data.num = nums[i];
+    }
+    v->form = 0;
+    v->data.arr.elem = e;   /* size and capacity carry over */
+    v->data.arr.size = v->data.nums.size;
+    v->data.arr.capacity = v->data.nums.capacity;
+    if (cjson_block_unref(nums))
+        cjson_block_free(nums);
+}
+
+// ===========================
+// ========== trace ==========
+// ===========================
+
+/* With CJSON_TRACE defined, the parser and generator charge cycles and bytes to the phase
+ * that is running. A phase entered inside another one (a string inside an array) pauses the
+ * outer phase, so every cycle and byte is charged to exactly one phase. */
+#ifdef CJSON_TRACE
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CJSON_TRACE_CYCLES() __rdtsc()
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CJSON_TRACE_CYCLES() __rdtsc()
+#elif defined(__aarch64__)
+static unsigned long long cjson_trace_cycles(void) {
+    unsigned long long t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+}
+#define CJSON_TRACE_CYCLES() cjson_trace_cycles()
+#else
+#include <time.h>
+#define CJSON_TRACE_CYCLES() ((unsigned long long)clock())
+#endif
+
+typedef struct {
+    cjson_trace total;
+    int phase;                  /* phase being charged, -1 outside the library */
+    unsigned long long mark;    /* counter at the last phase change */
+    size_t pos;                 /* input address or output offset at the last phase change */
+    cjson_trace_callback callback;
+    void* user;
+} cjson_trace_state;
+
+static CJSON_THREAD_LOCAL cjson_trace_state cjson_thread_trace = {{{{0, 0, 0}}}, -1, 0, 0, NULL, NULL};
+
+static void cjson_trace_charge(size_t pos) {
+    cjson_trace_state* t = &cjson_thread_trace;
+    unsigned long long now = CJSON_TRACE_CYCLES();
+    if (t->phase >= 0) {
+        t->total.phase[t->phase].cycles += now - t->mark;
+        t->total.phase[t->phase].bytes += pos - t->pos;
+    }
+    t->mark = now;
+    t->pos = pos;
+}
+
+static int cjson_trace_enter(int phase, size_t pos) {
+    int outer = cjson_thread_trace.phase;
+    cjson_trace_charge(pos);
+    cjson_thread_trace.phase = phase;
+    cjson_thread_trace.total.phase[phase].calls++;
+    return outer;
+}
+
+static void cjson_trace_leave(int outer, size_t pos) {
+    cjson_trace_charge(pos);
+    cjson_thread_trace.phase = outer;
+}
+
+static void cjson_trace_document_begin(cjson_trace* start) {
+    if (cjson_thread_trace.callback)
+        *start = cjson_thread_trace.total;
+}
+
+static void cjson_trace_document_end(const cjson_trace* start, const char* operation, size_t bytes) {
+    cjson_trace doc;
+    if (cjson_thread_trace.callback == NULL)
+        return;
+    for (int i = 0; i < CJSON_PHASE_COUNT; ++i) {
+        doc.phase[i].cycles = cjson_thread_trace.total.phase[i].cycles - start->phase[i].cycles;
+        doc.phase[i].bytes = cjson_thread_trace.total.phase[i].bytes - start->phase[i].bytes;
+        doc.phase[i].calls = cjson_thread_trace.total.phase[i].calls - start->phase[i].calls;
+    }
+    cjson_thread_trace.callback(operation, &doc, bytes, cjson_thread_trace.user);
+}
+
+static int cjson_trace_value_phase(char ch) {
+    switch (ch) {
+        case '"': return CJSON_PHASE_STRING;
+        case '[': return CJSON_PHASE_ARRAY;
+        case '{': return CJSON_PHASE_OBJECT;
+        case 't': case 'f': case 'n': case '\0': return CJSON_PHASE_LITERAL;
+        default:  return CJSON_PHASE_NUMBER;
+    }
+}
+
+static int cjson_trace_stringify_phase(int form) {
+    switch (form) {
+        case CJSON_NUMBER: return CJSON_PHASE_STRINGIFY_NUMBER;
+        case CJSON_RAW_NUMBER: return CJSON_PHASE_STRINGIFY_NUMBER;
+        case CJSON_NUMBER_ARRAY: return CJSON_PHASE_STRINGIFY;
+        case CJSON_STRING: return CJSON_PHASE_STRINGIFY_STRING;
+        default:           return CJSON_PHASE_STRINGIFY;
+    }
+}
+
+#define CJSON_TRACE_BEGIN(outer, phase, pos)    int outer = cjson_trace_enter(phase, (size_t)(pos))
+#define CJSON_TRACE_END(outer, pos)             cjson_trace_leave(outer, (size_t)(pos))
+#define CJSON_TRACE_ENTER(phase, pos)           cjson_trace_enter(phase, (size_t)(pos))
+#define CJSON_TRACE_LEAVE(outer, pos)           cjson_trace_leave(outer, (size_t)(pos))
+#define CJSON_TRACE_DOCUMENT_BEGIN(start)       cjson_trace start; cjson_trace_document_begin(&start)
+#define CJSON_TRACE_DOCUMENT_END(start, operation, bytes) cjson_trace_document_end(&start, operation, bytes)
+#else
+#define CJSON_TRACE_BEGIN(outer, phase, pos)
+#define CJSON_TRACE_END(outer, pos)             ((void)0)
+#define CJSON_TRACE_ENTER(phase, pos)           0
+#define CJSON_TRACE_LEAVE(outer, pos)           ((void)(outer))
+#define CJSON_TRACE_DOCUMENT_BEGIN(start)
+#define CJSON_TRACE_DOCUMENT_END(start, operation, bytes) ((void)0)
+#endif
+
+void cjson_get_trace(cjson_trace* t) {
+    assert(t != NULL);
+#ifdef CJSON_TRACE
+    *t = cjson_thread_trace.total;
+#else
+    memset(t, 0, sizeof(cjson_trace));
+#endif
+}
+
+void cjson_reset_trace(void) {
+#ifdef CJSON_TRACE
+    memset(&cjson_thread_trace.total, 0, sizeof(cjson_trace));
+#endif
+}
+
+void cjson_set_trace_callback(cjson_trace_callback callback, void* user) {
+#ifdef CJSON_TRACE
+    cjson_thread_trace.callback = callback;
+    cjson_thread_trace.user = user;
+#else
+    (void)callback;
+    (void)user;
+#endif
+}
+
 // ============================
 // ========== parser ==========
 // ============================
 
+#define CJSON_KEY_TABLE_MAX 4096   /* distinct keys shared per parse; further ones get their own storage */
+
+typedef struct {
+    char* k;
+    size_t klen;
+} cjson_key_slot;
+
+/* Keys seen by a parse with CJSON_PARSE_SHARE_KEYS, each holding a reference to its storage. */
+struct cjson_key_table {
+    cjson_key_slot* slots;
+    size_t size, mask;
+};
+
+static void cjson_key_table_add(struct cjson_key_table* t, char* k, size_t klen, size_t h) {
+    size_t j = h & t->mask;
+    while (t->slots[j].k != NULL)
+        j = (j + 1) & t->mask;
+    t->slots[j].k = k;
+    t->slots[j].klen = klen;
+    t->size++;
+}
+
+static void cjson_key_table_grow(struct cjson_key_table* t) {
+    struct cjson_key_table old = *t;
+    size_t capacity = old.slots != NULL ? (old.mask + 1) * 2 : 64;
+    t->slots = (cjson_key_slot*)cjson_heap_alloc(capacity * sizeof(cjson_key_slot));
+    memset(t->slots, 0, capacity * sizeof(cjson_key_slot));
+    t->size = 0;
+    t->mask = capacity - 1;
+    if (old.slots != NULL) {
+        for (size_t j = 0; j <= old.mask; j++)
+            if (old.slots[j].k != NULL)
+                cjson_key_table_add(t, old.slots[j].k, old.slots[j].klen, CJSON_BLOCK(old.slots[j].k)->hash);
+        cjson_heap_free(old.slots, (old.mask + 1) * sizeof(cjson_key_slot));
+    }
+}
+
+/* Storage for a parsed key, the same block for every occurrence of the same key. */
+static char* cjson_parse_key(cjson_context* c, const char* s, size_t len) {
+    struct cjson_key_table* t = c->keys;
+    size_t h, j;
+    char* k;
+    if (!(c->flags & CJSON_PARSE_SHARE_KEYS))
+        return cjson_string_dup(s, len);
+    if (t == NULL) {
+        t = c->keys = (struct cjson_key_table*)cjson_heap_alloc(sizeof(struct cjson_key_table));
+        t->slots = NULL;
+        cjson_key_table_grow(t);
+    }
+    h = cjson_hash_key(s, len);
+    for (j = h & t->mask; t->slots[j].k != NULL; j = (j + 1) & t->mask) {
+        k = t->slots[j].k;
+        if (CJSON_BLOCK(k)->hash == h && t->slots[j].klen == len && memcmp(k, s, len) == 0) {
+            cjson_block_retain(k);
+            return k;
+        }
+    }
+    k = cjson_string_dup(s, len);
+    CJSON_BLOCK(k)->hash = h;   /* saves hashing it again for lookups and equality */
+    if (t->size < CJSON_KEY_TABLE_MAX) {
+        if ((t->size + 1) * 2 > t->mask + 1)
+            cjson_key_table_grow(t);
+        cjson_block_retain(k);
+        cjson_key_table_add(t, k, len, h);
+    }
+    return k;
+}
+
+static void cjson_key_table_free(cjson_context* c) {
+    struct cjson_key_table* t = c->keys;
+    if (t == NULL)
+        return;
+    for (size_t j = 0; j <= t->mask; j++)
+        cjson_string_release(t->slots[j].k);
+    cjson_heap_free(t->slots, (t->mask + 1) * sizeof(cjson_key_slot));
+    cjson_heap_free(t, sizeof(struct cjson_key_table));
+    c->keys = NULL;
+}
+
 static void cjson_parse_whitespace(cjson_context* c) {
     const char *p = c->json;
+    CJSON_TRACE_BEGIN(outer, CJSON_PHASE_WHITESPACE, p);
     while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
         p++;
     c->json = p;
+    CJSON_TRACE_END(outer, p);
 }
 
 static int cjson_parse_literal(cjson_context* c, cjson_value* v, const char* literal, cjson_type type) {
@@ -96,6 +790,14 @@ static int cjson_parse_number(cjson_context* c, cjson_value* v) {
         while (*p >= '0' && *p <= '9') p++;
     }
 
+    if (c->flags & CJSON_PARSE_RAW_NUMBERS) {
+        v->data.str.len = p - c->json;
+        v->data.str.s = cjson_raw_dup(c->json, v->data.str.len);
+        c->json = p;
+        v->type = CJSON_NUMBER;
+        v->form = CJSON_RAW_NUMBER;
+        return CJSON_PARSE_OK;
+    }
     errno = 0;
     v->data.num = strtod(c->json, NULL);
     if (errno == ERANGE && (v->data.num == HUGE_VAL || v->data.num == -HUGE_VAL))
@@ -248,10 +950,13 @@ static int cjson_parse_array(cjson_context* c, cjson_value* v) {
             cjson_parse_whitespace(c);
         }
         else if (*c->json == ']') {
+            cjson_value* e = (cjson_value*)cjson_context_pop(c, sizeof(cjson_value) * size);
             c->json++;
-            cjson_set_array(v, size);
-            v->data.arr.size = size;
-            memcpy(v->data.arr.elem, cjson_context_pop(c, sizeof(cjson_value) * size),sizeof(cjson_value) * size);
+            if (!(c->flags & CJSON_PARSE_PACK_NUMBERS) || !cjson_pack(v, e, size)) {
+                cjson_set_array(v, size);
+                v->data.arr.size = size;
+                memcpy(v->data.arr.elem, e, sizeof(cjson_value) * size);
+            }
             return CJSON_PARSE_OK;
         }
         else {
@@ -289,10 +994,14 @@ static int cjson_parse_object(cjson_context* c, cjson_value* v) {
             break;
         }
         char* str;
-        if ((ret = cjson_parse_string_raw(c, &str, &m.klen)) != CJSON_PARSE_OK)
+        {
+            CJSON_TRACE_BEGIN(outer, CJSON_PHASE_STRING, c->json);
+            ret = cjson_parse_string_raw(c, &str, &m.klen);
+            CJSON_TRACE_END(outer, c->json);
+        }
+        if (ret != CJSON_PARSE_OK)
             break;
-        memcpy(m.k = (char*)malloc(m.klen + 1), str, m.klen);
-        m.k[m.klen] = '\0';
+        m.k = cjson_parse_key(c, str, m.klen);
         
         /* parse ws colon ws */
         cjson_parse_whitespace(c);
@@ -329,463 +1038,4688 @@ static int cjson_parse_object(cjson_context* c, cjson_value* v) {
         }
     }
     /* Pop and free members on the buffer */
-    free(m.k);
+    cjson_string_release(m.k);
     for (size_t i = 0; i < size; ++i) {
         cjson_member* m = (cjson_member*)cjson_context_pop(c, sizeof(cjson_member));
-        free(m->k);
+        cjson_string_release(m->k);
         cjson_free(&m->v);
     }
-    v->type = CJSON_NULL;
+    cjson_init(v);
     return ret;
 }
 
 static int cjson_parse_value(cjson_context* c, cjson_value* v) {
+    int ret;
+    CJSON_TRACE_BEGIN(outer, cjson_trace_value_phase(*c->json), c->json);
     switch (*c->json) {
-        case 't':  return cjson_parse_literal(c, v, "true", CJSON_TRUE);
-        case 'f':  return cjson_parse_literal(c, v, "false", CJSON_FALSE);
-        case 'n':  return cjson_parse_literal(c, v, "null", CJSON_NULL);
-        default:   return cjson_parse_number(c, v);
-        case '"':  return cjson_parse_string(c, v);
-        case '[':  return cjson_parse_array(c, v);
-        case '{':  return cjson_parse_object(c, v);
-        case '\0': return CJSON_PARSE_EXPECT_VALUE;
+        case 't':  ret = cjson_parse_literal(c, v, "true", CJSON_TRUE); break;
+        case 'f':  ret = cjson_parse_literal(c, v, "false", CJSON_FALSE); break;
+        case 'n':  ret = cjson_parse_literal(c, v, "null", CJSON_NULL); break;
+        default:   ret = cjson_parse_number(c, v); break;
+        case '"':  ret = cjson_parse_string(c, v); break;
+        case '[':  ret = cjson_parse_array(c, v); break;
+        case '{':  ret = cjson_parse_object(c, v); break;
+        case '\0': ret = CJSON_PARSE_EXPECT_VALUE; break;
     }
+    CJSON_TRACE_END(outer, c->json);
+    return ret;
 }
 
-int cjson_parse(cjson_value* v, const char* json) {
+/* end, when given, is where json's terminator must be: input with an embedded '\0'
+ * would otherwise look complete as soon as the parser reaches it. */
+static int cjson_parse_range(cjson_value* v, const char* json, const char* end, int flags) {
     int ret;
 
     assert(v != NULL);
-    v->type = CJSON_NULL;
+    cjson_init(v);
+    CJSON_TRACE_DOCUMENT_BEGIN(start);
     
     cjson_context c;
     c.json = json;
     c.buffer = NULL;
     c.size = c.top = 0;
+    c.flags = flags;
+    c.keys = NULL;
 
     cjson_parse_whitespace(&c);
     if ((ret = cjson_parse_value(&c, v)) == CJSON_PARSE_OK) {
         cjson_parse_whitespace(&c);
-        if (*c.json != '\0') {
-            v->type = CJSON_NULL;
+        if (*c.json != '\0' || (end != NULL && c.json != end)) {
+            cjson_free(v);
             ret = CJSON_PARSE_ROOT_NOT_SINGULAR;
         }
     }
     assert(c.top == 0);
-    free(c.buffer);
+    cjson_heap_free(c.buffer, c.size);
+    cjson_key_table_free(&c);
+    CJSON_TRACE_DOCUMENT_END(start, "parse", (size_t)(c.json - json));
     return ret;
 }
-// ===============================
-// ========== generator ==========
-// ===============================
 
-static void cjson_stringify_string(cjson_context* c, const char* s, size_t len) {
-    static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-    assert(s != NULL);
-    size_t size;
-    char* head, *p;
-    p = head = cjson_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-    
-    *p++ = '"';
-    for (size_t i = 0; i < len; ++i) {
-        unsigned char ch = (unsigned char)s[i];
-        switch (ch) {
-            case '\"': *p++ = '\\'; *p++ = '\"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\b': *p++ = '\\'; *p++ = 'b';  break;
-            case '\f': *p++ = '\\'; *p++ = 'f';  break;
-            case '\n': *p++ = '\\'; *p++ = 'n';  break;
-            case '\r': *p++ = '\\'; *p++ = 'r';  break;
-            case '\t': *p++ = '\\'; *p++ = 't';  break;
-            default:
-                if (ch < 0x20) {
-                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
-                    *p++ = hex_digits[ch >> 4];
-                    *p++ = hex_digits[ch & 15];
-                }
-                else
-                    *p++ = s[i];
-        }
-    }
-    *p++ = '"';
-    c->top -= size - (p - head);
+int cjson_parse(cjson_value* v, const char* json) {
+    return cjson_parse_range(v, json, NULL, 0);
 }
 
-static void cjson_stringify_value(cjson_context* c, const cjson_value* v) {
-    switch (v->type) {
-        case CJSON_NULL:   cjson_context_push_str(c, "null", 4); break;
-        case CJSON_FALSE:  cjson_context_push_str(c, "false", 5); break;
-        case CJSON_TRUE:   cjson_context_push_str(c, "true", 4); break;
-        case CJSON_NUMBER: c->top -= 32 - sprintf(cjson_context_push(c, 32), "%.17g", v->data.num); break;
-        case CJSON_STRING: cjson_stringify_string(c, v->data.str.s, v->data.str.len); break;
-        case CJSON_ARRAY:
-            cjson_context_push_char(c, '[');
-            for (size_t i = 0; i < v->data.arr.size; i++) {
-                if (i > 0)
-                    cjson_context_push_char(c, ',');
-                cjson_stringify_value(c, &v->data.arr.elem[i]);
+int cjson_parse_flags(cjson_value* v, const char* json, int flags) {
+    return cjson_parse_range(v, json, NULL, flags);
+}
+
+/* Resumable parsing keeps on the stack what the recursive parser keeps in its call frames:
+ * each open container pushes a frame, its finished elements go above it, and the frame
+ * records where its parent's frame is. */
+typedef struct {
+    size_t prev;        /* offset of the enclosing frame */
+    size_t size;        /* finished elements above this frame */
+    cjson_type type;    /* CJSON_ARRAY or CJSON_OBJECT */
+    char* k;            /* key of the member being parsed */
+    size_t klen;
+} cjson_parse_frame;
+
+#define CJSON_PARSER_NO_FRAME ((size_t)-1)
+#define CJSON_PARSER_FRAME(p) ((cjson_parse_frame*)((p)->c.buffer + (p)->frame))
+
+enum {
+    CJSON_PARSER_VALUE,     /* a value is expected, whitespace already skipped */
+    CJSON_PARSER_KEY,       /* a member key is expected, whitespace already skipped */
+    CJSON_PARSER_NEXT,      /* a comma or the closing bracket of the innermost container is expected */
+    CJSON_PARSER_DONE
+};
+
+void cjson_parser_init(cjson_parser* p, cjson_value* v, const char* json, int flags) {
+    assert(p != NULL && v != NULL && json != NULL);
+    cjson_init(v);
+    p->v = v;
+    p->c.json = json;
+    p->c.buffer = NULL;
+    p->c.size = p->c.top = 0;
+    p->c.flags = flags;
+    p->c.keys = NULL;
+    p->frame = CJSON_PARSER_NO_FRAME;
+    p->state = CJSON_PARSER_VALUE;
+    p->ret = CJSON_PARSE_OK;
+    cjson_parse_whitespace(&p->c);
+}
+
+/* Frees the open containers and everything parsed into them, then releases the stack. */
+static void cjson_parser_finish(cjson_parser* p, int ret) {
+    cjson_context* c = &p->c;
+    while (p->frame != CJSON_PARSER_NO_FRAME) {
+        cjson_parse_frame f = *CJSON_PARSER_FRAME(p);
+        for (size_t i = 0; i < f.size; ++i) {
+            if (f.type == CJSON_ARRAY)
+                cjson_free((cjson_value*)cjson_context_pop(c, sizeof(cjson_value)));
+            else {
+                cjson_member* m = (cjson_member*)cjson_context_pop(c, sizeof(cjson_member));
+                cjson_string_release(m->k);
+                cjson_free(&m->v);
             }
-            cjson_context_push_char(c, ']');
-            break;
-        case CJSON_OBJECT:
-            cjson_context_push_char(c, '{');
-            for (size_t i = 0; i < v->data.obj.size; i++) {
-                if (i > 0)
-                    cjson_context_push_char(c, ',');
-                cjson_stringify_string(c, v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
-                cjson_context_push_char(c, ':');
-                cjson_stringify_value(c, &v->data.obj.memb[i].v);
-            }
-            cjson_context_push_char(c, '}');
-            break;            
-        default: assert(0 && "invalid type");
+        }
+        cjson_string_release(f.k);
+        cjson_context_pop(c, sizeof(cjson_parse_frame));
+        p->frame = f.prev;
     }
+    assert(c->top == 0);
+    cjson_heap_free(c->buffer, c->size);
+    cjson_key_table_free(c);
+    c->buffer = NULL;
+    c->size = 0;
+    p->ret = ret;
+    p->state = CJSON_PARSER_DONE;
 }
 
-char* cjson_stringify(const cjson_value* v, size_t* len) {
-    cjson_context c;
-    assert(v != NULL);
-    c.buffer = (char*)malloc(c.size = CJSON_PARSE_STRINGIFY_INIT_SIZE);
-    c.top = 0;
-    cjson_stringify_value(&c, v);
-    if (len) *len = c.top;
-    cjson_context_push_char(&c, '\0');
-    return c.buffer;
+static void cjson_parser_open(cjson_parser* p, cjson_type type) {
+    cjson_parse_frame* f = (cjson_parse_frame*)cjson_context_push(&p->c, sizeof(cjson_parse_frame));
+    f->prev = p->frame;
+    f->size = 0;
+    f->type = type;
+    f->k = NULL;
+    p->frame = p->c.top - sizeof(cjson_parse_frame);
+    p->state = type == CJSON_ARRAY ? CJSON_PARSER_VALUE : CJSON_PARSER_KEY;
 }
 
-// ==============================
-// ========== accessor ==========
-// ==============================
+/* Hands a finished value to the innermost container, or to the caller at the root. */
+static void cjson_parser_complete(cjson_parser* p, const cjson_value* e) {
+    cjson_context* c = &p->c;
+    if (p->frame == CJSON_PARSER_NO_FRAME) {
+        memcpy(p->v, e, sizeof(cjson_value));
+        cjson_parse_whitespace(c);
+        if (*c->json != '\0') {
+            cjson_free(p->v);
+            cjson_parser_finish(p, CJSON_PARSE_ROOT_NOT_SINGULAR);
+        }
+        else
+            cjson_parser_finish(p, CJSON_PARSE_OK);
+    }
+    else if (CJSON_PARSER_FRAME(p)->type == CJSON_ARRAY) {
+        memcpy(cjson_context_push(c, sizeof(cjson_value)), e, sizeof(cjson_value));
+        CJSON_PARSER_FRAME(p)->size++;
+        p->state = CJSON_PARSER_NEXT;
+    }
+    else {
+        cjson_member* m = (cjson_member*)cjson_context_push(c, sizeof(cjson_member));
+        cjson_parse_frame* f = CJSON_PARSER_FRAME(p);
+        m->k = f->k;
+        m->klen = f->klen;
+        memcpy(&m->v, e, sizeof(cjson_value));
+        f->k = NULL;    /* ownership is transferred to member on buffer */
+        f->size++;
+        p->state = CJSON_PARSER_NEXT;
+    }
+}
 
-void cjson_copy(cjson_value* dst, const cjson_value* src) {
-    assert(src != NULL && dst != NULL && src != dst);
-    switch (src->type) {
-        case CJSON_STRING:
-            cjson_set_string(dst, src->data.str.s, src->data.str.len);
+/* Pops the innermost container's elements into a value, like the tail of cjson_parse_array/object(). */
+static void cjson_parser_close(cjson_parser* p) {
+    cjson_parse_frame f = *CJSON_PARSER_FRAME(p);
+    cjson_value e;
+    cjson_init(&e);
+    if (f.type == CJSON_ARRAY) {
+        cjson_value* elem = (cjson_value*)cjson_context_pop(&p->c, sizeof(cjson_value) * f.size);
+        if (!(p->c.flags & CJSON_PARSE_PACK_NUMBERS) || !cjson_pack(&e, elem, f.size)) {
+            cjson_set_array(&e, f.size);
+            e.data.arr.size = f.size;
+            memcpy(e.data.arr.elem, elem, sizeof(cjson_value) * f.size);
+        }
+    }
+    else {
+        cjson_set_object(&e, f.size);
+        e.data.obj.size = f.size;
+        memcpy(e.data.obj.memb, cjson_context_pop(&p->c, sizeof(cjson_member) * f.size), sizeof(cjson_member) * f.size);
+    }
+    cjson_context_pop(&p->c, sizeof(cjson_parse_frame));
+    p->frame = f.prev;
+    cjson_parser_complete(p, &e);
+}
+
+static void cjson_parser_value(cjson_parser* p) {
+    cjson_context* c = &p->c;
+    cjson_value e;
+    int ret;
+    cjson_init(&e);
+    if (*c->json == '[' || *c->json == '{') {
+        cjson_type type = *c->json == '[' ? CJSON_ARRAY : CJSON_OBJECT;
+        CJSON_TRACE_BEGIN(outer, type == CJSON_ARRAY ? CJSON_PHASE_ARRAY : CJSON_PHASE_OBJECT, c->json);
+        c->json++;
+        cjson_parse_whitespace(c);
+        if (*c->json == (type == CJSON_ARRAY ? ']' : '}')) {
+            c->json++;
+            if (type == CJSON_ARRAY)
+                cjson_set_array(&e, 0);
+            else
+                cjson_set_object(&e, 0);
+            cjson_parser_complete(p, &e);
+        }
+        else
+            cjson_parser_open(p, type);
+        CJSON_TRACE_END(outer, c->json);
+    }
+    else if ((ret = cjson_parse_value(c, &e)) == CJSON_PARSE_OK)
+        cjson_parser_complete(p, &e);
+    else
+        cjson_parser_finish(p, ret);
+}
+
+static void cjson_parser_key(cjson_parser* p) {
+    cjson_context* c = &p->c;
+    char* str;
+    size_t klen;
+    int ret;
+    if (*c->json != '"') {
+        cjson_parser_finish(p, CJSON_PARSE_MISS_KEY);
+        return;
+    }
+    {
+        CJSON_TRACE_BEGIN(outer, CJSON_PHASE_STRING, c->json);
+        ret = cjson_parse_string_raw(c, &str, &klen);
+        CJSON_TRACE_END(outer, c->json);
+    }
+    if (ret != CJSON_PARSE_OK) {
+        cjson_parser_finish(p, ret);
+        return;
+    }
+    CJSON_PARSER_FRAME(p)->k = cjson_parse_key(c, str, klen);
+    CJSON_PARSER_FRAME(p)->klen = klen;
+    cjson_parse_whitespace(c);
+    if (*c->json != ':') {
+        cjson_parser_finish(p, CJSON_PARSE_MISS_COLON);
+        return;
+    }
+    c->json++;
+    cjson_parse_whitespace(c);
+    p->state = CJSON_PARSER_VALUE;
+}
+
+static void cjson_parser_next(cjson_parser* p) {
+    cjson_context* c = &p->c;
+    cjson_type type = CJSON_PARSER_FRAME(p)->type;
+    CJSON_TRACE_BEGIN(outer, type == CJSON_ARRAY ? CJSON_PHASE_ARRAY : CJSON_PHASE_OBJECT, c->json);
+    cjson_parse_whitespace(c);
+    if (*c->json == ',') {
+        c->json++;
+        cjson_parse_whitespace(c);
+        p->state = type == CJSON_ARRAY ? CJSON_PARSER_VALUE : CJSON_PARSER_KEY;
+    }
+    else if (*c->json == (type == CJSON_ARRAY ? ']' : '}')) {
+        c->json++;
+        cjson_parser_close(p);
+    }
+    else
+        cjson_parser_finish(p, type == CJSON_ARRAY ? CJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : CJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET);
+    CJSON_TRACE_END(outer, c->json);
+}
+
+/* Parses until budget bytes of input have been consumed, or to the end when budget is 0.
+ * A step stops at the first token boundary past the budget, so a long string can overrun it. */
+int cjson_parse_step(cjson_parser* p, size_t budget) {
+    const char* start;
+    assert(p != NULL);
+    start = p->c.json;
+    while (p->state != CJSON_PARSER_DONE) {
+        if (budget != 0 && (size_t)(p->c.json - start) >= budget)
+            return CJSON_PARSE_AGAIN;
+        switch (p->state) {
+            case CJSON_PARSER_VALUE: cjson_parser_value(p); break;
+            case CJSON_PARSER_KEY:   cjson_parser_key(p); break;
+            case CJSON_PARSER_NEXT:  cjson_parser_next(p); break;
+        }
+    }
+    return p->ret;
+}
+
+/* Abandons a parse in progress; the value is left null. Harmless once the parse is done. */
+void cjson_parser_free(cjson_parser* p) {
+    assert(p != NULL);
+    if (p->state != CJSON_PARSER_DONE)
+        cjson_parser_finish(p, CJSON_PARSE_OK);
+}
+// ==========================
+// ========== walk ==========
+// ==========================
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CJSON_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CJSON_PREFETCH(p) ((void)(p))
+#endif
+
+#define CJSON_WALK_LOCAL_DEPTH 32
+
+/* Explicit stack of the tree walks, so that the depth of a tree is bounded by memory rather than
+ * by the call stack. Frames live in the caller's local buffer until they outgrow it. */
+typedef struct {
+    char* frames;
+    size_t top, size;   /* bytes in use, bytes available */
+    void* local;
+} cjson_walk_stack;
+
+#define CJSON_WALK_PUSH(s, type)    ((type*)cjson_walk_stack_push(s, sizeof(type)))
+#define CJSON_WALK_TOP(s, type)     ((type*)((s)->frames + (s)->top) - 1)
+#define CJSON_WALK_POP(s, type)     ((s)->top -= sizeof(type))
+
+static void cjson_walk_stack_init(cjson_walk_stack* s, void* local, size_t size) {
+    s->frames = (char*)local;
+    s->local = local;
+    s->top = 0;
+    s->size = size;
+}
+
+static void* cjson_walk_stack_push(cjson_walk_stack* s, size_t size) {
+    void* ret;
+    if (s->top + size > s->size) {
+        size_t old = s->size;
+        s->size *= 2;
+        if (s->frames == s->local) {
+            char* p = (char*)cjson_heap_alloc(s->size);
+            memcpy(p, s->frames, s->top);
+            s->frames = p;
+        }
+        else
+            s->frames = (char*)cjson_heap_realloc(s->frames, old, s->size);
+    }
+    ret = s->frames + s->top;
+    s->top += size;
+    return ret;
+}
+
+static void cjson_walk_stack_free(cjson_walk_stack* s) {
+    if (s->frames != s->local)
+        cjson_heap_free(s->frames, s->size);
+}
+
+/* Values directly inside v, 0 for scalars. */
+static size_t cjson_walk_size(const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_ARRAY:        return v->data.arr.size;
+        case CJSON_NUMBER_ARRAY: return v->data.nums.size;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT: return v->data.obj.size;
+        default: return 0;
+    }
+}
+
+/* Starts loading the storage of the i-th child of an array or object, the sibling visited
+ * next, while the current one is being processed. */
+static void cjson_walk_prefetch(const cjson_value* v, size_t i) {
+    if (v->type == CJSON_ARRAY) {
+        if (i < v->data.arr.size)
+            CJSON_PREFETCH(cjson_storage(&v->data.arr.elem[i]));
+    }
+    else if (i < v->data.obj.size) {
+        CJSON_PREFETCH(v->data.obj.memb[i].k);
+        CJSON_PREFETCH(cjson_storage(&v->data.obj.memb[i].v));
+    }
+}
+
+typedef struct {
+    const cjson_value* v;   /* container being walked */
+    size_t i;               /* next child */
+} cjson_walk_frame;
+
+int cjson_walk(const cjson_value* v, cjson_walk_enter enter, cjson_walk_leave leave, void* user) {
+    cjson_walk_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    cjson_value number;     /* element of a packed array, as the number it unpacks to */
+    const char* key = NULL;
+    size_t klen = 0;
+    int action = CJSON_WALK_CONTINUE;
+    assert(v != NULL);
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    cjson_init(&number);
+    number.type = CJSON_NUMBER;
+    while (v != NULL) {
+        size_t depth = s.top / sizeof(cjson_walk_frame);
+        if (enter && (action = enter(v, key, klen, depth, user)) == CJSON_WALK_STOP)
+            break;
+        if (action == CJSON_WALK_CONTINUE) {
+            if (cjson_walk_size(v) > 0) {
+                f = CJSON_WALK_PUSH(&s, cjson_walk_frame);
+                f->v = v;
+                f->i = 0;
+            }
+            else if (leave && (action = leave(v, depth, user)) == CJSON_WALK_STOP)
+                break;
+        }
+        /* next value in document order, leaving the containers it finishes */
+        for (v = NULL; v == NULL && s.top > 0; ) {
+            f = CJSON_WALK_TOP(&s, cjson_walk_frame);
+            if (f->i == cjson_walk_size(f->v)) {
+                CJSON_WALK_POP(&s, cjson_walk_frame);
+                if (leave && (action = leave(f->v, s.top / sizeof(cjson_walk_frame), user)) == CJSON_WALK_STOP)
+                    break;
+                continue;
+            }
+            switch (CJSON_FORM(f->v)) {
+                case CJSON_ARRAY:
+                    v = &f->v->data.arr.elem[f->i];
+                    key = NULL;
+                    klen = 0;
+                    break;
+                case CJSON_NUMBER_ARRAY:
+                    number.data.num = f->v->data.nums.elem[f->i];
+                    v = &number;
+                    key = NULL;
+                    klen = 0;
+                    break;
+                default:
+                    v = &f->v->data.obj.memb[f->i].v;
+                    key = f->v->data.obj.memb[f->i].k;
+                    klen = f->v->data.obj.memb[f->i].klen;
+                    break;
+            }
+            if (f->v->form != CJSON_NUMBER_ARRAY)
+                cjson_walk_prefetch(f->v, f->i + 1);
+            f->i++;
+        }
+        if (action == CJSON_WALK_STOP)
+            break;
+    }
+    cjson_walk_stack_free(&s);
+    return action == CJSON_WALK_STOP ? CJSON_WALK_STOP : CJSON_WALK_CONTINUE;
+}
+
+// ===============================
+// ========== generator ==========
+// ===============================
+
+static size_t cjson_stringify_string_length(const char* s, size_t len) {
+    size_t size = len + 2;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch == '\"' || ch == '\\' || ch == '\b' || ch == '\f' || ch == '\n' || ch == '\r' || ch == '\t')
+            size += 1;
+        else if (ch < 0x20)
+            size += 5;
+    }
+    return size;
+}
+
+static void cjson_stringify_string(cjson_context* c, const char* s, size_t len) {
+    static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+    assert(s != NULL);
+    size_t size = len * 6 + 2; /* "\u00xx..." */
+    char* head, *p;
+    if (c->top + size >= c->size)   /* reserve exactly rather than grow for the worst case */
+        size = cjson_stringify_string_length(s, len);
+    p = head = cjson_context_push(c, size);
+    
+    *p++ = '"';
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = (unsigned char)s[i];
+        switch (ch) {
+            case '\"': *p++ = '\\'; *p++ = '\"'; break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\b': *p++ = '\\'; *p++ = 'b';  break;
+            case '\f': *p++ = '\\'; *p++ = 'f';  break;
+            case '\n': *p++ = '\\'; *p++ = 'n';  break;
+            case '\r': *p++ = '\\'; *p++ = 'r';  break;
+            case '\t': *p++ = '\\'; *p++ = 't';  break;
+            default:
+                if (ch < 0x20) {
+                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
+                    *p++ = hex_digits[ch >> 4];
+                    *p++ = hex_digits[ch & 15];
+                }
+                else
+                    *p++ = s[i];
+        }
+    }
+    *p++ = '"';
+    c->top -= size - (p - head);
+}
+
+static void cjson_stringify_number(cjson_context* c, double n) {
+    char buffer[32];
+    cjson_context_push_str(c, buffer, sprintf(buffer, "%.17g", n));
+}
+
+/* Numbers [begin, end) of a packed array, each preceded by a comma unless it is the first one. */
+static void cjson_stringify_numbers(cjson_context* c, const double* nums, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        if (i > 0)
+            cjson_context_push_char(c, ',');
+        cjson_stringify_number(c, nums[i]);
+    }
+}
+
+/* Values that hold no cjson_value of their own: scalars and packed arrays. */
+static void cjson_stringify_leaf(cjson_context* c, const cjson_value* v) {
+    CJSON_TRACE_BEGIN(outer, cjson_trace_stringify_phase(CJSON_FORM(v)), c->top);
+    switch (CJSON_FORM(v)) {
+        case CJSON_NULL:   cjson_context_push_str(c, "null", 4); break;
+        case CJSON_FALSE:  cjson_context_push_str(c, "false", 5); break;
+        case CJSON_TRUE:   cjson_context_push_str(c, "true", 4); break;
+        case CJSON_NUMBER: cjson_stringify_number(c, v->data.num); break;
+        case CJSON_RAW_NUMBER: PUTS(c, v->data.str.s, v->data.str.len); break;
+        case CJSON_NUMBER_ARRAY:
+            cjson_context_push_char(c, '[');
+            cjson_stringify_numbers(c, v->data.nums.elem, 0, v->data.nums.size);
+            cjson_context_push_char(c, ']');
+            break;
+        case CJSON_STRING: cjson_stringify_string(c, v->data.str.s, v->data.str.len); break;
+        default: assert(0 && "invalid type");
+    }
+    CJSON_TRACE_END(outer, c->top);
+}
+
+typedef struct {
+    const cjson_value* v;   /* array or object being written */
+    size_t i, end;          /* next element, end of the range */
+    int outer;              /* trace phase to resume once it is closed */
+} cjson_stringify_frame;
+
+/* Elements [begin, end) of an array or object, each preceded by a comma unless it is the first one.
+ * Nested containers are opened and closed from an explicit stack rather than by recursion. */
+static void cjson_stringify_elements(cjson_context* c, const cjson_value* v, size_t begin, size_t end) {
+    cjson_stringify_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    f = CJSON_WALK_PUSH(&s, cjson_stringify_frame);
+    f->v = v;
+    f->i = begin;
+    f->end = end;
+    for (;;) {
+        const cjson_value* e;
+        f = CJSON_WALK_TOP(&s, cjson_stringify_frame);
+        if (f->i == f->end) {
+            if (s.top == sizeof(cjson_stringify_frame))
+                break;  /* v itself is closed by the caller */
+            cjson_context_push_char(c, f->v->type == CJSON_ARRAY ? ']' : '}');
+            CJSON_TRACE_LEAVE(f->outer, c->top);
+            CJSON_WALK_POP(&s, cjson_stringify_frame);
+            continue;
+        }
+        if (f->i > 0)
+            cjson_context_push_char(c, ',');
+        if (f->v->type == CJSON_ARRAY)
+            e = &f->v->data.arr.elem[f->i];
+        else {
+            {
+                CJSON_TRACE_BEGIN(key_outer, CJSON_PHASE_STRINGIFY_STRING, c->top);
+                cjson_stringify_string(c, f->v->data.obj.memb[f->i].k, f->v->data.obj.memb[f->i].klen);
+                CJSON_TRACE_END(key_outer, c->top);
+            }
+            cjson_context_push_char(c, ':');
+            e = &f->v->data.obj.memb[f->i].v;
+        }
+        cjson_walk_prefetch(f->v, ++f->i);
+        if (CJSON_IS_CONTAINER(e)) {
+            int outer = CJSON_TRACE_ENTER(CJSON_PHASE_STRINGIFY, c->top);
+            cjson_context_push_char(c, e->type == CJSON_ARRAY ? '[' : '{');
+            f = CJSON_WALK_PUSH(&s, cjson_stringify_frame);
+            f->v = e;
+            f->i = 0;
+            f->end = cjson_walk_size(e);
+            f->outer = outer;
+        }
+        else
+            cjson_stringify_leaf(c, e);
+    }
+    cjson_walk_stack_free(&s);
+}
+
+static void cjson_stringify_value(cjson_context* c, const cjson_value* v) {
+    if (CJSON_IS_CONTAINER(v)) {
+        CJSON_TRACE_BEGIN(outer, CJSON_PHASE_STRINGIFY, c->top);
+        cjson_context_push_char(c, v->type == CJSON_ARRAY ? '[' : '{');
+        cjson_stringify_elements(c, v, 0, cjson_walk_size(v));
+        cjson_context_push_char(c, v->type == CJSON_ARRAY ? ']' : '}');
+        CJSON_TRACE_END(outer, c->top);
+    }
+    else
+        cjson_stringify_leaf(c, v);
+}
+
+char* cjson_stringify(const cjson_value* v, size_t* len) {
+    cjson_context c;
+    assert(v != NULL);
+    c.buffer = (char*)cjson_heap_alloc(c.size = CJSON_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    CJSON_TRACE_DOCUMENT_BEGIN(start);
+    cjson_stringify_value(&c, v);
+    CJSON_TRACE_DOCUMENT_END(start, "stringify", c.top);
+    if (len) *len = c.top;
+    cjson_context_push_char(&c, '\0');
+    return cjson_context_detach(&c);
+}
+
+/* Brackets, commas and colons of an array or object, or the whole text of anything else. */
+static size_t cjson_stringify_shallow_length(const cjson_value* v) {
+    char buffer[32];
+    size_t size;
+    switch (CJSON_FORM(v)) {
+        case CJSON_NULL:   return 4;
+        case CJSON_FALSE:  return 5;
+        case CJSON_TRUE:   return 4;
+        case CJSON_NUMBER: return sprintf(buffer, "%.17g", v->data.num);
+        case CJSON_RAW_NUMBER: return v->data.str.len;
+        case CJSON_NUMBER_ARRAY:
+            size = v->data.nums.size > 0 ? v->data.nums.size + 1 : 2;
+            for (size_t i = 0; i < v->data.nums.size; i++)
+                size += sprintf(buffer, "%.17g", v->data.nums.elem[i]);
+            return size;
+        case CJSON_STRING: return cjson_stringify_string_length(v->data.str.s, v->data.str.len);
+        case CJSON_ARRAY:  return v->data.arr.size > 0 ? v->data.arr.size + 1 : 2;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            return v->data.obj.size > 0 ? v->data.obj.size * 2 + 1 : 2;
+        default: assert(0 && "invalid type"); return 0;
+    }
+}
+
+static size_t cjson_stringify_value_length(const cjson_value* v) {
+    cjson_walk_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    size_t size = cjson_stringify_shallow_length(v);
+    if (!CJSON_IS_CONTAINER(v))
+        return size;
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    f = CJSON_WALK_PUSH(&s, cjson_walk_frame);
+    f->v = v;
+    f->i = 0;
+    do {
+        const cjson_value* e;
+        f = CJSON_WALK_TOP(&s, cjson_walk_frame);
+        if (f->i == cjson_walk_size(f->v)) {
+            CJSON_WALK_POP(&s, cjson_walk_frame);
+            continue;
+        }
+        if (f->v->type == CJSON_ARRAY)
+            e = &f->v->data.arr.elem[f->i];
+        else {
+            size += cjson_stringify_string_length(f->v->data.obj.memb[f->i].k, f->v->data.obj.memb[f->i].klen);
+            e = &f->v->data.obj.memb[f->i].v;
+        }
+        cjson_walk_prefetch(f->v, ++f->i);
+        size += cjson_stringify_shallow_length(e);
+        if (CJSON_IS_CONTAINER(e)) {
+            f = CJSON_WALK_PUSH(&s, cjson_walk_frame);
+            f->v = e;
+            f->i = 0;
+        }
+    } while (s.top > 0);
+    cjson_walk_stack_free(&s);
+    return size;
+}
+
+size_t cjson_stringify_length(const cjson_value* v) {
+    assert(v != NULL);
+    return cjson_stringify_value_length(v);
+}
+
+int cjson_stringify_into(const cjson_value* v, char* buffer, size_t capacity, size_t* needed) {
+    cjson_context c;
+    size_t len;
+    assert(v != NULL && (buffer != NULL || capacity == 0));
+    len = cjson_stringify_value_length(v);
+    if (needed) *needed = len;
+    if (len >= capacity)    /* room for the terminator too */
+        return CJSON_STRINGIFY_BUFFER_TOO_SMALL;
+    /* The output is known to fit and every push is exact, so the buffer is never reallocated. */
+    c.buffer = buffer;
+    c.size = capacity;
+    c.top = 0;
+    CJSON_TRACE_DOCUMENT_BEGIN(start);
+    cjson_stringify_value(&c, v);
+    CJSON_TRACE_DOCUMENT_END(start, "stringify", c.top);
+    assert(c.buffer == buffer && c.top == len);
+    buffer[len] = '\0';
+    return CJSON_STRINGIFY_OK;
+}
+
+void cjson_context_init(cjson_context* c) {
+    assert(c != NULL);
+    c->json = NULL;
+    c->flags = 0;
+    c->keys = NULL;
+    c->buffer = NULL;
+    c->size = c->top = 0;
+}
+
+void cjson_context_free(cjson_context* c) {
+    assert(c != NULL);
+    cjson_heap_free(c->buffer, c->size);
+    cjson_context_init(c);
+}
+
+const char* cjson_stringify_context(cjson_context* c, const cjson_value* v, size_t* len) {
+    assert(c != NULL && v != NULL);
+    c->top = 0;
+    CJSON_TRACE_DOCUMENT_BEGIN(start);
+    cjson_stringify_value(c, v);
+    CJSON_TRACE_DOCUMENT_END(start, "stringify", c->top);
+    if (len) *len = c->top;
+    cjson_context_push_char(c, '\0');
+    c->top--;
+    return c->buffer;
+}
+
+/* Whether a and b are the same leaf or share their storage: bitwise equal numbers, or the
+ * same string, raw number or container storage with the same size. */
+static int cjson_same_element(const cjson_value* a, const cjson_value* b) {
+    if (a->type != b->type || a->form != b->form)
+        return 0;
+    switch (CJSON_FORM(a)) {
+        case CJSON_NUMBER: return memcmp(&a->data.num, &b->data.num, sizeof(double)) == 0;
+        case CJSON_STRING:
+        case CJSON_RAW_NUMBER: return a->data.str.s == b->data.str.s && a->data.str.len == b->data.str.len;
+        case CJSON_ARRAY:  return a->data.arr.elem == b->data.arr.elem && a->data.arr.size == b->data.arr.size;
+        case CJSON_NUMBER_ARRAY: return a->data.nums.elem == b->data.nums.elem && a->data.nums.size == b->data.nums.size;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT: return a->data.obj.memb == b->data.obj.memb && a->data.obj.size == b->data.obj.size;
+        default: return 1;
+    }
+}
+
+/* What an array or object held when its text was last made, and where that text went. The
+ * offsets of its elements are relative to its own text, so they hold wherever the text is copied. */
+typedef struct cjson_stringify_slot {
+    const void* storage;    /* key, NULL if the slot is empty */
+    size_t seen;            /* cjson_write_clock tick of the call that made its text */
+    size_t placed;          /* generation of the output its text last went into as a whole ... */
+    size_t at, length;      /* ... at this offset */
+    void* copy;             /* its elements or members then; strings, keys and packed arrays retained */
+    size_t* offsets;        /* start and end of the text of each element's value */
+    size_t count;
+    int object;             /* copy holds cjson_member */
+} cjson_stringify_slot;
+
+#define CJSON_STRINGIFY_UNPLACED ((size_t)-1)
+
+void cjson_stringify_cache_init(cjson_stringify_cache* sc) {
+    assert(sc != NULL);
+    cjson_context_init(&sc->out);
+    cjson_context_init(&sc->spare);
+    sc->slots = NULL;
+    sc->size = sc->mask = 0;
+    sc->limit = 0;
+    sc->generation = 0;
+    sc->bytes_reused = 0;
+    sc->elements_checked = 0;
+}
+
+/* Arrays and objects with elements: the values that get a slot. */
+static int cjson_stringify_cache_node(const cjson_value* v) {
+    return CJSON_IS_CONTAINER(v) && cjson_walk_size(v) > 0;
+}
+
+static cjson_value* cjson_stringify_copy_value(void* copy, int object, size_t i) {
+    return object ? &((cjson_member*)copy)[i].v : &((cjson_value*)copy)[i];
+}
+
+/* Containers in a copy are not retained: they are only compared by storage, and a block freed
+ * and allocated again is stamped after the copy was made. */
+static void cjson_stringify_copy_retain(void* copy, int object, size_t i) {
+    cjson_value* e = cjson_stringify_copy_value(copy, object, i);
+    if (object)
+        cjson_block_retain(((cjson_member*)copy)[i].k);
+    if (!CJSON_IS_CONTAINER(e))
+        cjson_retain(e);
+}
+
+static void cjson_stringify_copy_release(void* copy, int object, size_t i) {
+    cjson_value* e = cjson_stringify_copy_value(copy, object, i);
+    if (object)
+        cjson_string_release(((cjson_member*)copy)[i].k);
+    if (!CJSON_IS_CONTAINER(e))
+        cjson_free(e);
+}
+
+static void cjson_stringify_slot_release(cjson_stringify_slot* slot) {
+    size_t size = slot->object ? sizeof(cjson_member) : sizeof(cjson_value);
+    if (slot->copy != NULL) {
+        for (size_t i = 0; i < slot->count; ++i)
+            cjson_stringify_copy_release(slot->copy, slot->object, i);
+        cjson_heap_free(slot->copy, slot->count * size);
+    }
+    cjson_heap_free(slot->offsets, 2 * slot->count * sizeof(size_t));
+    slot->copy = NULL;
+    slot->offsets = NULL;
+    slot->count = 0;
+}
+
+static void cjson_stringify_cache_clear(cjson_stringify_cache* sc) {
+    if (sc->slots == NULL)
+        return;
+    for (size_t i = 0; i <= sc->mask; ++i)
+        if (sc->slots[i].storage != NULL)
+            cjson_stringify_slot_release(&sc->slots[i]);
+    memset(sc->slots, 0, (sc->mask + 1) * sizeof(cjson_stringify_slot));
+    sc->size = 0;
+}
+
+void cjson_stringify_cache_free(cjson_stringify_cache* sc) {
+    assert(sc != NULL);
+    cjson_context_free(&sc->out);
+    cjson_context_free(&sc->spare);
+    cjson_stringify_cache_clear(sc);
+    if (sc->slots != NULL)
+        cjson_heap_free(sc->slots, (sc->mask + 1) * sizeof(cjson_stringify_slot));
+    cjson_stringify_cache_init(sc);
+}
+
+static cjson_stringify_slot* cjson_stringify_cache_find(const cjson_stringify_cache* sc, const void* storage) {
+    if (sc->slots == NULL)
+        return NULL;
+    for (size_t i = cjson_hash_mix((size_t)storage) & sc->mask; sc->slots[i].storage != NULL; i = (i + 1) & sc->mask)
+        if (sc->slots[i].storage == storage)
+            return &sc->slots[i];
+    return NULL;
+}
+
+static cjson_stringify_slot* cjson_stringify_cache_insert(cjson_stringify_cache* sc, const void* storage) {
+    size_t i;
+    if (sc->slots == NULL || (sc->size + 1) * 2 > sc->mask + 1) {
+        cjson_stringify_slot* old = sc->slots;
+        size_t capacity = old == NULL ? 0 : sc->mask + 1;
+        sc->mask = capacity == 0 ? 63 : capacity * 2 - 1;
+        sc->slots = (cjson_stringify_slot*)cjson_heap_alloc((sc->mask + 1) * sizeof(cjson_stringify_slot));
+        memset(sc->slots, 0, (sc->mask + 1) * sizeof(cjson_stringify_slot));
+        for (size_t j = 0; j < capacity; ++j) {
+            if (old[j].storage == NULL)
+                continue;
+            for (i = cjson_hash_mix((size_t)old[j].storage) & sc->mask; sc->slots[i].storage != NULL; i = (i + 1) & sc->mask)
+                ;
+            sc->slots[i] = old[j];
+        }
+        cjson_heap_free(old, capacity * sizeof(cjson_stringify_slot));
+    }
+    for (i = cjson_hash_mix((size_t)storage) & sc->mask; sc->slots[i].storage != NULL; i = (i + 1) & sc->mask)
+        if (sc->slots[i].storage == storage)
+            return &sc->slots[i];
+    sc->slots[i].storage = storage;
+    sc->size++;
+    return &sc->slots[i];
+}
+
+typedef struct {
+    const cjson_value* v;   /* array or object being written */
+    const void* storage;
+    size_t i, n;            /* next element, elements */
+    size_t start;           /* offset of its text in the output being written */
+    size_t* offsets;        /* of its elements in that text, for its slot */
+    size_t old;             /* offset of its text in the last output, CJSON_STRINGIFY_UNPLACED if unknown */
+    size_t seen;            /* tick of the call that made that text */
+    const void* copy;       /* what it held then, NULL if not known */
+    const size_t* old_offsets;
+    size_t count;
+    size_t prefix, suffix;  /* leading and trailing elements that are the same as then */
+    size_t run, from;       /* elements [run, i) are still to be copied from the old text, from element from on */
+} cjson_stringify_cache_frame;
+
+/* Whether element i of v is element j of copy: the same key storage and the same leaf or storage. */
+static int cjson_stringify_same(const cjson_value* v, size_t i, const void* copy, size_t j) {
+    if (CJSON_IS_OBJECT(v)) {
+        const cjson_member* m = &v->data.obj.memb[i], *n = &((const cjson_member*)copy)[j];
+        return m->k == n->k && m->klen == n->klen && cjson_same_element(&m->v, &n->v);
+    }
+    return cjson_same_element(&v->data.arr.elem[i], &((const cjson_value*)copy)[j]);
+}
+
+/* Index of the element of f's copy that element i still is, CJSON_STRINGIFY_UNPLACED if none. */
+static size_t cjson_stringify_cache_match(cjson_stringify_cache* sc, const cjson_stringify_cache_frame* f, size_t i) {
+    if (f->copy == NULL)
+        return CJSON_STRINGIFY_UNPLACED;
+    if (i < f->prefix)
+        return i;
+    if (i >= f->n - f->suffix)
+        return i - f->n + f->count;
+    if (f->n != f->count)   /* inserted or replaced */
+        return CJSON_STRINGIFY_UNPLACED;
+    sc->elements_checked++;
+    return cjson_stringify_same(f->v, i, f->copy, i) ? i : CJSON_STRINGIFY_UNPLACED;
+}
+
+/* Copies elements [run, i) of f in one go from its old text, commas between them included. */
+static void cjson_stringify_cache_flush(cjson_stringify_cache* sc, cjson_context* c, cjson_stringify_cache_frame* f) {
+    size_t n = f->i - f->run, begin, end, shift;
+    if (n == 0)
+        return;
+    begin = f->from == 0 ? 1 : f->old_offsets[2 * f->from - 1] + 1;     /* past the bracket or comma */
+    end = f->old_offsets[2 * (f->from + n) - 1];
+    if (f->run > 0)
+        cjson_context_push_char(c, ',');
+    shift = c->top - f->start - begin;  /* unsigned, so it may wrap */
+    PUTS(c, sc->out.buffer + f->old + begin, end - begin);
+    for (size_t k = 0; k < 2 * n; ++k)
+        f->offsets[2 * f->run + k] = f->old_offsets[2 * f->from + k] + shift;
+    sc->bytes_reused += end - begin;
+    f->run = f->i;
+}
+
+/* Writes e, an array or object with elements. Its text is copied if it is in this output already, or
+ * in the last one and e was not written since it was made there; old, length and seen say where that
+ * is if e's parent knows. Otherwise returns the frame to write e in, with what e held then if known. */
+static cjson_stringify_cache_frame* cjson_stringify_cache_place(cjson_stringify_cache* sc, cjson_context* c, cjson_walk_stack* s,
+    const cjson_value* e, size_t old, size_t length, size_t seen) {
+    const void* storage = cjson_storage(e);
+    cjson_stringify_slot* slot = cjson_stringify_cache_find(sc, storage);
+    cjson_stringify_cache_frame* f;
+    if (slot != NULL && slot->placed == sc->generation) {   /* shared, and written further up */
+        char* p = (char*)cjson_context_push(c, slot->length);
+        memcpy(p, c->buffer + slot->at, slot->length);
+        sc->bytes_reused += slot->length;
+        return NULL;
+    }
+    if (old == CJSON_STRINGIFY_UNPLACED && slot != NULL && slot->placed == sc->generation - 1) {
+        old = slot->at;
+        length = slot->length;
+        seen = slot->seen;
+    }
+    if (old != CJSON_STRINGIFY_UNPLACED && CJSON_BLOCK(storage)->written < seen) {
+        PUTS(c, sc->out.buffer + old, length);
+        sc->bytes_reused += length;
+        if (slot != NULL) {
+            slot->placed = sc->generation;
+            slot->at = c->top - length;
+        }
+        return NULL;
+    }
+    f = CJSON_WALK_PUSH(s, cjson_stringify_cache_frame);
+    f->v = e;
+    f->storage = storage;
+    f->i = f->run = f->from = 0;
+    f->n = cjson_walk_size(e);
+    f->start = c->top;
+    f->offsets = (size_t*)cjson_heap_alloc(2 * f->n * sizeof(size_t));
+    f->old = old;
+    f->seen = seen;
+    f->copy = NULL;
+    f->old_offsets = NULL;
+    f->count = f->prefix = f->suffix = 0;
+    if (old != CJSON_STRINGIFY_UNPLACED && slot != NULL && slot->copy != NULL && slot->length == length
+        && slot->object == CJSON_IS_OBJECT(e)) {
+        size_t k = f->n < slot->count ? f->n : slot->count;
+        f->copy = slot->copy;
+        f->old_offsets = slot->offsets;
+        f->count = slot->count;
+        while (f->prefix < k && cjson_stringify_same(e, f->prefix, f->copy, f->prefix))
+            f->prefix++;
+        while (f->suffix < k - f->prefix && cjson_stringify_same(e, f->n - 1 - f->suffix, f->copy, f->count - 1 - f->suffix))
+            f->suffix++;
+        sc->elements_checked += f->prefix + f->suffix;
+    }
+    cjson_context_push_char(c, e->type == CJSON_ARRAY ? '[' : '{');
+    return f;
+}
+
+/* Brings the copy kept in slot up to what f's container holds, keeping the entries that are the same. */
+static void cjson_stringify_slot_record(cjson_stringify_slot* slot, const cjson_stringify_cache_frame* f) {
+    int object = CJSON_IS_OBJECT(f->v);
+    size_t size = object ? sizeof(cjson_member) : sizeof(cjson_value), n = f->n, i;
+    const char* now = object ? (const char*)f->v->data.obj.memb : (const char*)f->v->data.arr.elem;
+    char* copy;
+    if (f->copy == NULL) {
+        cjson_stringify_slot_release(slot);
+        copy = (char*)cjson_heap_alloc(n * size);
+        memcpy(copy, now, n * size);
+        for (i = 0; i < n; ++i)
+            cjson_stringify_copy_retain(copy, object, i);
+    }
+    else if (n == f->count) {
+        copy = (char*)slot->copy;
+        for (i = f->prefix; i < n - f->suffix; ++i)
+            if (!cjson_stringify_same(f->v, i, copy, i)) {
+                cjson_stringify_copy_release(copy, object, i);
+                memcpy(copy + i * size, now + i * size, size);
+                cjson_stringify_copy_retain(copy, object, i);
+            }
+        cjson_heap_free(slot->offsets, 2 * n * sizeof(size_t));
+    }
+    else {
+        copy = (char*)cjson_heap_alloc(n * size);
+        memcpy(copy, slot->copy, f->prefix * size);
+        memcpy(copy + (n - f->suffix) * size, (char*)slot->copy + (f->count - f->suffix) * size, f->suffix * size);
+        for (i = f->prefix; i < f->count - f->suffix; ++i)
+            cjson_stringify_copy_release(slot->copy, object, i);
+        memcpy(copy + f->prefix * size, now + f->prefix * size, (n - f->suffix - f->prefix) * size);
+        for (i = f->prefix; i < n - f->suffix; ++i)
+            cjson_stringify_copy_retain(copy, object, i);
+        cjson_heap_free(slot->copy, f->count * size);
+        cjson_heap_free(slot->offsets, 2 * f->count * sizeof(size_t));
+    }
+    slot->copy = copy;
+    slot->offsets = f->offsets;
+    slot->count = n;
+    slot->object = object;
+}
+
+const char* cjson_stringify_cached(cjson_stringify_cache* sc, const cjson_value* v, size_t* len) {
+    cjson_stringify_cache_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    cjson_context c = sc->spare;
+    size_t tick;
+    int rebuilt;
+    assert(sc != NULL && v != NULL);
+    rebuilt = sc->size == 0;
+    sc->generation++;
+    tick = CJSON_ATOMIC_ADD(&cjson_write_clock, 1);    /* writes from now on are stamped with it */
+    c.top = 0;
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    CJSON_TRACE_DOCUMENT_BEGIN(start);
+    CJSON_TRACE_BEGIN(outer, CJSON_PHASE_STRINGIFY, c.top);
+    if (cjson_stringify_cache_node(v))
+        cjson_stringify_cache_place(sc, &c, &s, v, CJSON_STRINGIFY_UNPLACED, 0, 0);
+    else
+        cjson_stringify_value(&c, v);
+    while (s.top > 0) {
+        const cjson_value* e;
+        size_t i, j;
+        f = CJSON_WALK_TOP(&s, cjson_stringify_cache_frame);
+        if (f->i == f->n) {
+            cjson_stringify_slot* slot;
+            cjson_stringify_cache_flush(sc, &c, f);
+            cjson_context_push_char(&c, f->v->type == CJSON_ARRAY ? ']' : '}');
+            slot = cjson_stringify_cache_insert(sc, f->storage);
+            cjson_stringify_slot_record(slot, f);
+            slot->seen = tick;
+            slot->placed = sc->generation;
+            slot->at = f->start;
+            slot->length = c.top - f->start;
+            CJSON_WALK_POP(&s, cjson_stringify_cache_frame);
+            if (s.top > 0) {
+                f = CJSON_WALK_TOP(&s, cjson_stringify_cache_frame);
+                f->offsets[2 * f->i - 1] = c.top - f->start;
+            }
+            continue;
+        }
+        i = f->i;
+        j = cjson_stringify_cache_match(sc, f, i);
+        e = CJSON_IS_OBJECT(f->v) ? &f->v->data.obj.memb[i].v : &f->v->data.arr.elem[i];
+        if (j != CJSON_STRINGIFY_UNPLACED && (!cjson_stringify_cache_node(e) || CJSON_BLOCK(cjson_storage(e))->written < f->seen)) {
+            if (f->run < i && f->from + (i - f->run) != j)
+                cjson_stringify_cache_flush(sc, &c, f);
+            if (f->run == i)
+                f->from = j;
+            f->i++;     /* to the run */
+            continue;
+        }
+        cjson_stringify_cache_flush(sc, &c, f);
+        if (i > 0)
+            cjson_context_push_char(&c, ',');
+        if (CJSON_IS_OBJECT(f->v)) {
+            {
+                CJSON_TRACE_BEGIN(key_outer, CJSON_PHASE_STRINGIFY_STRING, c.top);
+                cjson_stringify_string(&c, f->v->data.obj.memb[i].k, f->v->data.obj.memb[i].klen);
+                CJSON_TRACE_END(key_outer, c.top);
+            }
+            cjson_context_push_char(&c, ':');
+        }
+        f->offsets[2 * i] = c.top - f->start;
+        f->run = ++f->i;
+        cjson_walk_prefetch(f->v, f->i);
+        if (!cjson_stringify_cache_node(e))
+            cjson_stringify_value(&c, e);
+        else if (j != CJSON_STRINGIFY_UNPLACED) {  /* written since, where it was is known */
+            size_t old = f->old + f->old_offsets[2 * j], length = f->old_offsets[2 * j + 1] - f->old_offsets[2 * j];
+            if (cjson_stringify_cache_place(sc, &c, &s, e, old, length, f->seen) != NULL)
+                continue;
+        }
+        else if (cjson_stringify_cache_place(sc, &c, &s, e, CJSON_STRINGIFY_UNPLACED, 0, 0) != NULL)
+            continue;
+        f = CJSON_WALK_TOP(&s, cjson_stringify_cache_frame);
+        f->offsets[2 * i + 1] = c.top - f->start;
+    }
+    cjson_walk_stack_free(&s);
+    CJSON_TRACE_END(outer, c.top);
+    CJSON_TRACE_DOCUMENT_END(start, "stringify", c.top);
+    if (len) *len = c.top;
+    cjson_context_push_char(&c, '\0');
+    c.top--;
+    sc->spare = sc->out;
+    sc->out = c;
+    /* Slots of containers gone from the tree are never reused; drop them all once they pile up. */
+    if (rebuilt)
+        sc->limit = sc->size * 2 + 64;
+    else if (sc->size > sc->limit)
+        cjson_stringify_cache_clear(sc);
+    return sc->out.buffer;
+}
+
+// ============================
+// ========== writer ==========
+// ============================
+
+#define CJSON_WRITER_OBJECT 0x1 /* container is an object */
+#define CJSON_WRITER_ITEMS  0x2 /* container has at least one item */
+#define CJSON_WRITER_KEY    0x4 /* object key written, value pending */
+
+void cjson_writer_init(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_context_init(&w->c);
+    w->stack = NULL;
+    w->depth = w->capacity = 0;
+}
+
+void cjson_writer_reset(cjson_writer* w) {
+    assert(w != NULL);
+    w->c.top = 0;
+    w->depth = 0;
+}
+
+void cjson_writer_free(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_context_free(&w->c);
+    cjson_heap_free(w->stack, w->capacity);
+    cjson_writer_init(w);
+}
+
+const char* cjson_writer_get_string(cjson_writer* w, size_t* len) {
+    assert(w != NULL);
+    assert(w->depth == 0 && w->c.top > 0 && "document is incomplete");
+    if (len) *len = w->c.top;
+    cjson_context_push_char(&w->c, '\0');
+    w->c.top--;   /* keep the terminator out of the document */
+    return w->c.buffer;
+}
+
+/* Emits the separator owed before a value and checks the value is allowed here. */
+static void cjson_writer_prefix(cjson_writer* w) {
+    unsigned char* s;
+    if (w->depth == 0) {
+        assert(w->c.top == 0 && "root is already complete");
+        return;
+    }
+    s = &w->stack[w->depth - 1];
+    if (*s & CJSON_WRITER_OBJECT) {
+        assert((*s & CJSON_WRITER_KEY) && "object value must follow a key");
+        *s &= ~CJSON_WRITER_KEY;
+    }
+    else {
+        if (*s & CJSON_WRITER_ITEMS)
+            cjson_context_push_char(&w->c, ',');
+        *s |= CJSON_WRITER_ITEMS;
+    }
+}
+
+static void cjson_writer_open(cjson_writer* w, unsigned char state, char ch) {
+    cjson_writer_prefix(w);
+    if (w->depth == w->capacity) {
+        size_t old = w->capacity;
+        w->capacity = w->capacity == 0 ? 16 : w->capacity * 2;
+        w->stack = (unsigned char*)cjson_heap_realloc(w->stack, old, w->capacity);
+    }
+    w->stack[w->depth++] = state;
+    cjson_context_push_char(&w->c, ch);
+}
+
+static void cjson_writer_close(cjson_writer* w, unsigned char state, char ch) {
+    assert(w->depth > 0 && "no open container");
+    assert((w->stack[w->depth - 1] & CJSON_WRITER_OBJECT) == state && "mismatched container end");
+    assert(!(w->stack[w->depth - 1] & CJSON_WRITER_KEY) && "object key without value");
+    w->depth--;
+    cjson_context_push_char(&w->c, ch);
+}
+
+void cjson_write_null(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_writer_prefix(w);
+    cjson_context_push_str(&w->c, "null", 4);
+}
+
+void cjson_write_boolean(cjson_writer* w, int b) {
+    assert(w != NULL);
+    cjson_writer_prefix(w);
+    if (b)
+        cjson_context_push_str(&w->c, "true", 4);
+    else
+        cjson_context_push_str(&w->c, "false", 5);
+}
+
+void cjson_write_number(cjson_writer* w, double n) {
+    assert(w != NULL);
+    cjson_writer_prefix(w);
+    cjson_stringify_number(&w->c, n);
+}
+
+void cjson_write_int(cjson_writer* w, long long n) {
+    char buffer[32];
+    assert(w != NULL);
+    cjson_writer_prefix(w);
+    cjson_context_push_str(&w->c, buffer, sprintf(buffer, "%lld", n));
+}
+
+void cjson_write_string(cjson_writer* w, const char* s, size_t len) {
+    assert(w != NULL && (s != NULL || len == 0));
+    cjson_writer_prefix(w);
+    cjson_stringify_string(&w->c, s ? s : "", len);
+}
+
+void cjson_write_value(cjson_writer* w, const cjson_value* v) {
+    assert(w != NULL && v != NULL);
+    cjson_writer_prefix(w);
+    cjson_stringify_value(&w->c, v);
+}
+
+void cjson_write_begin_array(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_writer_open(w, 0, '[');
+}
+
+void cjson_write_end_array(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_writer_close(w, 0, ']');
+}
+
+void cjson_write_begin_object(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_writer_open(w, CJSON_WRITER_OBJECT, '{');
+}
+
+void cjson_write_key(cjson_writer* w, const char* key, size_t klen) {
+    unsigned char* s;
+    assert(w != NULL && (key != NULL || klen == 0));
+    assert(w->depth > 0 && (w->stack[w->depth - 1] & CJSON_WRITER_OBJECT) && "key outside of object");
+    s = &w->stack[w->depth - 1];
+    assert(!(*s & CJSON_WRITER_KEY) && "object key without value");
+    if (*s & CJSON_WRITER_ITEMS)
+        cjson_context_push_char(&w->c, ',');
+    *s |= CJSON_WRITER_ITEMS | CJSON_WRITER_KEY;
+    cjson_stringify_string(&w->c, key ? key : "", klen);
+    cjson_context_push_char(&w->c, ':');
+}
+
+void cjson_write_end_object(cjson_writer* w) {
+    assert(w != NULL);
+    cjson_writer_close(w, CJSON_WRITER_OBJECT, '}');
+}
+
+// ==============================
+// ========== accessor ==========
+// ==============================
+
+/* Copies src into dst, which holds nothing. A non-empty array or object gets storage for its
+ * children, left for the caller to copy, who is told so by a non-zero return. */
+static int cjson_copy_shallow(cjson_value* dst, const cjson_value* src) {
+    cjson_init(dst);
+    switch (CJSON_FORM(src)) {
+        case CJSON_STRING:
+            cjson_set_string(dst, src->data.str.s, src->data.str.len);
+            return 0;
+        case CJSON_RAW_NUMBER:
+            dst->data.str.s = cjson_raw_dup(src->data.str.s, src->data.str.len);
+            dst->data.str.len = src->data.str.len;
+            dst->type = CJSON_NUMBER;
+            dst->form = CJSON_RAW_NUMBER;
+            return 0;
+        case CJSON_NUMBER_ARRAY:
+            cjson_set_number_array(dst, src->data.nums.elem, src->data.nums.size);
+            return 0;
+        case CJSON_ARRAY:
+            cjson_set_array(dst, src->data.arr.size);
+            dst->data.arr.size = src->data.arr.size;
+            return dst->data.arr.size > 0;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            cjson_set_object(dst, src->data.obj.size);
+            dst->data.obj.size = src->data.obj.size;
+            dst->form = src->form;  /* still sorted */
+            return dst->data.obj.size > 0;
+        default:
+            memcpy(dst, src, sizeof(cjson_value));
+            return 0;
+    }
+}
+
+typedef struct {
+    const cjson_value* src;
+    cjson_value* dst;       /* storage allocated, children [0, i) copied */
+    size_t i;
+} cjson_copy_frame;
+
+void cjson_copy(cjson_value* dst, const cjson_value* src) {
+    cjson_copy_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    assert(src != NULL && dst != NULL && src != dst);
+    cjson_free(dst);
+    if (!cjson_copy_shallow(dst, src))
+        return;
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    f = CJSON_WALK_PUSH(&s, cjson_copy_frame);
+    f->src = src;
+    f->dst = dst;
+    f->i = 0;
+    do {
+        const cjson_value* e;
+        cjson_value* d;
+        f = CJSON_WALK_TOP(&s, cjson_copy_frame);
+        if (f->i == cjson_walk_size(f->src)) {
+            CJSON_WALK_POP(&s, cjson_copy_frame);
+            continue;
+        }
+        if (f->src->type == CJSON_ARRAY) {
+            e = &f->src->data.arr.elem[f->i];
+            d = &f->dst->data.arr.elem[f->i];
+        }
+        else {
+            const cjson_member* m = &f->src->data.obj.memb[f->i];
+            f->dst->data.obj.memb[f->i].klen = m->klen;
+            f->dst->data.obj.memb[f->i].k = cjson_string_dup(m->k, m->klen);
+            e = &m->v;
+            d = &f->dst->data.obj.memb[f->i].v;
+        }
+        cjson_walk_prefetch(f->src, ++f->i);
+        if (cjson_copy_shallow(d, e)) {
+            f = CJSON_WALK_PUSH(&s, cjson_copy_frame);
+            f->src = e;
+            f->dst = d;
+            f->i = 0;
+        }
+    } while (s.top > 0);
+    cjson_walk_stack_free(&s);
+}
+
+void cjson_copy_shared(cjson_value* dst, const cjson_value* src) {
+    assert(src != NULL && dst != NULL && src != dst);
+    cjson_retain(src);
+    cjson_free(dst);
+    memcpy(dst, src, sizeof(cjson_value));
+}
+
+void cjson_move(cjson_value* dst, cjson_value* src) {
+    assert(dst != NULL && src != NULL && src != dst);
+    cjson_free(dst);
+    memcpy(dst, src, sizeof(cjson_value));
+    cjson_init(src);
+}
+
+void cjson_swap(cjson_value* lhs, cjson_value* rhs) {
+    assert(lhs != NULL && rhs != NULL);
+    if (lhs != rhs) {
+        cjson_value temp;
+        memcpy(&temp, lhs, sizeof(cjson_value));
+        memcpy(lhs,   rhs, sizeof(cjson_value));
+        memcpy(rhs, &temp, sizeof(cjson_value));
+    }
+}
+
+/* Private copy of a storage block, cached hash included. */
+static void* cjson_compact_block(const void* p, size_t size) {
+    void* q = cjson_block_alloc(size);
+    memcpy(q, p, size);
+    CJSON_BLOCK(q)->hash = CJSON_BLOCK(p)->hash;
+    return q;
+}
+
+/* Relocates what src owns into dst in depth-first order, each container followed by
+ * its keys and children, with no spare capacity. Shared storage stays where it is. */
+static void cjson_compact_value(cjson_value* dst, const cjson_value* src) {
+    const void* storage = cjson_storage(src);
+    size_t size;
+    memcpy(dst, src, sizeof(cjson_value));
+    if (storage == NULL)
+        return;
+    if (cjson_block_is_shared(storage)) {
+        cjson_block_retain(storage);
+        return;
+    }
+    switch (CJSON_FORM(src)) {
+        case CJSON_STRING:
+            dst->data.str.s = (char*)cjson_compact_block(src->data.str.s, src->data.str.len + 1);
+            break;
+        case CJSON_RAW_NUMBER:  /* along with the decoded number, if any */
+            dst->data.str.s = (char*)cjson_compact_block(src->data.str.s, CJSON_RAW_TEXT_SIZE(src->data.str.len) + sizeof(cjson_raw_cache));
+            break;
+        case CJSON_NUMBER_ARRAY:
+            dst->data.nums.elem = (double*)cjson_compact_block(src->data.nums.elem, src->data.nums.size * sizeof(double));
+            dst->data.nums.capacity = src->data.nums.size;
+            break;
+        case CJSON_ARRAY:
+            if ((size = dst->data.arr.capacity = src->data.arr.size) == 0) {
+                dst->data.arr.elem = NULL;
+                break;
+            }
+            dst->data.arr.elem = (cjson_value*)cjson_block_alloc(size * sizeof(cjson_value));
+            CJSON_BLOCK(dst->data.arr.elem)->hash = CJSON_BLOCK(storage)->hash;
+            for (size_t i = 0; i < size; ++i)
+                cjson_compact_value(&dst->data.arr.elem[i], &src->data.arr.elem[i]);
+            break;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            if ((size = dst->data.obj.capacity = src->data.obj.size) == 0) {
+                dst->data.obj.memb = NULL;
+                break;
+            }
+            dst->data.obj.memb = (cjson_member*)cjson_block_alloc(size * sizeof(cjson_member));
+            CJSON_BLOCK(dst->data.obj.memb)->hash = CJSON_BLOCK(storage)->hash;
+            for (size_t i = 0; i < size; ++i) {
+                const cjson_member* m = &src->data.obj.memb[i];
+                dst->data.obj.memb[i].klen = m->klen;
+                if (cjson_block_is_shared(m->k)) {   /* e.g. keys shared by CJSON_PARSE_SHARE_KEYS */
+                    cjson_block_retain(m->k);
+                    dst->data.obj.memb[i].k = m->k;
+                }
+                else
+                    dst->data.obj.memb[i].k = (char*)cjson_compact_block(m->k, m->klen + 1);
+                cjson_compact_value(&dst->data.obj.memb[i].v, &m->v);
+            }
+            break;
+        default: break;
+    }
+}
+
+/* Rebuilds v in freshly allocated storage, which the allocator tends to hand out in one
+ * run, dropping the slack growth left behind; the old tree is freed only afterwards. */
+void cjson_compact(cjson_value* v) {
+    cjson_value t;
+    assert(v != NULL);
+    cjson_compact_value(&t, v);
+    cjson_free(v);
+    memcpy(v, &t, sizeof(cjson_value));
+}
+
+/* Drops what v holds. When v held the last reference to the storage of an array or object,
+ * its children and the block itself are left to the caller, who is told so by a non-zero return. */
+static int cjson_free_shallow(const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_STRING:
+        case CJSON_RAW_NUMBER:
+            cjson_string_release(v->data.str.s);
+            return 0;
+        case CJSON_ARRAY:
+            return cjson_block_unref(v->data.arr.elem);
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            return cjson_block_unref(v->data.obj.memb);
+        case CJSON_NUMBER_ARRAY:
+            if (cjson_block_unref(v->data.nums.elem))
+                cjson_block_free(v->data.nums.elem);
+            return 0;
+        default: return 0;
+    }
+}
+
+typedef struct {
+    cjson_value v;  /* container whose storage is going away */
+    size_t i;       /* next child to free */
+} cjson_free_frame;
+
+void cjson_free(cjson_value* v) {
+    cjson_free_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    assert(v != NULL);
+    if (!cjson_free_shallow(v)) {
+        cjson_init(v);
+        return;
+    }
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    f = CJSON_WALK_PUSH(&s, cjson_free_frame);
+    f->v = *v;
+    f->i = 0;
+    do {
+        const cjson_value* e;
+        f = CJSON_WALK_TOP(&s, cjson_free_frame);
+        if (f->i == cjson_walk_size(&f->v)) {
+            cjson_block_free(f->v.type == CJSON_ARRAY ? (void*)f->v.data.arr.elem : (void*)f->v.data.obj.memb);
+            CJSON_WALK_POP(&s, cjson_free_frame);
+            continue;
+        }
+        if (f->v.type == CJSON_ARRAY)
+            e = &f->v.data.arr.elem[f->i];
+        else {
+            cjson_string_release(f->v.data.obj.memb[f->i].k);
+            e = &f->v.data.obj.memb[f->i].v;
+        }
+        cjson_walk_prefetch(&f->v, ++f->i);
+        if (cjson_free_shallow(e)) {
+            f = CJSON_WALK_PUSH(&s, cjson_free_frame);
+            f->v = *e;
+            f->i = 0;
+        }
+    } while (s.top > 0);
+    cjson_walk_stack_free(&s);
+    cjson_init(v);
+}
+
+cjson_type cjson_get_type(const cjson_value* v) {
+    assert(v != NULL);
+    return v->type;
+}
+
+const static size_t CJSON_EQUAL_INDEX_THRESHOLD = 16;
+
+/* Hash of a string or key; strings are immutable, so the result is always cached. */
+static size_t cjson_hash_string(const char* s, size_t len) {
+    size_t h = CJSON_ATOMIC_LOAD(&CJSON_BLOCK(s)->hash);
+    if (h == 0) {
+        h = cjson_hash_key(s, len);
+        CJSON_ATOMIC_STORE(&CJSON_BLOCK(s)->hash, h);
+    }
+    return h;
+}
+
+/* Cached hash of a container, 0 if not computed since the last write. */
+static size_t cjson_cached_hash(const cjson_value* v) {
+    const void* s = CJSON_IS_ARRAY(v) || CJSON_IS_OBJECT(v) ? cjson_storage(v) : NULL;
+    return s ? CJSON_ATOMIC_LOAD(&CJSON_BLOCK(s)->hash) : 0;
+}
+
+static size_t cjson_hash_number(double n) {
+    size_t h;
+    n = n == 0.0 ? 0.0 : n;   /* -0.0 == 0.0 */
+    memcpy(&h, &n, sizeof(h) < sizeof(n) ? sizeof(h) : sizeof(n));
+    return cjson_hash_mix(h);
+}
+
+size_t cjson_hash(const cjson_value* v) {
+    size_t h;
+    assert(v != NULL);
+    switch (CJSON_FORM(v)) {
+        case CJSON_NULL:   return 0x6E756C6C;
+        case CJSON_FALSE:  return 0x66616C73;
+        case CJSON_TRUE:   return 0x74727565;
+        case CJSON_NUMBER:
+        case CJSON_RAW_NUMBER:  /* hashed by value, as it compares */
+            return cjson_hash_number(cjson_get_number(v));
+        case CJSON_STRING:
+            return cjson_hash_string(v->data.str.s, v->data.str.len);
+        case CJSON_ARRAY:
+            if ((h = cjson_cached_hash(v)) != 0)
+                return h;
+            h = 0x5B5D ^ v->data.arr.size;
+            for (size_t i = 0; i < v->data.arr.size; ++i)
+                h = cjson_hash_mix(h * 31 + cjson_hash(&v->data.arr.elem[i]));
+            break;
+        case CJSON_NUMBER_ARRAY:  /* as the same array unpacked */
+            if ((h = cjson_cached_hash(v)) != 0)
+                return h;
+            h = 0x5B5D ^ v->data.nums.size;
+            for (size_t i = 0; i < v->data.nums.size; ++i)
+                h = cjson_hash_mix(h * 31 + cjson_hash_number(v->data.nums.elem[i]));
+            break;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            if ((h = cjson_cached_hash(v)) != 0)
+                return h;
+            h = 0x7B7D ^ v->data.obj.size;
+            for (size_t i = 0; i < v->data.obj.size; ++i)  /* summed, so member order does not matter */
+                h += cjson_hash_mix(cjson_hash_string(v->data.obj.memb[i].k, v->data.obj.memb[i].klen) * 31 + cjson_hash(&v->data.obj.memb[i].v));
+            h = cjson_hash_mix(h);
+            break;
+        default: assert(0 && "invalid type"); return 0;
+    }
+    h |= 1;
+    if (cjson_storage(v))
+        CJSON_ATOMIC_STORE(&CJSON_BLOCK(cjson_storage(v))->hash, h);
+    return h;
+}
+
+/* Temporary open-addressing index of an object's keys, used instead of a linear
+ * cjson_find_object_index() per lookup when many keys of a large object are looked up. */
+typedef struct {
+    const cjson_value* obj;
+    size_t* slots;  /* member index + 1, 0 if empty */
+    size_t mask;
+} cjson_key_index;
+
+static void cjson_key_index_init(cjson_key_index* x, const cjson_value* obj) {
+    size_t capacity = 1;
+    while (capacity < obj->data.obj.size * 2)
+        capacity <<= 1;
+    x->obj = obj;
+    x->slots = (size_t*)cjson_heap_alloc(capacity * sizeof(size_t));
+    memset(x->slots, 0, capacity * sizeof(size_t));
+    x->mask = capacity - 1;
+    for (size_t i = 0; i < obj->data.obj.size; ++i) {
+        size_t j = cjson_hash_string(obj->data.obj.memb[i].k, obj->data.obj.memb[i].klen) & x->mask;
+        while (x->slots[j] != 0)
+            j = (j + 1) & x->mask;
+        x->slots[j] = i + 1;   /* duplicates land after the first occurrence, as in a linear search */
+    }
+}
+
+static size_t cjson_key_index_find(const cjson_key_index* x, const char* key, size_t klen, size_t khash) {
+    for (size_t j = khash & x->mask; x->slots[j] != 0; j = (j + 1) & x->mask) {
+        const cjson_member* m = &x->obj->data.obj.memb[x->slots[j] - 1];
+        if (m->klen == klen && memcmp(m->k, key, klen) == 0)
+            return x->slots[j] - 1;
+    }
+    return CJSON_KEY_NOT_EXIST;
+}
+
+static void cjson_key_index_free(cjson_key_index* x) {
+    cjson_heap_free(x->slots, (x->mask + 1) * sizeof(size_t));
+}
+
+/* A packed array against a packed or generic one. */
+static int cjson_is_equal_packed(const cjson_value* packed, const cjson_value* other) {
+    size_t lh, rh, size = packed->data.nums.size;
+    if (size != cjson_get_array_size(other))
+        return 0;
+    if ((lh = cjson_cached_hash(packed)) != 0 && (rh = cjson_cached_hash(other)) != 0 && lh != rh)
+        return 0;
+    if (other->form == CJSON_NUMBER_ARRAY) {
+        if (packed->data.nums.elem == other->data.nums.elem)  /* shared storage */
+            return 1;
+        for (size_t i = 0; i < size; ++i)
+            if (packed->data.nums.elem[i] != other->data.nums.elem[i])
+                return 0;
+        return 1;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        const cjson_value* e = &other->data.arr.elem[i];
+        if (cjson_get_type(e) != CJSON_NUMBER || cjson_get_number(e) != packed->data.nums.elem[i])
+            return 0;
+    }
+    return 1;
+}
+
+enum { CJSON_EQUAL_DESCEND = 2 };
+
+/* Compares lhs and rhs short of their children: 0 if they differ, 1 if they are equal, and
+ * CJSON_EQUAL_DESCEND if they are arrays or objects whose children are to be compared pairwise.
+ * Of two objects only one of which is frozen, the frozen one is moved to *rhs for lookups. */
+static int cjson_is_equal_shallow(const cjson_value** lhs, const cjson_value** rhs) {
+    const cjson_value* a = *lhs, *b = *rhs;
+    size_t lh, rh;
+    if (a->form == CJSON_NUMBER_ARRAY && CJSON_IS_ARRAY(b))
+        return cjson_is_equal_packed(a, b);
+    if (b->form == CJSON_NUMBER_ARRAY && CJSON_IS_ARRAY(a))
+        return cjson_is_equal_packed(b, a);
+    if (CJSON_FORM(a) != CJSON_FORM(b) && !(CJSON_IS_OBJECT(a) && CJSON_IS_OBJECT(b))) {
+        if (cjson_get_type(a) == CJSON_NUMBER && cjson_get_type(b) == CJSON_NUMBER)
+            return cjson_get_number(a) == cjson_get_number(b);
+        return 0;
+    }
+    switch (CJSON_FORM(a)) {
+        case CJSON_STRING:
+            return a->data.str.len == b->data.str.len && 
+                (a->data.str.s == b->data.str.s ||
+                 memcmp(a->data.str.s, b->data.str.s, a->data.str.len) == 0);
+        case CJSON_NUMBER:
+            return a->data.num == b->data.num;
+        case CJSON_RAW_NUMBER:
+            return a->data.str.s == b->data.str.s || cjson_get_number(a) == cjson_get_number(b);
+        case CJSON_ARRAY:
+            if (a->data.arr.size != b->data.arr.size)
+                return 0;
+            if (a->data.arr.size == 0 || a->data.arr.elem == b->data.arr.elem)  /* shared storage */
+                return 1;
+            break;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            if (a->data.obj.size != b->data.obj.size)
+                return 0;
+            if (a->data.obj.size == 0 || a->data.obj.memb == b->data.obj.memb)  /* shared storage */
+                return 1;
+            if (a->form == CJSON_FROZEN_OBJECT && b->form != CJSON_FROZEN_OBJECT) {
+                *lhs = b;
+                *rhs = a;
+            }
+            break;
+        default:
+            return 1;
+    }
+    if ((lh = cjson_cached_hash(a)) != 0 && (rh = cjson_cached_hash(b)) != 0 && lh != rh)
+        return 0;
+    return CJSON_EQUAL_DESCEND;
+}
+
+/* Arrays are compared element by element and two frozen objects member by member in their
+ * sorted order; otherwise the members of lhs are looked up in rhs, through a temporary key
+ * index when rhs is large and not frozen. */
+typedef struct {
+    const cjson_value* lhs, *rhs;
+    size_t i;               /* next child of lhs */
+    int indexed;
+    cjson_key_index index;  /* of rhs, if indexed */
+} cjson_equal_frame;
+
+static void cjson_equal_push(cjson_walk_stack* s, const cjson_value* lhs, const cjson_value* rhs) {
+    cjson_equal_frame* f = CJSON_WALK_PUSH(s, cjson_equal_frame);
+    f->lhs = lhs;
+    f->rhs = rhs;
+    f->i = 0;
+    f->indexed = CJSON_FORM(lhs) == CJSON_OBJECT && CJSON_FORM(rhs) == CJSON_OBJECT && lhs->data.obj.size >= CJSON_EQUAL_INDEX_THRESHOLD;
+    if (f->indexed)
+        cjson_key_index_init(&f->index, rhs);
+}
+
+static void cjson_equal_pop(cjson_walk_stack* s) {
+    cjson_equal_frame* f = CJSON_WALK_TOP(s, cjson_equal_frame);
+    if (f->indexed)
+        cjson_key_index_free(&f->index);
+    CJSON_WALK_POP(s, cjson_equal_frame);
+}
+
+int cjson_is_equal(const cjson_value* lhs, const cjson_value* rhs) {
+    cjson_equal_frame local[CJSON_WALK_LOCAL_DEPTH], *f;
+    cjson_walk_stack s;
+    int ret;
+    assert(lhs != NULL && rhs != NULL);
+    if ((ret = cjson_is_equal_shallow(&lhs, &rhs)) != CJSON_EQUAL_DESCEND)
+        return ret;
+    cjson_walk_stack_init(&s, local, sizeof(local));
+    cjson_equal_push(&s, lhs, rhs);
+    do {
+        const cjson_value* a, *b;
+        f = CJSON_WALK_TOP(&s, cjson_equal_frame);
+        if (f->i == cjson_walk_size(f->lhs)) {
+            cjson_equal_pop(&s);
+            continue;
+        }
+        if (f->lhs->type == CJSON_ARRAY) {
+            a = &f->lhs->data.arr.elem[f->i];
+            b = &f->rhs->data.arr.elem[f->i];
+        }
+        else if (f->lhs->form == CJSON_FROZEN_OBJECT && f->rhs->form == CJSON_FROZEN_OBJECT) {
+            const cjson_member *m = &f->lhs->data.obj.memb[f->i], *n = &f->rhs->data.obj.memb[f->i];
+            if (m->klen != n->klen || (m->k != n->k && memcmp(m->k, n->k, m->klen) != 0)) {
+                ret = 0;
+                break;
+            }
+            a = &m->v;
+            b = &n->v;
+        }
+        else {
+            const cjson_member* m = &f->lhs->data.obj.memb[f->i];
+            size_t index = f->indexed
+                ? cjson_key_index_find(&f->index, m->k, m->klen, cjson_hash_string(m->k, m->klen))
+                : cjson_find_object_index(f->rhs, m->k, m->klen);
+            if (index == CJSON_KEY_NOT_EXIST) {
+                ret = 0;
+                break;
+            }
+            a = &m->v;
+            b = &f->rhs->data.obj.memb[index].v;
+        }
+        cjson_walk_prefetch(f->lhs, ++f->i);
+        if ((ret = cjson_is_equal_shallow(&a, &b)) == 0)
+            break;
+        if (ret == CJSON_EQUAL_DESCEND)
+            cjson_equal_push(&s, a, b);
+    } while (s.top > 0);
+    while (s.top > 0)   /* left by a mismatch */
+        cjson_equal_pop(&s);
+    cjson_walk_stack_free(&s);
+    return ret != 0;
+}
+
+void cjson_set_null(cjson_value* v) {
+    cjson_free(v);
+}
+
+int cjson_get_boolean(const cjson_value* v) {
+    assert(v != NULL && (v->type == CJSON_TRUE || v->type == CJSON_FALSE));
+    return v->type == CJSON_TRUE;
+}
+
+void cjson_set_boolean(cjson_value* v, int b) {
+    cjson_free(v);
+    v->type = b ? CJSON_TRUE : CJSON_FALSE;
+}
+
+/* Decodes a raw number; the first caller to get here publishes the result for the others. */
+static double cjson_raw_number(const cjson_value* v) {
+    cjson_raw_cache* cache = CJSON_RAW_CACHE(v->data.str.s, v->data.str.len);
+    double n;
+    if (CJSON_ATOMIC_LOAD(&cache->state) == CJSON_RAW_READY)
+        return cache->num;
+    n = strtod(v->data.str.s, NULL);
+    if (CJSON_ATOMIC_CAS(&cache->state, CJSON_RAW_PENDING, CJSON_RAW_DECODING)) {
+        cache->num = n;
+        CJSON_ATOMIC_STORE(&cache->state, CJSON_RAW_READY);
+    }
+    return n;
+}
+
+double cjson_get_number(const cjson_value* v) {
+    assert(v != NULL && v->type == CJSON_NUMBER);
+    return v->form == CJSON_RAW_NUMBER ? cjson_raw_number(v) : v->data.num;
+}
+
+/* Integer literals of raw numbers convert exactly, beyond the 53 bits a double holds;
+ * everything else is truncated and saturated. */
+long long cjson_get_int(const cjson_value* v) {
+    double n;
+    assert(v != NULL && v->type == CJSON_NUMBER);
+    if (v->form == CJSON_RAW_NUMBER && strpbrk(v->data.str.s, ".eE") == NULL) {
+        long long i;
+        errno = 0;
+        i = strtoll(v->data.str.s, NULL, 10);
+        if (errno != ERANGE)
+            return i;
+    }
+    n = cjson_get_number(v);
+    if (n >= 9223372036854775807.0)
+        return LLONG_MAX;
+    if (n <= -9223372036854775808.0)
+        return LLONG_MIN;
+    return n == n ? (long long)n : 0;
+}
+
+const char* cjson_get_number_literal(const cjson_value* v, size_t* len) {
+    assert(v != NULL && v->type == CJSON_NUMBER);
+    if (v->form != CJSON_RAW_NUMBER)
+        return NULL;
+    if (len) *len = v->data.str.len;
+    return v->data.str.s;
+}
+
+void cjson_set_number(cjson_value* v, double n) {
+    cjson_free(v);
+    v->data.num = n;
+    v->type = CJSON_NUMBER;
+}
+
+const char* cjson_get_string(const cjson_value* v) {
+    assert(v != NULL && v->type == CJSON_STRING);
+    return v->data.str.s;
+}
+
+size_t cjson_get_string_length(const cjson_value* v) {
+    assert(v != NULL && v->type == CJSON_STRING);
+    return v->data.str.len;
+}
+
+void cjson_set_string(cjson_value* v, const char* s, size_t len) {
+    assert(v != NULL && (s != NULL || len == 0));
+    cjson_free(v);
+    v->data.str.s = cjson_string_dup(s, len);
+    v->data.str.len = len;
+    v->type = CJSON_STRING;
+}
+
+void cjson_set_array(cjson_value* v, size_t capacity) {
+    assert(v != NULL);
+    cjson_free(v);
+    v->type = CJSON_ARRAY;
+    v->data.arr.size = 0;
+    v->data.arr.capacity = capacity;
+    v->data.arr.elem = capacity > 0 ? (cjson_value*)cjson_block_alloc(capacity * sizeof(cjson_value)) : NULL;
+}
+
+size_t cjson_get_array_size(const cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    return v->form == CJSON_NUMBER_ARRAY ? v->data.nums.size : v->data.arr.size;
+}
+
+size_t cjson_get_array_capacity(const cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    return v->form == CJSON_NUMBER_ARRAY ? v->data.nums.capacity : v->data.arr.capacity;
+}
+
+void cjson_set_number_array(cjson_value* v, const double* numbers, size_t count) {
+    double* nums;
+    assert(v != NULL && (numbers != NULL || count == 0));
+    if (count == 0) {
+        cjson_set_array(v, 0);
+        return;
+    }
+    nums = (double*)cjson_block_alloc(count * sizeof(double));
+    memcpy(nums, numbers, count * sizeof(double));   /* before freeing v: numbers may be its own */
+    cjson_free(v);
+    v->type = CJSON_ARRAY;
+    v->form = CJSON_NUMBER_ARRAY;
+    v->data.nums.elem = nums;
+    v->data.nums.size = v->data.nums.capacity = count;
+}
+
+int cjson_get_number_array(const cjson_value* v, const double** numbers, size_t* count) {
+    assert(v != NULL);
+    if (v->form != CJSON_NUMBER_ARRAY)
+        return 0;
+    if (numbers) *numbers = v->data.nums.elem;
+    if (count) *count = v->data.nums.size;
+    return 1;
+}
+
+void cjson_reserve_array(cjson_value* v, size_t capacity) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    if (cjson_get_array_capacity(v) >= capacity)
+        return;
+    cjson_touch(v);
+    if (v->form == CJSON_NUMBER_ARRAY) {
+        v->data.nums.capacity = capacity;
+        v->data.nums.elem = (double*)cjson_block_realloc(v->data.nums.elem, capacity * sizeof(double));
+    }
+    else {
+        v->data.arr.capacity = capacity;
+        v->data.arr.elem = (cjson_value*)cjson_block_realloc(v->data.arr.elem, capacity * sizeof(cjson_value));
+    }
+}
+
+void cjson_shrink_array(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    if (cjson_get_array_capacity(v) == cjson_get_array_size(v))
+        return;
+    cjson_touch(v);
+    if (v->form == CJSON_NUMBER_ARRAY) {
+        v->data.nums.capacity = v->data.nums.size;
+        v->data.nums.elem = (double*)cjson_block_realloc(v->data.nums.elem, v->data.nums.capacity * sizeof(double));
+    }
+    else {
+        v->data.arr.capacity = v->data.arr.size;
+        v->data.arr.elem = (cjson_value*)cjson_block_realloc(v->data.arr.elem, v->data.arr.capacity * sizeof(cjson_value));
+    }
+}
+
+void cjson_clear_array(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    cjson_erase_array_element(v, 0, cjson_get_array_size(v));
+}
+
+/* Hands out a value the caller may store anything in, so a packed array turns generic here. */
+cjson_value* cjson_get_array_element(cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    cjson_unpack(v);
+    assert(index < v->data.arr.size);
+    cjson_touch(v);
+    return &v->data.arr.elem[index];
+}
+
+/* Reads leave packed arrays packed, so there is no element value to point at in one: NULL. */
+const cjson_value* cjson_get_array_element_const(const cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    assert(index < cjson_get_array_size(v));
+    if (v->form == CJSON_NUMBER_ARRAY)
+        return NULL;
+    return &v->data.arr.elem[index];
+}
+
+double cjson_get_array_number(const cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    assert(index < cjson_get_array_size(v));
+    if (v->form == CJSON_NUMBER_ARRAY)
+        return v->data.nums.elem[index];
+    return cjson_get_number(&v->data.arr.elem[index]);
+}
+
+/* Stores a number without handing out a value, so a packed array stays packed. */
+void cjson_set_array_number(cjson_value* v, size_t index, double n) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    assert(index < cjson_get_array_size(v));
+    if (v->form != CJSON_NUMBER_ARRAY) {
+        cjson_set_number(cjson_get_array_element(v, index), n);
+        return;
+    }
+    cjson_touch(v);
+    v->data.nums.elem[index] = n;
+}
+
+cjson_value* cjson_pushback_array_element(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    cjson_unpack(v);
+    cjson_touch(v);
+    if (v->data.arr.size == v->data.arr.capacity)
+        cjson_reserve_array(v, v->data.arr.capacity == 0 ? 1 : v->data.arr.capacity * 2);
+    cjson_touch(v);
+    cjson_init(&v->data.arr.elem[v->data.arr.size]);
+    return &v->data.arr.elem[v->data.arr.size++];
+}
+
+void cjson_pushback_array_number(cjson_value* v, double n) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    if (v->form != CJSON_NUMBER_ARRAY) {
+        cjson_set_number(cjson_pushback_array_element(v), n);
+        return;
+    }
+    cjson_touch(v);
+    if (v->data.nums.size == v->data.nums.capacity)
+        cjson_reserve_array(v, v->data.nums.capacity == 0 ? 1 : v->data.nums.capacity * 2);
+    v->data.nums.elem[v->data.nums.size++] = n;
+}
+
+void cjson_popback_array_element(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    assert(cjson_get_array_size(v) > 0);
+    cjson_touch(v);
+    if (v->form == CJSON_NUMBER_ARRAY)
+        v->data.nums.size--;
+    else
+        cjson_free(&v->data.arr.elem[--v->data.arr.size]);
+}
+
+cjson_value* cjson_insert_array_element(cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    cjson_unpack(v);
+    assert(index <= v->data.arr.size);   /* if index == size, then this's equivalent to pushback*/
+    cjson_touch(v);
+    if (v->data.arr.size == v->data.arr.capacity) {
+        cjson_reserve_array(v, v->data.arr.capacity == 0 ? 1 : v->data.arr.capacity * 2);
+    }
+    cjson_touch(v);
+    for(size_t i = v->data.arr.size++; i > index; --i) {
+        v->data.arr.elem[i] = v->data.arr.elem[i - 1];
+    }
+    cjson_init(&v->data.arr.elem[index]);   /* the slot still aliases the shifted element */
+    return &v->data.arr.elem[index]; 
+}
+
+void cjson_erase_array_element(cjson_value* v, size_t index, size_t count) {
+    assert(v != NULL && CJSON_IS_ARRAY(v));
+    assert(index + count <= cjson_get_array_size(v));
+    if(!count) return;
+    cjson_touch(v);
+    if (v->form == CJSON_NUMBER_ARRAY) {
+        memmove(&v->data.nums.elem[index], &v->data.nums.elem[index + count], sizeof(double) * (v->data.nums.size - index - count));
+        v->data.nums.size -= count;
+        return;
+    }
+    for(size_t i = index; i < index + count; ++i)
+        cjson_free(&v->data.arr.elem[i]);
+    memmove(&v->data.arr.elem[index], &v->data.arr.elem[index + count], sizeof(cjson_value) * (v->data.arr.size - index - count));
+    v->data.arr.size -= count;
+}
+
+void cjson_set_object(cjson_value* v, size_t capacity) {
+    assert(v != NULL);
+    cjson_free(v);
+    v->type = CJSON_OBJECT;
+    v->data.obj.size = 0;
+    v->data.obj.capacity = capacity;
+    v->data.obj.memb = capacity > 0 ? (cjson_member*)cjson_block_alloc(capacity * sizeof(cjson_member)) : NULL;
+}
+
+size_t cjson_get_object_size(const cjson_value* v) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    return v->data.obj.size;
+}
+
+size_t cjson_get_object_capacity(const cjson_value* v) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    return v->data.obj.capacity;
+}
+
+void cjson_reserve_object(cjson_value* v, size_t capacity) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    if (v->data.obj.capacity < capacity) {
+        cjson_touch(v);
+        v->data.obj.capacity = capacity;
+        v->data.obj.memb = (cjson_member*)cjson_block_realloc(v->data.obj.memb, capacity * sizeof(cjson_member));
+    }
+}
+
+void cjson_shrink_object(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    if (v->data.obj.capacity > v->data.obj.size) {
+        cjson_touch(v);
+        v->data.obj.capacity = v->data.obj.size;
+        v->data.obj.memb = (cjson_member*)cjson_block_realloc(v->data.obj.memb, v->data.obj.size * sizeof(cjson_member));
+    }
+}
+
+void cjson_clear_object(cjson_value* v) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    cjson_touch(v);
+    for(size_t i = 0; i < v->data.obj.size; ++i){
+        cjson_string_release(v->data.obj.memb[i].k);
+        cjson_free(&v->data.obj.memb[i].v);
+    }
+    v->data.obj.size = 0;
+}
+
+const char* cjson_get_object_key(const cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    assert(index < v->data.obj.size);
+    return v->data.obj.memb[index].k;
+}
+
+size_t cjson_get_object_key_length(const cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    assert(index < v->data.obj.size);
+    return v->data.obj.memb[index].klen;
+}
+
+cjson_value* cjson_get_object_value(cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    assert(index < v->data.obj.size);
+    cjson_touch(v);
+    return &v->data.obj.memb[index].v;
+}
+
+const cjson_value* cjson_get_object_value_const(const cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_OBJECT(v));
+    assert(index < v->data.obj.size);
+    return &v->data.obj.memb[index].v;
+}
+
+/* Lower bound: the first of equal keys, as a linear search finds them. */
+static size_t cjson_find_frozen_index(const cjson_value* v, const char* key, size_t klen) {
+    const cjson_member* base = v->data.obj.memb;
+    size_t n = v->data.obj.size;
+    if (n == 0)
+        return CJSON_KEY_NOT_EXIST;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = cjson_key_compare(base[half - 1].k, base[half - 1].klen, key, klen) < 0 ? base + half : base;
+        n -= half;
+    }
+    base += cjson_key_compare(base->k, base->klen, key, klen) < 0;
+    if (base == v->data.obj.memb + v->data.obj.size || base->klen != klen || memcmp(base->k, key, klen) != 0)
+        return CJSON_KEY_NOT_EXIST;
+    return (size_t)(base - v->data.obj.memb);
+}
+
+size_t cjson_find_object_index(const cjson_value* v, const char* key, size_t klen) {
+    assert(v != NULL && CJSON_IS_OBJECT(v) && key != NULL);
+    if (v->form == CJSON_FROZEN_OBJECT)
+        return cjson_find_frozen_index(v, key, klen);
+    for (size_t i = 0; i < v->data.obj.size; ++i)
+        if (v->data.obj.memb[i].klen == klen && memcmp(v->data.obj.memb[i].k, key, klen) == 0)
+            return i;
+    return CJSON_KEY_NOT_EXIST;
+}
+
+cjson_value* cjson_find_object_value(cjson_value* v, const char* key, size_t klen) {
+    size_t index = cjson_find_object_index(v, key, klen);
+    return index != CJSON_KEY_NOT_EXIST ? cjson_get_object_value(v, index) : NULL;
+}
+
+const cjson_value* cjson_find_object_value_const(const cjson_value* v, const char* key, size_t klen) {
+    size_t index = cjson_find_object_index(v, key, klen);
+    return index != CJSON_KEY_NOT_EXIST ? cjson_get_object_value_const(v, index) : NULL;
+}
+
+void cjson_field_cache_init(cjson_field_cache* fc, const char* key, size_t klen) {
+    assert(fc != NULL && key != NULL);
+    fc->key = key;
+    fc->klen = klen;
+    fc->hash = cjson_hash_key(key, klen);
+    fc->k = NULL;
+    fc->index = 0;
+}
+
+void cjson_field_cache_free(cjson_field_cache* fc) {
+    assert(fc != NULL);
+    cjson_string_release((char*)fc->k);
+    fc->k = NULL;
+}
+
+/* Whether m holds the cached key. Holding a reference to the key storage of the last hit makes
+ * an equal pointer proof of an equal key, the common case for objects whose keys are shared
+ * (CJSON_PARSE_SHARE_KEYS, dedup pools, shared copies); otherwise a key hash cached in its
+ * storage rules out most mismatches without a memcmp(). */
+static int cjson_field_cache_match(const cjson_field_cache* fc, const cjson_member* m) {
+    size_t h;
+    if (m->k == fc->k)
+        return 1;
+    return m->klen == fc->klen && ((h = CJSON_ATOMIC_LOAD(&CJSON_BLOCK(m->k)->hash)) == 0 || h == fc->hash)
+        && memcmp(m->k, fc->key, fc->klen) == 0;
+}
+
+/* Whether no member before index holds the cached key, so that a hit at index is the one
+ * cjson_find_object_index() finds. A frozen object keeps equal keys next to each other. */
+static int cjson_field_cache_is_first(const cjson_value* v, const cjson_field_cache* fc, size_t index) {
+    if (v->form == CJSON_FROZEN_OBJECT)
+        return index == 0 || !cjson_field_cache_match(fc, &v->data.obj.memb[index - 1]);
+    for (size_t i = 0; i < index; i++)
+        if (cjson_field_cache_match(fc, &v->data.obj.memb[i]))
+            return 0;
+    return 1;
+}
+
+/* The member at the index of the last hit is checked first. */
+size_t cjson_find_object_index_cached(const cjson_value* v, cjson_field_cache* fc) {
+    size_t index = CJSON_KEY_NOT_EXIST;
+    assert(v != NULL && CJSON_IS_OBJECT(v) && fc != NULL);
+    if (fc->index < v->data.obj.size && cjson_field_cache_match(fc, &v->data.obj.memb[fc->index])
+        && cjson_field_cache_is_first(v, fc, fc->index)) {
+        if (v->data.obj.memb[fc->index].k == fc->k)
+            return fc->index;
+        index = fc->index;
+    }
+    if (index == CJSON_KEY_NOT_EXIST && (index = cjson_find_object_index(v, fc->key, fc->klen)) == CJSON_KEY_NOT_EXIST)
+        return index;
+    cjson_block_retain(v->data.obj.memb[index].k);
+    cjson_string_release((char*)fc->k);
+    fc->k = v->data.obj.memb[index].k;
+    fc->index = index;
+    return index;
+}
+
+cjson_value* cjson_find_object_value_cached(cjson_value* v, cjson_field_cache* fc) {
+    size_t index = cjson_find_object_index_cached(v, fc);
+    return index != CJSON_KEY_NOT_EXIST ? cjson_get_object_value(v, index) : NULL;
+}
+
+const cjson_value* cjson_find_object_value_cached_const(const cjson_value* v, cjson_field_cache* fc) {
+    size_t index = cjson_find_object_index_cached(v, fc);
+    return index != CJSON_KEY_NOT_EXIST ? cjson_get_object_value_const(v, index) : NULL;
+}
+
+cjson_value* cjson_set_object_value(cjson_value* v, const char* key, size_t klen) {
+    assert(v != NULL && CJSON_IS_OBJECT(v) && key != NULL);
+    cjson_touch(v);
+    v->form = 0;    /* appending breaks the order of a frozen object */
+    if (v->data.obj.size == v->data.obj.capacity)
+        cjson_reserve_object(v, v->data.obj.capacity == 0 ? 1 : v->data.obj.capacity * 2);
+    cjson_touch(v);
+    v->data.obj.memb[v->data.obj.size].k = cjson_string_dup(key, klen);
+    v->data.obj.memb[v->data.obj.size].klen = klen;
+    cjson_init(&(v->data.obj.memb[v->data.obj.size].v));
+    return &v->data.obj.memb[v->data.obj.size++].v;
+}
+
+void cjson_remove_object_value(cjson_value* v, size_t index) {
+    assert(v != NULL && CJSON_IS_OBJECT(v) && index < v->data.obj.size);
+    cjson_touch(v);
+    cjson_string_release(v->data.obj.memb[index].k);
+    cjson_free(&(v->data.obj.memb[index].v));
+    memmove(&v->data.obj.memb[index], &v->data.obj.memb[index+1], sizeof(cjson_member)*(v->data.obj.size-index-1));
+    v->data.obj.size--;
+}
+
+/* Stable merge sort by key; tmp holds n / 2 members. */
+static void cjson_sort_members(cjson_member* m, cjson_member* tmp, size_t n) {
+    size_t half = n / 2, i = 0, j = half, k = 0;
+    if (n < 2)
+        return;
+    cjson_sort_members(m, tmp, half);
+    cjson_sort_members(m + half, tmp, n - half);
+    if (cjson_key_compare(m[half - 1].k, m[half - 1].klen, m[half].k, m[half].klen) <= 0)
+        return;     /* already in order, the common case for generated documents */
+    memcpy(tmp, m, half * sizeof(cjson_member));
+    while (i < half && j < n)   /* equal keys keep their order: the left run wins ties */
+        m[k++] = cjson_key_compare(m[j].k, m[j].klen, tmp[i].k, tmp[i].klen) < 0 ? m[j++] : tmp[i++];
+    while (i < half)
+        m[k++] = tmp[i++];
+}
+
+static void cjson_freeze_value(cjson_value* v, cjson_member* tmp) {
+    if (CJSON_FORM(v) == CJSON_ARRAY) {
+        cjson_touch(v);
+        for (size_t i = 0; i < v->data.arr.size; ++i)
+            cjson_freeze_value(&v->data.arr.elem[i], tmp);
+    }
+    else if (CJSON_IS_OBJECT(v)) {
+        cjson_touch(v);
+        for (size_t i = 0; i < v->data.obj.size; ++i)
+            cjson_freeze_value(&v->data.obj.memb[i].v, tmp);
+        if (v->form != CJSON_FROZEN_OBJECT)
+            cjson_sort_members(v->data.obj.memb, tmp, v->data.obj.size);
+        v->form = CJSON_FROZEN_OBJECT;
+    }
+}
+
+static size_t cjson_freeze_scratch(const cjson_value* v) {
+    size_t n = 0, m;
+    if (CJSON_FORM(v) == CJSON_ARRAY)
+        for (size_t i = 0; i < v->data.arr.size; ++i)
+            n = (m = cjson_freeze_scratch(&v->data.arr.elem[i])) > n ? m : n;
+    else if (CJSON_IS_OBJECT(v)) {
+        n = v->data.obj.size / 2;
+        for (size_t i = 0; i < v->data.obj.size; ++i)
+            n = (m = cjson_freeze_scratch(&v->data.obj.memb[i].v)) > n ? m : n;
+    }
+    return n;
+}
+
+/* Sorts the members of every object in v by key, so that lookups binary search and equal
+ * frozen objects compare in one pass. Member values stay writable; adding a member thaws
+ * the object it goes into. */
+void cjson_freeze(cjson_value* v) {
+    size_t n;
+    cjson_member* tmp;
+    assert(v != NULL);
+    n = cjson_freeze_scratch(v);
+    tmp = n > 0 ? (cjson_member*)cjson_heap_alloc(n * sizeof(cjson_member)) : NULL;
+    cjson_freeze_value(v, tmp);
+    cjson_heap_free(tmp, n * sizeof(cjson_member));
+}
+
+int cjson_is_frozen(const cjson_value* v) {
+    assert(v != NULL);
+    return v->form == CJSON_FROZEN_OBJECT;
+}
+
+// ===========================
+// ========== dedup ==========
+// ===========================
+
+void cjson_dedup_pool_init(cjson_dedup_pool* p) {
+    assert(p != NULL);
+    p->entries = NULL;
+    p->size = p->capacity = 0;
+    p->hits = p->bytes_saved = 0;
+}
+
+void cjson_dedup_pool_free(cjson_dedup_pool* p) {
+    assert(p != NULL);
+    for (size_t i = 0; i < p->capacity; ++i)
+        cjson_free(&p->entries[i]);
+    cjson_heap_free(p->entries, p->capacity * sizeof(cjson_value));
+    cjson_dedup_pool_init(p);
+}
+
+/*
+ * The pool merges byte-identical subtrees only: same forms, member order, number bits and raw
+ * text. Children are canonicalized before their container is looked up, so containers compare
+ * their elements by instance rather than by value.
+ */
+static size_t cjson_dedup_element_hash(const cjson_value* e) {
+    size_t h = (size_t)CJSON_FORM(e);
+    if (CJSON_FORM(e) == CJSON_NUMBER) {
+        uint64_t bits;
+        memcpy(&bits, &e->data.num, sizeof(bits));
+        h += (size_t)(bits ^ (bits >> 32));
+    }
+    else
+        h += (size_t)cjson_storage(e);
+    return cjson_hash_mix(h);
+}
+
+static size_t cjson_dedup_hash(const cjson_value* v) {
+    size_t h = (size_t)CJSON_FORM(v), i;
+    switch (CJSON_FORM(v)) {
+        case CJSON_STRING: return cjson_hash_mix(h + cjson_hash_string(v->data.str.s, v->data.str.len));
+        case CJSON_RAW_NUMBER: return cjson_hash_mix(h + cjson_hash_bytes(v->data.str.s, v->data.str.len));
+        case CJSON_NUMBER_ARRAY:
+            return cjson_hash_mix(h + cjson_hash_bytes((const char*)v->data.nums.elem, v->data.nums.size * sizeof(double)));
+        case CJSON_ARRAY:
+            for (i = 0; i < v->data.arr.size; ++i)
+                h = cjson_hash_mix(h + cjson_dedup_element_hash(&v->data.arr.elem[i]));
+            return h;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            for (i = 0; i < v->data.obj.size; ++i) {
+                const cjson_member* m = &v->data.obj.memb[i];
+                h = cjson_hash_mix(h + cjson_hash_string(m->k, m->klen));
+                h = cjson_hash_mix(h + cjson_dedup_element_hash(&m->v));
+            }
+            return h;
+        default: return h;
+    }
+}
+
+static int cjson_dedup_equal(const cjson_value* a, const cjson_value* b) {
+    size_t i;
+    if (a->type != b->type || a->form != b->form)
+        return 0;
+    switch (CJSON_FORM(a)) {
+        case CJSON_STRING:
+        case CJSON_RAW_NUMBER:
+            return a->data.str.len == b->data.str.len && memcmp(a->data.str.s, b->data.str.s, a->data.str.len) == 0;
+        case CJSON_NUMBER_ARRAY:
+            return a->data.nums.size == b->data.nums.size &&
+                memcmp(a->data.nums.elem, b->data.nums.elem, a->data.nums.size * sizeof(double)) == 0;
+        case CJSON_ARRAY:
+            if (a->data.arr.size != b->data.arr.size)
+                return 0;
+            for (i = 0; i < a->data.arr.size; ++i)
+                if (!cjson_same_element(&a->data.arr.elem[i], &b->data.arr.elem[i]))
+                    return 0;
+            return 1;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            if (a->data.obj.size != b->data.obj.size)
+                return 0;
+            for (i = 0; i < a->data.obj.size; ++i) {
+                const cjson_member* m = &a->data.obj.memb[i];
+                const cjson_member* n = &b->data.obj.memb[i];
+                if (m->klen != n->klen || (m->k != n->k && memcmp(m->k, n->k, m->klen) != 0) ||
+                    !cjson_same_element(&m->v, &n->v))
+                    return 0;
+            }
+            return 1;
+        default: return 1;
+    }
+}
+
+/* Canonical value identical to v, or NULL; empty slots hold CJSON_NULL. */
+static cjson_value* cjson_dedup_find(cjson_dedup_pool* p, const cjson_value* v, size_t h) {
+    if (p->capacity == 0)
+        return NULL;
+    for (size_t i = h & (p->capacity - 1); p->entries[i].type != CJSON_NULL; i = (i + 1) & (p->capacity - 1))
+        if (cjson_dedup_equal(&p->entries[i], v))
+            return &p->entries[i];
+    return NULL;
+}
+
+static void cjson_dedup_add(cjson_dedup_pool* p, const cjson_value* v, size_t h) {
+    size_t i;
+    if ((p->size + 1) * 2 > p->capacity) {
+        cjson_value* old = p->entries;
+        size_t capacity = p->capacity;
+        p->capacity = capacity == 0 ? 64 : capacity * 2;
+        p->entries = (cjson_value*)cjson_heap_alloc(p->capacity * sizeof(cjson_value));
+        for (i = 0; i < p->capacity; ++i)
+            cjson_init(&p->entries[i]);
+        for (size_t j = 0; j < capacity; ++j) {
+            if (old[j].type == CJSON_NULL)
+                continue;
+            for (i = cjson_dedup_hash(&old[j]) & (p->capacity - 1); p->entries[i].type != CJSON_NULL; i = (i + 1) & (p->capacity - 1))
+                ;
+            memcpy(&p->entries[i], &old[j], sizeof(cjson_value));
+        }
+        cjson_heap_free(old, capacity * sizeof(cjson_value));
+    }
+    for (i = h & (p->capacity - 1); p->entries[i].type != CJSON_NULL; i = (i + 1) & (p->capacity - 1))
+        ;
+    cjson_copy_shared(&p->entries[i], v);
+    p->size++;
+}
+
+/* Replaces the key storage *k with its canonical instance. */
+static void cjson_dedup_key(cjson_dedup_pool* p, char** k, size_t klen) {
+    cjson_value key, *c;
+    size_t h;
+    cjson_init(&key);
+    key.type = CJSON_STRING;
+    key.data.str.s = *k;
+    key.data.str.len = klen;
+    h = cjson_dedup_hash(&key);
+    if ((c = cjson_dedup_find(p, &key, h)) == NULL)
+        cjson_dedup_add(p, &key, h);
+    else if (c->data.str.s != *k) {
+        if (!cjson_block_is_shared(*k))
+            p->bytes_saved += sizeof(cjson_block) + klen + 1;
+        p->hits++;
+        cjson_block_retain(c->data.str.s);
+        cjson_string_release(*k);
+        *k = c->data.str.s;
+    }
+}
+
+static size_t cjson_dedup_storage_size(const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_STRING: return sizeof(cjson_block) + v->data.str.len + 1;
+        case CJSON_RAW_NUMBER: return sizeof(cjson_block) + CJSON_RAW_TEXT_SIZE(v->data.str.len) + sizeof(cjson_raw_cache);
+        case CJSON_ARRAY:  return sizeof(cjson_block) + v->data.arr.capacity * sizeof(cjson_value);
+        case CJSON_NUMBER_ARRAY: return sizeof(cjson_block) + v->data.nums.capacity * sizeof(double);
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT: return sizeof(cjson_block) + v->data.obj.capacity * sizeof(cjson_member);
+        default: return 0;
+    }
+}
+
+/* Replaces v with its canonical instance if the pool holds one, returns whether it did. */
+static int cjson_dedup_replace(cjson_dedup_pool* p, cjson_value* v, size_t h) {
+    cjson_value* c = cjson_dedup_find(p, v, h);
+    void* storage = cjson_storage(v);
+    if (c == NULL)
+        return 0;
+    if (cjson_storage(c) != storage) {
+        if (!cjson_block_is_shared(storage))
+            p->bytes_saved += cjson_dedup_storage_size(v);
+        p->hits++;
+        cjson_copy_shared(v, c);
+    }
+    return 1;
+}
+
+static void cjson_dedup_value(cjson_dedup_pool* p, cjson_value* v) {
+    if (cjson_storage(v) == NULL)
+        return;     /* scalars and empty containers */
+    if (cjson_dedup_replace(p, v, cjson_dedup_hash(v)))
+        return;     /* leaves, and containers whose children are canonical already */
+    if (CJSON_FORM(v) == CJSON_ARRAY) {
+        cjson_touch(v);
+        for (size_t i = 0; i < v->data.arr.size; ++i)
+            cjson_dedup_value(p, &v->data.arr.elem[i]);
+    }
+    else if (CJSON_IS_OBJECT(v)) {
+        cjson_touch(v);
+        for (size_t i = 0; i < v->data.obj.size; ++i) {
+            cjson_dedup_key(p, &v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
+            cjson_dedup_value(p, &v->data.obj.memb[i].v);
+        }
+    }
+    else {
+        cjson_dedup_add(p, v, cjson_dedup_hash(v));
+        return;
+    }
+    /* with canonical children, an identical container is now a match by instance */
+    {
+        size_t h = cjson_dedup_hash(v);
+        if (!cjson_dedup_replace(p, v, h))
+            cjson_dedup_add(p, v, h);
+    }
+}
+
+void cjson_dedup_pool_insert(cjson_dedup_pool* p, cjson_value* v) {
+    assert(p != NULL && v != NULL);
+    cjson_dedup_value(p, v);
+}
+
+void cjson_dedup_pool_trim(cjson_dedup_pool* p) {
+    size_t removed;
+    assert(p != NULL);
+    do {    /* dropping a container can leave its children referenced by the pool only */
+        cjson_value* old = p->entries;
+        size_t capacity = p->capacity;
+        removed = 0;
+        p->entries = NULL;
+        p->size = p->capacity = 0;
+        for (size_t i = 0; i < capacity; ++i) {
+            if (old[i].type == CJSON_NULL)
+                continue;
+            if (cjson_block_is_shared(cjson_storage(&old[i])))
+                cjson_dedup_add(p, &old[i], cjson_dedup_hash(&old[i]));
+            else
+                removed++;
+            cjson_free(&old[i]);
+        }
+        cjson_heap_free(old, capacity * sizeof(cjson_value));
+    } while (removed > 0 && p->size > 0);
+}
+
+// =============================
+// ========== columns ==========
+// =============================
+
+/* Stores row of a column from e, which is NULL when the record lacks the field. */
+static void cjson_columns_put(cjson_column* col, cjson_context* chars, size_t row, const cjson_value* e) {
+    cjson_type type = e != NULL ? cjson_get_type(e) : CJSON_NULL;
+    int valid = 0;
+    switch (col->type) {
+        case CJSON_COLUMN_NUMBER:
+            valid = type == CJSON_NUMBER;
+            col->numbers[row] = valid ? cjson_get_number(e) : 0.0;
+            break;
+        case CJSON_COLUMN_INT:
+            valid = type == CJSON_NUMBER;
+            col->ints[row] = valid ? cjson_get_int(e) : 0;
+            break;
+        case CJSON_COLUMN_STRING:
+            if ((valid = type == CJSON_STRING) && e->data.str.len > 0)
+                PUTS(chars, e->data.str.s, e->data.str.len);
+            col->offsets[row + 1] = chars->top;
+            break;
+    }
+    if (valid)
+        col->valid[row >> 3] |= (unsigned char)(1 << (row & 7));
+}
+
+/* Fills one column per field from an array of objects in a single pass over the records.
+ * Rows whose record is not an object, lacks the field or holds another type are not valid. */
+void cjson_extract_columns(cjson_columns* t, const cjson_value* records, const char* const* fields, const cjson_column_type* types, size_t count) {
+    cjson_field_cache* caches;
+    cjson_context* chars;
+    size_t rows;
+    assert(t != NULL && records != NULL && CJSON_IS_ARRAY(records) && (count == 0 || (fields != NULL && types != NULL)));
+    rows = cjson_get_array_size(records);
+    t->count = count;
+    t->rows = rows;
+    t->heap = NULL;
+    t->heap_size = 0;
+    t->columns = count > 0 ? (cjson_column*)cjson_heap_alloc(count * sizeof(cjson_column)) : NULL;
+    caches = (cjson_field_cache*)cjson_heap_alloc((count + 1) * sizeof(cjson_field_cache));
+    chars = (cjson_context*)cjson_heap_alloc((count + 1) * sizeof(cjson_context));
+    for (size_t j = 0; j < count; j++) {
+        cjson_column* col = &t->columns[j];
+        memset(col, 0, sizeof(*col));
+        col->type = types[j];
+        col->valid = (unsigned char*)cjson_heap_alloc((rows + 7) / 8 + 1);
+        memset(col->valid, 0, (rows + 7) / 8 + 1);
+        if (col->type == CJSON_COLUMN_NUMBER)
+            col->numbers = (double*)cjson_heap_alloc((rows + 1) * sizeof(double));
+        else if (col->type == CJSON_COLUMN_INT)
+            col->ints = (long long*)cjson_heap_alloc((rows + 1) * sizeof(long long));
+        else {
+            col->offsets = (size_t*)cjson_heap_alloc((rows + 1) * sizeof(size_t));
+            col->offsets[0] = 0;
+        }
+        cjson_field_cache_init(&caches[j], fields[j], strlen(fields[j]));
+        caches[j].index = j;    /* fields are often listed in record order */
+        cjson_context_init(&chars[j]);
+    }
+
+    for (size_t i = 0; i < rows; i++) {
+        const cjson_value* record = CJSON_FORM(records) == CJSON_ARRAY ? &records->data.arr.elem[i] : NULL;
+        for (size_t j = 0; j < count; j++) {
+            size_t index = CJSON_KEY_NOT_EXIST;
+            if (record != NULL && CJSON_IS_OBJECT(record))
+                index = cjson_find_object_index_cached(record, &caches[j]);
+            cjson_columns_put(&t->columns[j], &chars[j], i, index != CJSON_KEY_NOT_EXIST ? &record->data.obj.memb[index].v : NULL);
+        }
+    }
+
+    /* gather the strings of each column into the shared heap */
+    for (size_t j = 0; j < count; j++)
+        t->heap_size += chars[j].top;
+    if (t->heap_size > 0) {
+        size_t top = 0;
+        t->heap = (char*)cjson_heap_alloc(t->heap_size);
+        for (size_t j = 0; j < count; j++) {
+            if (chars[j].top > 0)
+                memcpy(t->heap + top, chars[j].buffer, chars[j].top);
+            if (t->columns[j].type == CJSON_COLUMN_STRING)
+                t->columns[j].chars = t->heap + top;
+            top += chars[j].top;
+        }
+    }
+    for (size_t j = 0; j < count; j++) {
+        cjson_context_free(&chars[j]);
+        cjson_field_cache_free(&caches[j]);
+    }
+    cjson_heap_free(chars, (count + 1) * sizeof(cjson_context));
+    cjson_heap_free(caches, (count + 1) * sizeof(cjson_field_cache));
+}
+
+void cjson_columns_free(cjson_columns* t) {
+    assert(t != NULL);
+    for (size_t j = 0; j < t->count; j++) {
+        cjson_column* col = &t->columns[j];
+        cjson_heap_free(col->valid, (t->rows + 7) / 8 + 1);
+        cjson_heap_free(col->numbers, (t->rows + 1) * sizeof(double));
+        cjson_heap_free(col->ints, (t->rows + 1) * sizeof(long long));
+        cjson_heap_free(col->offsets, (t->rows + 1) * sizeof(size_t));
+    }
+    cjson_heap_free(t->columns, t->count * sizeof(cjson_column));
+    cjson_heap_free(t->heap, t->heap_size);
+    t->columns = NULL;
+    t->heap = NULL;
+    t->count = t->rows = t->heap_size = 0;
+}
+
+// ===========================
+// ========== patch ==========
+// ===========================
+
+/* Decodes the reference token starting after the '/' at p into c->buffer (NUL-terminated,
+ * length c->top); returns the end of the token or NULL for an invalid '~' escape. */
+static const char* cjson_pointer_token(cjson_context* c, const char* p, const char* end) {
+    c->top = 0;
+    for (++p; p < end && *p != '/'; ++p) {
+        if (*p == '~') {
+            if (p + 1 == end || (p[1] != '0' && p[1] != '1'))
+                return NULL;
+            cjson_context_push_char(c, *++p == '0' ? '~' : '/');
+        }
+        else
+            cjson_context_push_char(c, *p);
+    }
+    cjson_context_push_char(c, '\0');
+    c->top--;
+    return p;
+}
+
+/* Array index of a token; "-" names the end of the array and is accepted only if append is set. */
+static int cjson_pointer_index(const cjson_context* c, const cjson_value* a, int append, size_t* index) {
+    const char* t = c->buffer;
+    if (append && c->top == 1 && t[0] == '-') {
+        *index = a->data.arr.size;
+        return 1;
+    }
+    if (c->top == 0 || (t[0] == '0' && c->top > 1))
+        return 0;
+    *index = 0;
+    for (size_t i = 0; i < c->top; ++i) {
+        if (t[i] < '0' || t[i] > '9' || *index > (CJSON_KEY_NOT_EXIST - 9) / 10)
+            return 0;
+        *index = *index * 10 + (t[i] - '0');
+    }
+    return *index < a->data.arr.size + (append ? 1 : 0);
+}
+
+/* Resolves all but the last token of a non-empty pointer, which is left in c. */
+static int cjson_pointer_parent(cjson_context* c, cjson_value* root, const char* path, size_t len, cjson_value** parent) {
+    const char* end = path + len;
+    cjson_value* v = root;
+    size_t index;
+    if (len == 0 || *path != '/')
+        return CJSON_PATCH_INVALID_POINTER;
+    for (;;) {
+        cjson_unpack(v);   /* the caller writes through what is resolved */
+        if ((path = cjson_pointer_token(c, path, end)) == NULL)
+            return CJSON_PATCH_INVALID_POINTER;
+        if (path == end) {
+            *parent = v;
+            return CJSON_PATCH_OK;
+        }
+        if (CJSON_IS_OBJECT(v) && (v = cjson_find_object_value(v, c->buffer, c->top)) != NULL)
+            continue;
+        if (v != NULL && v->type == CJSON_ARRAY && cjson_pointer_index(c, v, 0, &index)) {
+            v = cjson_get_array_element(v, index);
+            continue;
+        }
+        return CJSON_PATCH_PATH_NOT_FOUND;
+    }
+}
+
+static int cjson_pointer_get(cjson_context* c, cjson_value* root, const char* path, size_t len, cjson_value** target) {
+    cjson_value* parent;
+    size_t index;
+    int ret;
+    if (len == 0) {
+        *target = root;
+        return CJSON_PATCH_OK;
+    }
+    if ((ret = cjson_pointer_parent(c, root, path, len, &parent)) != CJSON_PATCH_OK)
+        return ret;
+    if (CJSON_IS_OBJECT(parent) && (*target = cjson_find_object_value(parent, c->buffer, c->top)) != NULL)
+        return CJSON_PATCH_OK;
+    if (parent->type == CJSON_ARRAY && cjson_pointer_index(c, parent, 0, &index)) {
+        *target = cjson_get_array_element(parent, index);
+        return CJSON_PATCH_OK;
+    }
+    return CJSON_PATCH_PATH_NOT_FOUND;
+}
+
+static int cjson_patch_add(cjson_context* c, cjson_value* doc, const char* path, size_t len, const cjson_value* value) {
+    cjson_value* parent;
+    size_t index;
+    int ret;
+    if (len == 0) {
+        cjson_copy_shared(doc, value);
+        return CJSON_PATCH_OK;
+    }
+    if ((ret = cjson_pointer_parent(c, doc, path, len, &parent)) != CJSON_PATCH_OK)
+        return ret;
+    if (CJSON_IS_OBJECT(parent)) {
+        if ((index = cjson_find_object_index(parent, c->buffer, c->top)) != CJSON_KEY_NOT_EXIST)
+            cjson_copy_shared(cjson_get_object_value(parent, index), value);
+        else
+            cjson_copy_shared(cjson_set_object_value(parent, c->buffer, c->top), value);
+        return CJSON_PATCH_OK;
+    }
+    if (parent->type == CJSON_ARRAY && cjson_pointer_index(c, parent, 1, &index)) {
+        cjson_copy_shared(cjson_insert_array_element(parent, index), value);
+        return CJSON_PATCH_OK;
+    }
+    return CJSON_PATCH_PATH_NOT_FOUND;
+}
+
+static int cjson_patch_remove(cjson_context* c, cjson_value* doc, const char* path, size_t len) {
+    cjson_value* parent;
+    size_t index;
+    int ret;
+    if (len == 0)
+        return CJSON_PATCH_INVALID_OPERATION;   /* the root cannot be removed */
+    if ((ret = cjson_pointer_parent(c, doc, path, len, &parent)) != CJSON_PATCH_OK)
+        return ret;
+    if (CJSON_IS_OBJECT(parent) && (index = cjson_find_object_index(parent, c->buffer, c->top)) != CJSON_KEY_NOT_EXIST) {
+        cjson_remove_object_value(parent, index);
+        return CJSON_PATCH_OK;
+    }
+    if (parent->type == CJSON_ARRAY && cjson_pointer_index(c, parent, 0, &index)) {
+        cjson_erase_array_element(parent, index, 1);
+        return CJSON_PATCH_OK;
+    }
+    return CJSON_PATCH_PATH_NOT_FOUND;
+}
+
+static const cjson_value* cjson_patch_member(const cjson_value* op, const char* key, cjson_type type) {
+    size_t index = cjson_find_object_index(op, key, strlen(key));
+    if (index == CJSON_KEY_NOT_EXIST || (type != CJSON_NULL && op->data.obj.memb[index].v.type != type))
+        return NULL;
+    return &op->data.obj.memb[index].v;
+}
+
+static int cjson_patch_is(const cjson_value* name, const char* op) {
+    return name->data.str.len == strlen(op) && memcmp(name->data.str.s, op, name->data.str.len) == 0;
+}
+
+static int cjson_patch_operation(cjson_context* c, cjson_value* doc, const cjson_value* op) {
+    const cjson_value *name, *path, *from = NULL, *value = NULL;
+    cjson_value* target, temp;
+    int ret;
+    if (!CJSON_IS_OBJECT(op)
+        || (name = cjson_patch_member(op, "op", CJSON_STRING)) == NULL
+        || (path = cjson_patch_member(op, "path", CJSON_STRING)) == NULL)
+        return CJSON_PATCH_INVALID_OPERATION;
+    if (cjson_patch_is(name, "add") || cjson_patch_is(name, "replace") || cjson_patch_is(name, "test")) {
+        if ((value = cjson_patch_member(op, "value", CJSON_NULL)) == NULL)
+            return CJSON_PATCH_INVALID_OPERATION;
+    }
+    else if (cjson_patch_is(name, "move") || cjson_patch_is(name, "copy")) {
+        if ((from = cjson_patch_member(op, "from", CJSON_STRING)) == NULL)
+            return CJSON_PATCH_INVALID_OPERATION;
+    }
+    else if (!cjson_patch_is(name, "remove"))
+        return CJSON_PATCH_INVALID_OPERATION;
+
+    if (cjson_patch_is(name, "add"))
+        return cjson_patch_add(c, doc, path->data.str.s, path->data.str.len, value);
+    if (cjson_patch_is(name, "remove"))
+        return cjson_patch_remove(c, doc, path->data.str.s, path->data.str.len);
+    if (cjson_patch_is(name, "replace")) {
+        if ((ret = cjson_pointer_get(c, doc, path->data.str.s, path->data.str.len, &target)) == CJSON_PATCH_OK)
+            cjson_copy_shared(target, value);
+        return ret;
+    }
+    if (cjson_patch_is(name, "test")) {
+        if ((ret = cjson_pointer_get(c, doc, path->data.str.s, path->data.str.len, &target)) != CJSON_PATCH_OK)
+            return ret;
+        return cjson_is_equal(target, value) ? CJSON_PATCH_OK : CJSON_PATCH_TEST_FAILED;
+    }
+    /* move or copy */
+    if (cjson_patch_is(name, "move")) {
+        if (from->data.str.len == path->data.str.len && memcmp(from->data.str.s, path->data.str.s, path->data.str.len) == 0)
+            return CJSON_PATCH_OK;
+        if (from->data.str.len < path->data.str.len && path->data.str.s[from->data.str.len] == '/'
+            && memcmp(from->data.str.s, path->data.str.s, from->data.str.len) == 0)
+            return CJSON_PATCH_INVALID_OPERATION;   /* a value cannot move into its own child */
+    }
+    if ((ret = cjson_pointer_get(c, doc, from->data.str.s, from->data.str.len, &target)) != CJSON_PATCH_OK)
+        return ret;
+    cjson_init(&temp);
+    cjson_copy_shared(&temp, target);
+    if (name->data.str.s[0] == 'm')
+        ret = cjson_patch_remove(c, doc, from->data.str.s, from->data.str.len);
+    if (ret == CJSON_PATCH_OK)
+        ret = cjson_patch_add(c, doc, path->data.str.s, path->data.str.len, &temp);
+    cjson_free(&temp);
+    return ret;
+}
+
+int cjson_patch_apply(cjson_value* v, const cjson_value* patch) {
+    cjson_context c;
+    cjson_value doc;
+    int ret = CJSON_PATCH_OK;
+    assert(v != NULL && patch != NULL);
+    if (CJSON_FORM(patch) != CJSON_ARRAY)
+        return CJSON_PATCH_INVALID_OPERATION;
+    /* Operations run on a shared copy, so a failing patch leaves v untouched. */
+    cjson_init(&doc);
+    cjson_copy_shared(&doc, v);
+    cjson_context_init(&c);
+    for (size_t i = 0; i < patch->data.arr.size && ret == CJSON_PATCH_OK; ++i)
+        ret = cjson_patch_operation(&c, &doc, &patch->data.arr.elem[i]);
+    cjson_context_free(&c);
+    if (ret == CJSON_PATCH_OK)
+        cjson_move(v, &doc);
+    else
+        cjson_free(&doc);
+    return ret;
+}
+
+void cjson_merge_patch_apply(cjson_value* v, const cjson_value* patch) {
+    assert(v != NULL && patch != NULL);
+    if (!CJSON_IS_OBJECT(patch)) {
+        cjson_copy_shared(v, patch);
+        return;
+    }
+    if (!CJSON_IS_OBJECT(v))
+        cjson_set_object(v, patch->data.obj.size);
+    for (size_t i = 0; i < patch->data.obj.size; ++i) {
+        const cjson_member* m = &patch->data.obj.memb[i];
+        size_t index = cjson_find_object_index(v, m->k, m->klen);
+        if (m->v.type == CJSON_NULL) {
+            if (index != CJSON_KEY_NOT_EXIST)
+                cjson_remove_object_value(v, index);
+        }
+        else if (index != CJSON_KEY_NOT_EXIST)
+            cjson_merge_patch_apply(cjson_get_object_value(v, index), &m->v);
+        else
+            cjson_merge_patch_apply(cjson_set_object_value(v, m->k, m->klen), &m->v);
+    }
+}
+
+static void cjson_diff_push_token(cjson_context* path, const char* s, size_t len) {
+    cjson_context_push_char(path, '/');
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] == '~')
+            cjson_context_push_str(path, "~0", 2);
+        else if (s[i] == '/')
+            cjson_context_push_str(path, "~1", 2);
+        else
+            cjson_context_push_char(path, s[i]);
+    }
+}
+
+static void cjson_diff_push_index(cjson_context* path, size_t index) {
+    char buffer[32];
+    cjson_context_push_str(path, buffer, sprintf(buffer, "/%lu", (unsigned long)index));
+}
+
+static void cjson_diff_operation(cjson_value* patch, const char* op, const cjson_context* path, const cjson_value* value) {
+    cjson_value* e = cjson_pushback_array_element(patch);
+    cjson_set_object(e, value ? 3 : 2);
+    cjson_set_string(cjson_set_object_value(e, "op", 2), op, strlen(op));
+    cjson_set_string(cjson_set_object_value(e, "path", 4), path->top ? path->buffer : "", path->top);
+    if (value)
+        cjson_copy_shared(cjson_set_object_value(e, "value", 5), value);
+}
+
+static void cjson_diff_value(cjson_value* patch, cjson_context* path, const cjson_value* a, const cjson_value* b) {
+    size_t top = path->top;
+    /* cached subtree hashes make the common unchanged case cheap */
+    if (cjson_hash(a) == cjson_hash(b) && cjson_is_equal(a, b))
+        return;
+    if (!(CJSON_IS_OBJECT(a) && CJSON_IS_OBJECT(b)) && (CJSON_FORM(a) != CJSON_ARRAY || CJSON_FORM(b) != CJSON_ARRAY)) {
+        cjson_diff_operation(patch, "replace", path, b);
+        return;
+    }
+    if (CJSON_IS_OBJECT(a)) {
+        cjson_key_index xa, xb;
+        int indexed = a->data.obj.size >= CJSON_EQUAL_INDEX_THRESHOLD || b->data.obj.size >= CJSON_EQUAL_INDEX_THRESHOLD;
+        if (indexed) {
+            cjson_key_index_init(&xa, a);
+            cjson_key_index_init(&xb, b);
+        }
+        for (size_t i = 0; i < a->data.obj.size; ++i) {
+            const cjson_member* m = &a->data.obj.memb[i];
+            size_t index = indexed ? cjson_key_index_find(&xb, m->k, m->klen, cjson_hash_string(m->k, m->klen))
+                : cjson_find_object_index(b, m->k, m->klen);
+            cjson_diff_push_token(path, m->k, m->klen);
+            if (index == CJSON_KEY_NOT_EXIST)
+                cjson_diff_operation(patch, "remove", path, NULL);
+            else
+                cjson_diff_value(patch, path, &m->v, &b->data.obj.memb[index].v);
+            path->top = top;
+        }
+        for (size_t i = 0; i < b->data.obj.size; ++i) {
+            const cjson_member* m = &b->data.obj.memb[i];
+            size_t index = indexed ? cjson_key_index_find(&xa, m->k, m->klen, cjson_hash_string(m->k, m->klen))
+                : cjson_find_object_index(a, m->k, m->klen);
+            if (index != CJSON_KEY_NOT_EXIST)
+                continue;
+            cjson_diff_push_token(path, m->k, m->klen);
+            cjson_diff_operation(patch, "add", path, &m->v);
+            path->top = top;
+        }
+        if (indexed) {
+            cjson_key_index_free(&xa);
+            cjson_key_index_free(&xb);
+        }
+    }
+    else {
+        /* Skip the common prefix and suffix, diff the overlap of the middle in place,
+         * then remove or add the rest; enough for the usual insert/append/delete edits. */
+        const cjson_value *ea = a->data.arr.elem, *eb = b->data.arr.elem;
+        size_t na = a->data.arr.size, nb = b->data.arr.size, prefix = 0, suffix = 0, ma, mb;
+        while (prefix < na && prefix < nb && cjson_hash(&ea[prefix]) == cjson_hash(&eb[prefix]) && cjson_is_equal(&ea[prefix], &eb[prefix]))
+            prefix++;
+        while (suffix < na - prefix && suffix < nb - prefix
+            && cjson_hash(&ea[na - 1 - suffix]) == cjson_hash(&eb[nb - 1 - suffix]) && cjson_is_equal(&ea[na - 1 - suffix], &eb[nb - 1 - suffix]))
+            suffix++;
+        ma = na - prefix - suffix;
+        mb = nb - prefix - suffix;
+        for (size_t i = 0; i < ma && i < mb; ++i) {
+            cjson_diff_push_index(path, prefix + i);
+            cjson_diff_value(patch, path, &ea[prefix + i], &eb[prefix + i]);
+            path->top = top;
+        }
+        for (size_t i = mb; i < ma; ++i) {
+            cjson_diff_push_index(path, prefix + mb);
+            cjson_diff_operation(patch, "remove", path, NULL);
+            path->top = top;
+        }
+        for (size_t i = ma; i < mb; ++i) {
+            cjson_diff_push_index(path, prefix + i);
+            cjson_diff_operation(patch, "add", path, &eb[prefix + i]);
+            path->top = top;
+        }
+    }
+}
+
+void cjson_diff(cjson_value* patch, const cjson_value* a, const cjson_value* b) {
+    cjson_context path;
+    assert(patch != NULL && a != NULL && b != NULL && patch != a && patch != b);
+    cjson_set_array(patch, 0);
+    cjson_context_init(&path);
+    cjson_diff_value(patch, &path, a, b);
+    cjson_context_free(&path);
+}
+
+// ============================
+// ========== binary ==========
+// ============================
+
+#define CJSON_BINARY_INDEFINITE (~0ULL)    /* CBOR container terminated by a break byte */
+#define CJSON_BINARY_MAX_DEPTH  1000        /* nested containers and tags; the readers recurse */
+
+typedef struct cjson_reader cjson_reader;
+typedef int (*cjson_read_value)(cjson_reader* r, cjson_value* v);
+typedef int (*cjson_read_key)(cjson_reader* r, const char** key, size_t* klen);
+
+struct cjson_reader {
+    const unsigned char* p, *end;   /* input cursor, end of input */
+    cjson_context c;                /* joins the chunks of indefinite-length strings */
+    size_t depth;                   /* containers and tags open */
+};
+
+/* Pushes a type byte followed by the low size bytes of n in network order. */
+static void cjson_binary_put(cjson_context* c, unsigned char byte, unsigned long long n, size_t size) {
+    unsigned char* p = (unsigned char*)cjson_context_push(c, size + 1);
+    *p++ = byte;
+    while (size-- > 0) {
+        p[size] = (unsigned char)n;
+        n >>= 8;
+    }
+}
+
+static int cjson_binary_get(cjson_reader* r, size_t size, unsigned long long* n) {
+    if ((size_t)(r->end - r->p) < size)
+        return CJSON_BINARY_TRUNCATED;
+    *n = 0;
+    while (size-- > 0)
+        *n = *n << 8 | *r->p++;
+    return CJSON_BINARY_OK;
+}
+
+static int cjson_binary_get_bytes(cjson_reader* r, unsigned long long len, const char** s) {
+    if ((unsigned long long)(r->end - r->p) < len)
+        return CJSON_BINARY_TRUNCATED;
+    *s = (const char*)r->p;
+    r->p += len;
+    return CJSON_BINARY_OK;
+}
+
+static unsigned long long cjson_binary_bits(double n) {
+    unsigned long long bits;
+    memcpy(&bits, &n, sizeof(bits));
+    return bits;
+}
+
+static double cjson_binary_double(unsigned long long bits) {
+    double n;
+    memcpy(&n, &bits, sizeof(n));
+    return n;
+}
+
+static double cjson_binary_float(unsigned long long bits) {
+    unsigned int u = (unsigned int)bits;
+    float n;
+    memcpy(&n, &u, sizeof(n));
+    return n;
+}
+
+/* Returns 1 if n is a non-negative integer, stored exactly in *u, -1 if it is a negative
+ * integer with *u = -1 - n, and 0 if it has to go out as a double (fractions, -0, huge values). */
+static int cjson_binary_integer(double n, unsigned long long* u) {
+    if (n >= 0 && n < 18446744073709551616.0) {
+        *u = (unsigned long long)n;
+        return (double)*u == n && !(cjson_binary_bits(n) >> 63);
+    }
+    if (n < 0 && n > -18446744073709551616.0) {
+        unsigned long long m = (unsigned long long)-n;
+        *u = m - 1;
+        return (double)m == -n ? -1 : 0;
+    }
+    return 0;
+}
+
+static int cjson_binary_number(cjson_value* v, double n) {
+    if (n - n != 0)     /* JSON has no NaN or infinity */
+        return CJSON_BINARY_INVALID_NUMBER;
+    cjson_set_number(v, n);
+    return CJSON_BINARY_OK;
+}
+
+/* Element counts are checked against the remaining input before reserving,
+ * since every item takes at least one byte; a bogus count cannot force a huge allocation. */
+static int cjson_binary_read_array(cjson_reader* r, cjson_value* v, unsigned long long n, cjson_read_value read) {
+    int ret;
+    if (n != CJSON_BINARY_INDEFINITE && n > (unsigned long long)(r->end - r->p))
+        return CJSON_BINARY_TRUNCATED;
+    if (++r->depth > CJSON_BINARY_MAX_DEPTH)
+        return CJSON_BINARY_TOO_DEEP;
+    cjson_set_array(v, n != CJSON_BINARY_INDEFINITE ? (size_t)n : 0);
+    for (unsigned long long i = 0; i != n; ++i) {
+        if (n == CJSON_BINARY_INDEFINITE) {
+            if (r->p == r->end) {
+                cjson_free(v);
+                return CJSON_BINARY_TRUNCATED;
+            }
+            if (*r->p == 0xFF) {
+                r->p++;
+                break;
+            }
+        }
+        if ((ret = read(r, cjson_pushback_array_element(v))) != CJSON_BINARY_OK) {
+            cjson_free(v);
+            return ret;
+        }
+    }
+    r->depth--;
+    return CJSON_BINARY_OK;
+}
+
+static int cjson_binary_read_object(cjson_reader* r, cjson_value* v, unsigned long long n, cjson_read_key key, cjson_read_value read) {
+    const char* k;
+    size_t klen;
+    int ret;
+    if (n != CJSON_BINARY_INDEFINITE && n > (unsigned long long)(r->end - r->p) / 2)
+        return CJSON_BINARY_TRUNCATED;
+    if (++r->depth > CJSON_BINARY_MAX_DEPTH)
+        return CJSON_BINARY_TOO_DEEP;
+    cjson_set_object(v, n != CJSON_BINARY_INDEFINITE ? (size_t)n : 0);
+    for (unsigned long long i = 0; i != n; ++i) {
+        if (n == CJSON_BINARY_INDEFINITE) {
+            if (r->p == r->end) {
+                cjson_free(v);
+                return CJSON_BINARY_TRUNCATED;
+            }
+            if (*r->p == 0xFF) {
+                r->p++;
+                break;
+            }
+        }
+        if ((ret = key(r, &k, &klen)) != CJSON_BINARY_OK
+            || (ret = read(r, cjson_set_object_value(v, k, klen))) != CJSON_BINARY_OK) {
+            cjson_free(v);
+            return ret;
+        }
+    }
+    r->depth--;
+    return CJSON_BINARY_OK;
+}
+
+static int cjson_binary_decode(cjson_value* v, const char* data, size_t length, cjson_read_value read) {
+    cjson_reader r;
+    int ret;
+    assert(v != NULL && (data != NULL || length == 0));
+    cjson_init(v);
+    if (length == 0)
+        return CJSON_BINARY_TRUNCATED;
+    r.p = (const unsigned char*)data;
+    r.end = r.p + length;
+    r.depth = 0;
+    cjson_context_init(&r.c);
+    if ((ret = read(&r, v)) == CJSON_BINARY_OK && r.p != r.end) {
+        cjson_free(v);
+        ret = CJSON_BINARY_ROOT_NOT_SINGULAR;
+    }
+    cjson_context_free(&r.c);
+    return ret;
+}
+
+/* CBOR (RFC 8949): integral numbers go out as the shortest integer, the rest as float64. */
+
+static void cjson_cbor_write_head(cjson_context* c, unsigned major, unsigned long long n) {
+    unsigned char byte = (unsigned char)(major << 5);
+    if (n < 24)
+        cjson_binary_put(c, byte | (unsigned char)n, 0, 0);
+    else if (n <= 0xFF)
+        cjson_binary_put(c, byte | 24, n, 1);
+    else if (n <= 0xFFFF)
+        cjson_binary_put(c, byte | 25, n, 2);
+    else if (n <= 0xFFFFFFFF)
+        cjson_binary_put(c, byte | 26, n, 4);
+    else
+        cjson_binary_put(c, byte | 27, n, 8);
+}
+
+static void cjson_cbor_write_string(cjson_context* c, const char* s, size_t len) {
+    cjson_cbor_write_head(c, 3, len);
+    if (len)
+        PUTS(c, s, len);
+}
+
+static void cjson_cbor_write_number(cjson_context* c, double n) {
+    unsigned long long u;
+    int sign;
+    if ((sign = cjson_binary_integer(n, &u)) != 0)
+        cjson_cbor_write_head(c, sign > 0 ? 0 : 1, u);
+    else
+        cjson_binary_put(c, 0xFB, cjson_binary_bits(n), 8);
+}
+
+static void cjson_cbor_write_value(cjson_context* c, const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_NULL:  cjson_binary_put(c, 0xF6, 0, 0); break;
+        case CJSON_FALSE: cjson_binary_put(c, 0xF4, 0, 0); break;
+        case CJSON_TRUE:  cjson_binary_put(c, 0xF5, 0, 0); break;
+        case CJSON_NUMBER:
+        case CJSON_RAW_NUMBER: cjson_cbor_write_number(c, cjson_get_number(v)); break;
+        case CJSON_STRING: cjson_cbor_write_string(c, v->data.str.s, v->data.str.len); break;
+        case CJSON_ARRAY:
+            cjson_cbor_write_head(c, 4, v->data.arr.size);
+            for (size_t i = 0; i < v->data.arr.size; i++)
+                cjson_cbor_write_value(c, &v->data.arr.elem[i]);
+            break;
+        case CJSON_NUMBER_ARRAY:
+            cjson_cbor_write_head(c, 4, v->data.nums.size);
+            for (size_t i = 0; i < v->data.nums.size; i++)
+                cjson_cbor_write_number(c, v->data.nums.elem[i]);
+            break;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            cjson_cbor_write_head(c, 5, v->data.obj.size);
+            for (size_t i = 0; i < v->data.obj.size; i++) {
+                cjson_cbor_write_string(c, v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
+                cjson_cbor_write_value(c, &v->data.obj.memb[i].v);
+            }
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+char* cjson_to_cbor(const cjson_value* v, size_t* length) {
+    cjson_context c;
+    assert(v != NULL);
+    c.buffer = (char*)cjson_heap_alloc(c.size = CJSON_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    cjson_cbor_write_value(&c, v);
+    if (length) *length = c.top;
+    return cjson_context_detach(&c);
+}
+
+/* Splits an initial byte into major type and additional info, reading the argument that follows. */
+static int cjson_cbor_read_head(cjson_reader* r, unsigned* major, unsigned* info, unsigned long long* n) {
+    if (r->p == r->end)
+        return CJSON_BINARY_TRUNCATED;
+    *major = *r->p >> 5;
+    *info = *r->p++ & 0x1F;
+    *n = *info;
+    if (*info >= 24 && *info <= 27)
+        return cjson_binary_get(r, (size_t)1 << (*info - 24), n);
+    if (*info == 31) {
+        *n = CJSON_BINARY_INDEFINITE;
+        return *major >= 2 && *major != 6 ? CJSON_BINARY_OK : CJSON_BINARY_INVALID_VALUE;
+    }
+    return *info < 24 ? CJSON_BINARY_OK : CJSON_BINARY_INVALID_VALUE;
+}
+
+static int cjson_cbor_read_string(cjson_reader* r, unsigned long long n, const char** s, size_t* len) {
+    size_t head = r->c.top;
+    unsigned major, info;
+    const char* chunk;
+    int ret;
+    if (n != CJSON_BINARY_INDEFINITE) {
+        *len = (size_t)n;
+        return cjson_binary_get_bytes(r, n, s);
+    }
+    for (;;) {
+        if (r->p < r->end && *r->p == 0xFF) {
+            r->p++;
             break;
+        }
+        if ((ret = cjson_cbor_read_head(r, &major, &info, &n)) != CJSON_BINARY_OK
+            || (ret = (major == 3 && n != CJSON_BINARY_INDEFINITE) ? cjson_binary_get_bytes(r, n, &chunk) : CJSON_BINARY_INVALID_VALUE) != CJSON_BINARY_OK) {
+            r->c.top = head;
+            return ret;
+        }
+        if (n)
+            PUTS(&r->c, chunk, (size_t)n);
+    }
+    /* The joined string stays in the scratch buffer until the next push, long enough to be copied. */
+    *len = r->c.top - head;
+    *s = *len ? (const char*)cjson_context_pop(&r->c, *len) : "";
+    return CJSON_BINARY_OK;
+}
+
+static int cjson_cbor_read_key(cjson_reader* r, const char** key, size_t* klen) {
+    unsigned major, info;
+    unsigned long long n;
+    int ret;
+    if ((ret = cjson_cbor_read_head(r, &major, &info, &n)) != CJSON_BINARY_OK)
+        return ret;
+    if (major != 3)
+        return CJSON_BINARY_INVALID_KEY;
+    return cjson_cbor_read_string(r, n, key, klen);
+}
+
+static double cjson_cbor_half(unsigned long long bits) {
+    unsigned exponent = (bits >> 10) & 0x1F, mantissa = bits & 0x3FF;
+    double n;
+    if (exponent == 0)
+        n = mantissa / 16777216.0;  /* subnormal: mantissa * 2^-24 */
+    else    /* rebias into a float32, which represents every half exactly */
+        n = cjson_binary_float((exponent == 31 ? 0xFFULL : exponent + 112ULL) << 23 | (unsigned long long)mantissa << 13);
+    return bits & 0x8000 ? -n : n;
+}
+
+static int cjson_cbor_read_value(cjson_reader* r, cjson_value* v) {
+    unsigned major, info;
+    unsigned long long n;
+    const char* s;
+    size_t len;
+    int ret;
+    if ((ret = cjson_cbor_read_head(r, &major, &info, &n)) != CJSON_BINARY_OK)
+        return ret;
+    switch (major) {
+        case 0: return cjson_binary_number(v, (double)n);
+        case 1: return cjson_binary_number(v, -1.0 - (double)n);
+        case 2: return CJSON_BINARY_UNSUPPORTED_TYPE;  /* byte string */
+        case 3:
+            if ((ret = cjson_cbor_read_string(r, n, &s, &len)) == CJSON_BINARY_OK)
+                cjson_set_string(v, s, len);
+            return ret;
+        case 4: return cjson_binary_read_array(r, v, n, cjson_cbor_read_value);
+        case 5: return cjson_binary_read_object(r, v, n, cjson_cbor_read_key, cjson_cbor_read_value);
+        case 6:     /* JSON has no tags, keep the tagged item */
+            if (++r->depth > CJSON_BINARY_MAX_DEPTH)
+                return CJSON_BINARY_TOO_DEEP;
+            if ((ret = cjson_cbor_read_value(r, v)) == CJSON_BINARY_OK)
+                r->depth--;
+            return ret;
+        default:
+            switch (info) {
+                case 20: cjson_set_boolean(v, 0); return CJSON_BINARY_OK;
+                case 21: cjson_set_boolean(v, 1); return CJSON_BINARY_OK;
+                case 22:
+                case 23: cjson_set_null(v); return CJSON_BINARY_OK;    /* null, undefined */
+                case 25: return cjson_binary_number(v, cjson_cbor_half(n));
+                case 26: return cjson_binary_number(v, cjson_binary_float(n));
+                case 27: return cjson_binary_number(v, cjson_binary_double(n));
+                case 31: return CJSON_BINARY_INVALID_VALUE;    /* break outside a container */
+                default: return CJSON_BINARY_UNSUPPORTED_TYPE; /* other simple values */
+            }
+    }
+}
+
+int cjson_from_cbor(cjson_value* v, const char* data, size_t length) {
+    return cjson_binary_decode(v, data, length, cjson_cbor_read_value);
+}
+
+/* MessagePack: same number policy as CBOR, integers limited to the int64/uint64 families. */
+
+/* Writes a fix-form byte when n fits, else the 8-bit (strings only), 16-bit or 32-bit form. */
+static void cjson_msgpack_write_size(cjson_context* c, unsigned char fix, size_t fix_max, unsigned char b8, unsigned char b16, unsigned char b32, size_t n) {
+    if (n <= fix_max)
+        cjson_binary_put(c, fix | (unsigned char)n, 0, 0);
+    else if (b8 && n <= 0xFF)
+        cjson_binary_put(c, b8, n, 1);
+    else if (n <= 0xFFFF)
+        cjson_binary_put(c, b16, n, 2);
+    else {
+        assert(n <= 0xFFFFFFFF && "too large for MessagePack");
+        cjson_binary_put(c, b32, n, 4);
+    }
+}
+
+static void cjson_msgpack_write_string(cjson_context* c, const char* s, size_t len) {
+    cjson_msgpack_write_size(c, 0xA0, 31, 0xD9, 0xDA, 0xDB, len);
+    if (len)
+        PUTS(c, s, len);
+}
+
+static void cjson_msgpack_write_number(cjson_context* c, double n) {
+    unsigned long long u;
+    long long i;
+    int sign = cjson_binary_integer(n, &u);
+    if (sign > 0) {
+        if (u <= 0x7F)             cjson_binary_put(c, (unsigned char)u, 0, 0);
+        else if (u <= 0xFF)        cjson_binary_put(c, 0xCC, u, 1);
+        else if (u <= 0xFFFF)      cjson_binary_put(c, 0xCD, u, 2);
+        else if (u <= 0xFFFFFFFF)  cjson_binary_put(c, 0xCE, u, 4);
+        else                       cjson_binary_put(c, 0xCF, u, 8);
+    }
+    else if (sign < 0 && u <= 0x7FFFFFFFFFFFFFFFULL) {
+        i = -1 - (long long)u;
+        if (i >= -32)                   cjson_binary_put(c, (unsigned char)i, 0, 0);
+        else if (i >= -128)             cjson_binary_put(c, 0xD0, (unsigned long long)i, 1);
+        else if (i >= -32768)           cjson_binary_put(c, 0xD1, (unsigned long long)i, 2);
+        else if (i >= -2147483647 - 1)  cjson_binary_put(c, 0xD2, (unsigned long long)i, 4);
+        else                            cjson_binary_put(c, 0xD3, (unsigned long long)i, 8);
+    }
+    else
+        cjson_binary_put(c, 0xCB, cjson_binary_bits(n), 8);
+}
+
+static void cjson_msgpack_write_value(cjson_context* c, const cjson_value* v) {
+    switch (CJSON_FORM(v)) {
+        case CJSON_NULL:   cjson_binary_put(c, 0xC0, 0, 0); break;
+        case CJSON_FALSE:  cjson_binary_put(c, 0xC2, 0, 0); break;
+        case CJSON_TRUE:   cjson_binary_put(c, 0xC3, 0, 0); break;
+        case CJSON_NUMBER: cjson_msgpack_write_number(c, v->data.num); break;
+        case CJSON_RAW_NUMBER: cjson_msgpack_write_number(c, cjson_get_number(v)); break;
+        case CJSON_STRING: cjson_msgpack_write_string(c, v->data.str.s, v->data.str.len); break;
         case CJSON_ARRAY:
-            cjson_set_array(dst, src->data.arr.size);
-            for(size_t i = 0; i < src->data.arr.size; ++i) {
-                cjson_init(dst->data.arr.elem + i);
-                cjson_copy(dst->data.arr.elem + i, src->data.arr.elem + i);
+            cjson_msgpack_write_size(c, 0x90, 15, 0, 0xDC, 0xDD, v->data.arr.size);
+            for (size_t i = 0; i < v->data.arr.size; i++)
+                cjson_msgpack_write_value(c, &v->data.arr.elem[i]);
+            break;
+        case CJSON_NUMBER_ARRAY:
+            cjson_msgpack_write_size(c, 0x90, 15, 0, 0xDC, 0xDD, v->data.nums.size);
+            for (size_t i = 0; i < v->data.nums.size; i++)
+                cjson_msgpack_write_number(c, v->data.nums.elem[i]);
+            break;
+        case CJSON_OBJECT:
+        case CJSON_FROZEN_OBJECT:
+            cjson_msgpack_write_size(c, 0x80, 15, 0, 0xDE, 0xDF, v->data.obj.size);
+            for (size_t i = 0; i < v->data.obj.size; i++) {
+                cjson_msgpack_write_string(c, v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
+                cjson_msgpack_write_value(c, &v->data.obj.memb[i].v);
+            }
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+char* cjson_to_msgpack(const cjson_value* v, size_t* length) {
+    cjson_context c;
+    assert(v != NULL);
+    c.buffer = (char*)cjson_heap_alloc(c.size = CJSON_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    cjson_msgpack_write_value(&c, v);
+    if (length) *length = c.top;
+    return cjson_context_detach(&c);
+}
+
+/* Reads a fixstr or str8/16/32 whose type byte has already been consumed. */
+static int cjson_msgpack_read_string(cjson_reader* r, unsigned char byte, const char** s, size_t* len) {
+    unsigned long long n;
+    int ret;
+    if (byte >= 0xA0 && byte <= 0xBF)
+        n = byte & 0x1F;
+    else if (byte >= 0xD9 && byte <= 0xDB) {
+        if ((ret = cjson_binary_get(r, (size_t)1 << (byte - 0xD9), &n)) != CJSON_BINARY_OK)
+            return ret;
+    }
+    else
+        return CJSON_BINARY_INVALID_KEY;
+    *len = (size_t)n;
+    return cjson_binary_get_bytes(r, n, s);
+}
+
+static int cjson_msgpack_read_key(cjson_reader* r, const char** key, size_t* klen) {
+    if (r->p == r->end)
+        return CJSON_BINARY_TRUNCATED;
+    return cjson_msgpack_read_string(r, *r->p++, key, klen);
+}
+
+static int cjson_msgpack_read_value(cjson_reader* r, cjson_value* v) {
+    unsigned char byte;
+    unsigned long long n;
+    const char* s;
+    size_t len;
+    int ret;
+    if (r->p == r->end)
+        return CJSON_BINARY_TRUNCATED;
+    byte = *r->p++;
+    if (byte <= 0x7F || byte >= 0xE0)  /* positive and negative fixint */
+        return cjson_binary_number(v, (signed char)byte);
+    if (byte <= 0x8F)
+        return cjson_binary_read_object(r, v, byte & 0x0F, cjson_msgpack_read_key, cjson_msgpack_read_value);
+    if (byte <= 0x9F)
+        return cjson_binary_read_array(r, v, byte & 0x0F, cjson_msgpack_read_value);
+    if (byte <= 0xBF || (byte >= 0xD9 && byte <= 0xDB)) {
+        if ((ret = cjson_msgpack_read_string(r, byte, &s, &len)) == CJSON_BINARY_OK)
+            cjson_set_string(v, s, len);
+        return ret;
+    }
+    switch (byte) {
+        case 0xC0: cjson_set_null(v); return CJSON_BINARY_OK;
+        case 0xC2: cjson_set_boolean(v, 0); return CJSON_BINARY_OK;
+        case 0xC3: cjson_set_boolean(v, 1); return CJSON_BINARY_OK;
+        case 0xCA:
+            if ((ret = cjson_binary_get(r, 4, &n)) != CJSON_BINARY_OK)
+                return ret;
+            return cjson_binary_number(v, cjson_binary_float(n));
+        case 0xCB:
+            if ((ret = cjson_binary_get(r, 8, &n)) != CJSON_BINARY_OK)
+                return ret;
+            return cjson_binary_number(v, cjson_binary_double(n));
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            if ((ret = cjson_binary_get(r, (size_t)1 << (byte - 0xCC), &n)) != CJSON_BINARY_OK)
+                return ret;
+            return cjson_binary_number(v, (double)n);
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+            len = (size_t)1 << (byte - 0xD0);
+            if ((ret = cjson_binary_get(r, len, &n)) != CJSON_BINARY_OK)
+                return ret;
+            if (len < 8 && n >> (len * 8 - 1))
+                n |= ~0ULL << (len * 8);    /* sign-extend */
+            return cjson_binary_number(v, (double)(long long)n);
+        case 0xDC: case 0xDD:
+            if ((ret = cjson_binary_get(r, byte == 0xDC ? 2 : 4, &n)) != CJSON_BINARY_OK)
+                return ret;
+            return cjson_binary_read_array(r, v, n, cjson_msgpack_read_value);
+        case 0xDE: case 0xDF:
+            if ((ret = cjson_binary_get(r, byte == 0xDE ? 2 : 4, &n)) != CJSON_BINARY_OK)
+                return ret;
+            return cjson_binary_read_object(r, v, n, cjson_msgpack_read_key, cjson_msgpack_read_value);
+        case 0xC1: return CJSON_BINARY_INVALID_VALUE;   /* never used */
+        default:   return CJSON_BINARY_UNSUPPORTED_TYPE; /* bin, ext and fixext */
+    }
+}
+
+int cjson_from_msgpack(cjson_value* v, const char* data, size_t length) {
+    return cjson_binary_decode(v, data, length, cjson_msgpack_read_value);
+}
+
+// ==============================
+// ========== snapshot ==========
+// ==============================
+
+/* A snapshot is a 16-byte header, the bodies of strings and containers in post-order,
+ * the root slot, and the magic again so that a truncated image is rejected.
+ * Every value is a 16-byte slot (a cjson_view): scalars are held in the slot, anything
+ * else points back to its body by a distance relative to the slot itself, so the image
+ * can be mapped at any address and read in place.
+ *
+ *   string body: uint64 length, bytes, '\0', padding to 8
+ *   array body:  uint64 count, count value slots
+ *   object body: uint64 count, count (key slot, value slot) pairs,
+ *                count uint32 member indices sorted by key, padding to 8 */
+struct cjson_view {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t payload;   /* number bits, or distance back to the body */
+};
+
+static const char CJSON_SNAPSHOT_MAGIC[8] = {'C', 'J', 'S', 'N', 'A', 'P', '0', '1'};
+#define CJSON_SNAPSHOT_BYTE_ORDER 0x01020304u  /* a foreign-endian image reads differently */
+#define CJSON_SNAPSHOT_FLUSH_SIZE 65536
+
+typedef struct {
+    int fd;
+    int error;
+    uint64_t pos;           /* bytes flushed so far */
+    cjson_context out;      /* pending output */
+    cjson_context stack;    /* child slots waiting for their parent's body */
+} cjson_snapshot_writer;
+
+typedef struct {
+    const char* k;
+    size_t klen;
+    uint32_t index;
+} cjson_snapshot_key;
+
+static int cjson_write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        long ret = (long)write(fd, p, n);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        p += ret;
+        n -= (size_t)ret;
+    }
+    return 1;
+}
+
+static void cjson_snapshot_flush(cjson_snapshot_writer* w) {
+    if (!w->error && !cjson_write_all(w->fd, w->out.buffer, w->out.top))
+        w->error = 1;
+    w->pos += w->out.top;
+    w->out.top = 0;
+}
+
+static void cjson_snapshot_put(cjson_snapshot_writer* w, const void* p, size_t size) {
+    memcpy(cjson_context_push(&w->out, size), p, size);
+    if (w->out.top >= CJSON_SNAPSHOT_FLUSH_SIZE)
+        cjson_snapshot_flush(w);
+}
+
+static void cjson_snapshot_put_u64(cjson_snapshot_writer* w, uint64_t n) {
+    cjson_snapshot_put(w, &n, sizeof(n));
+}
+
+static void cjson_snapshot_pad(cjson_snapshot_writer* w) {
+    static const char zeros[8] = {0};
+    size_t rem = (size_t)((w->pos + w->out.top) & 7);
+    if (rem)
+        cjson_snapshot_put(w, zeros, 8 - rem);
+}
+
+static uint64_t cjson_snapshot_tell(const cjson_snapshot_writer* w) {
+    return w->pos + w->out.top;
+}
+
+/* Writes the body of a string and returns the slot for it, addressed absolutely for now. */
+static cjson_view cjson_snapshot_write_string(cjson_snapshot_writer* w, const char* s, size_t len) {
+    cjson_view slot;
+    slot.type = CJSON_STRING;
+    slot.reserved = 0;
+    slot.payload = cjson_snapshot_tell(w);
+    cjson_snapshot_put_u64(w, len);
+    if (len)
+        cjson_snapshot_put(w, s, len);
+    cjson_snapshot_put(w, "", 1);
+    cjson_snapshot_pad(w);
+    return slot;
+}
+
+/* Rewrites the absolute body position of a child slot as a distance back from where the slot lands. */
+static void cjson_snapshot_put_slot(cjson_snapshot_writer* w, cjson_view slot) {
+    if (slot.type == CJSON_STRING || slot.type == CJSON_ARRAY || slot.type == CJSON_OBJECT)
+        slot.payload = cjson_snapshot_tell(w) - slot.payload;
+    cjson_snapshot_put(w, &slot, sizeof(slot));
+}
+
+static int cjson_snapshot_key_compare(const void* lhs, const void* rhs) {
+    const cjson_snapshot_key* a = (const cjson_snapshot_key*)lhs;
+    const cjson_snapshot_key* b = (const cjson_snapshot_key*)rhs;
+    int ret = memcmp(a->k, b->k, a->klen < b->klen ? a->klen : b->klen);
+    if (ret == 0 && a->klen != b->klen)
+        ret = a->klen < b->klen ? -1 : 1;
+    return ret != 0 ? ret : (a->index < b->index ? -1 : a->index > b->index);
+}
+
+static cjson_view cjson_snapshot_write_value(cjson_snapshot_writer* w, const cjson_value* v) {
+    cjson_view slot, *slots;
+    size_t n, top = w->stack.top;
+    double num;
+    slot.type = cjson_get_type(v);
+    slot.reserved = 0;
+    slot.payload = 0;
+    switch (CJSON_FORM(v)) {
+        case CJSON_NUMBER:
+        case CJSON_RAW_NUMBER:
+            num = cjson_get_number(v);
+            memcpy(&slot.payload, &num, sizeof(slot.payload));
+            break;
+        case CJSON_STRING:
+            return cjson_snapshot_write_string(w, v->data.str.s, v->data.str.len);
+        case CJSON_ARRAY:
+            n = v->data.arr.size;
+            for (size_t i = 0; i < n; i++) {
+                cjson_view e = cjson_snapshot_write_value(w, &v->data.arr.elem[i]);
+                memcpy(cjson_context_push(&w->stack, sizeof(e)), &e, sizeof(e));
+            }
+            slot.payload = cjson_snapshot_tell(w);
+            cjson_snapshot_put_u64(w, n);
+            slots = (cjson_view*)(w->stack.buffer + top);
+            for (size_t i = 0; i < n; i++)
+                cjson_snapshot_put_slot(w, slots[i]);
+            w->stack.top = top;
+            break;
+        case CJSON_NUMBER_ARRAY:   /* number slots carry no body, so they go out directly */
+            n = v->data.nums.size;
+            slot.payload = cjson_snapshot_tell(w);
+            cjson_snapshot_put_u64(w, n);
+            for (size_t i = 0; i < n; i++) {
+                cjson_view e;
+                e.type = CJSON_NUMBER;
+                e.reserved = 0;
+                memcpy(&e.payload, &v->data.nums.elem[i], sizeof(e.payload));
+                cjson_snapshot_put_slot(w, e);
             }
-            dst->data.arr.size = src->data.arr.size;
             break;
         case CJSON_OBJECT:
-            cjson_set_object(dst, src->data.obj.size);
-            for(size_t i = 0; i < src->data.obj.size; ++i) {
-                dst->data.obj.memb[i].klen = src->data.obj.memb[i].klen;
-                dst->data.obj.memb[i].k = (char*)malloc(dst->data.obj.memb[i].klen + 1);
-                memcpy(dst->data.obj.memb[i].k, src->data.obj.memb[i].k, dst->data.obj.memb[i].klen);
-                dst->data.obj.memb[i].k[dst->data.obj.memb[i].klen] = '\0';
-                cjson_init(&dst->data.obj.memb[i].v);
-                cjson_copy(&dst->data.obj.memb[i].v, &src->data.obj.memb[i].v);
+        case CJSON_FROZEN_OBJECT: {
+            cjson_snapshot_key* keys;
+            n = v->data.obj.size;
+            assert(n <= 0xFFFFFFFF && "too many members for a snapshot");
+            for (size_t i = 0; i < n; i++) {
+                cjson_view kv[2];
+                kv[0] = cjson_snapshot_write_string(w, v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
+                kv[1] = cjson_snapshot_write_value(w, &v->data.obj.memb[i].v);
+                memcpy(cjson_context_push(&w->stack, sizeof(kv)), kv, sizeof(kv));
+            }
+            slot.payload = cjson_snapshot_tell(w);
+            cjson_snapshot_put_u64(w, n);
+            slots = (cjson_view*)(w->stack.buffer + top);
+            for (size_t i = 0; i < 2 * n; i++)
+                cjson_snapshot_put_slot(w, slots[i]);
+            w->stack.top = top;
+            if (n > 0) {
+                keys = (cjson_snapshot_key*)cjson_context_push(&w->stack, n * sizeof(cjson_snapshot_key));
+                for (size_t i = 0; i < n; i++) {
+                    keys[i].k = v->data.obj.memb[i].k;
+                    keys[i].klen = v->data.obj.memb[i].klen;
+                    keys[i].index = (uint32_t)i;
+                }
+                qsort(keys, n, sizeof(cjson_snapshot_key), cjson_snapshot_key_compare);
+                for (size_t i = 0; i < n; i++)
+                    cjson_snapshot_put(w, &keys[i].index, sizeof(uint32_t));
+                cjson_snapshot_pad(w);
+                w->stack.top = top;
             }
-            dst->data.obj.size = src->data.obj.size;
             break;
-        default:
-            cjson_free(dst);
-            memcpy(dst, src, sizeof(cjson_value));
+        }
+        default: break;
+    }
+    return slot;
+}
+
+int cjson_snapshot_write(const cjson_value* v, int fd) {
+    cjson_snapshot_writer w;
+    uint32_t order[2] = {CJSON_SNAPSHOT_BYTE_ORDER, 0};
+    cjson_view root;
+    assert(v != NULL);
+    w.fd = fd;
+    w.error = 0;
+    w.pos = 0;
+    cjson_context_init(&w.out);
+    cjson_context_init(&w.stack);
+    cjson_snapshot_put(&w, CJSON_SNAPSHOT_MAGIC, sizeof(CJSON_SNAPSHOT_MAGIC));
+    cjson_snapshot_put(&w, order, sizeof(order));
+    root = cjson_snapshot_write_value(&w, v);
+    cjson_snapshot_put_slot(&w, root);
+    cjson_snapshot_put(&w, CJSON_SNAPSHOT_MAGIC, sizeof(CJSON_SNAPSHOT_MAGIC));
+    cjson_snapshot_flush(&w);
+    cjson_context_free(&w.out);
+    cjson_context_free(&w.stack);
+    return w.error ? CJSON_SNAPSHOT_IO_ERROR : CJSON_SNAPSHOT_OK;
+}
+
+/* Only the framing is checked; the image itself is trusted, which is what keeps opening it O(1). */
+const cjson_view* cjson_snapshot_root(const void* data, size_t length) {
+    const char* p = (const char*)data;
+    uint32_t order;
+    assert(data != NULL || length == 0);
+    if (length < 16 + sizeof(cjson_view) + sizeof(CJSON_SNAPSHOT_MAGIC) || length % 8 != 0 || ((uintptr_t)p & 7) != 0)
+        return NULL;
+    memcpy(&order, p + sizeof(CJSON_SNAPSHOT_MAGIC), sizeof(order));
+    if (memcmp(p, CJSON_SNAPSHOT_MAGIC, sizeof(CJSON_SNAPSHOT_MAGIC)) != 0 || order != CJSON_SNAPSHOT_BYTE_ORDER
+        || memcmp(p + length - sizeof(CJSON_SNAPSHOT_MAGIC), CJSON_SNAPSHOT_MAGIC, sizeof(CJSON_SNAPSHOT_MAGIC)) != 0)
+        return NULL;
+    return (const cjson_view*)(p + length - sizeof(CJSON_SNAPSHOT_MAGIC) - sizeof(cjson_view));
+}
+
+#define CJSON_VIEW_BODY(v)  ((const char*)(v) - (v)->payload)
+#define CJSON_VIEW_COUNT(v) (*(const uint64_t*)CJSON_VIEW_BODY(v))
+#define CJSON_VIEW_SLOTS(v) ((const cjson_view*)(CJSON_VIEW_BODY(v) + sizeof(uint64_t)))
+
+cjson_type cjson_view_get_type(const cjson_view* v) {
+    assert(v != NULL);
+    return (cjson_type)v->type;
+}
+
+int cjson_view_get_boolean(const cjson_view* v) {
+    assert(v != NULL && (v->type == CJSON_TRUE || v->type == CJSON_FALSE));
+    return v->type == CJSON_TRUE;
+}
+
+double cjson_view_get_number(const cjson_view* v) {
+    double n;
+    assert(v != NULL && v->type == CJSON_NUMBER);
+    memcpy(&n, &v->payload, sizeof(n));
+    return n;
+}
+
+const char* cjson_view_get_string(const cjson_view* v) {
+    assert(v != NULL && v->type == CJSON_STRING);
+    return CJSON_VIEW_BODY(v) + sizeof(uint64_t);
+}
+
+size_t cjson_view_get_string_length(const cjson_view* v) {
+    assert(v != NULL && v->type == CJSON_STRING);
+    return (size_t)CJSON_VIEW_COUNT(v);
+}
+
+size_t cjson_view_get_array_size(const cjson_view* v) {
+    assert(v != NULL && v->type == CJSON_ARRAY);
+    return (size_t)CJSON_VIEW_COUNT(v);
+}
+
+const cjson_view* cjson_view_get_array_element(const cjson_view* v, size_t index) {
+    assert(v != NULL && v->type == CJSON_ARRAY);
+    assert(index < CJSON_VIEW_COUNT(v));
+    return &CJSON_VIEW_SLOTS(v)[index];
+}
+
+size_t cjson_view_get_object_size(const cjson_view* v) {
+    assert(v != NULL && v->type == CJSON_OBJECT);
+    return (size_t)CJSON_VIEW_COUNT(v);
+}
+
+const char* cjson_view_get_object_key(const cjson_view* v, size_t index) {
+    assert(v != NULL && v->type == CJSON_OBJECT);
+    assert(index < CJSON_VIEW_COUNT(v));
+    return cjson_view_get_string(&CJSON_VIEW_SLOTS(v)[2 * index]);
+}
+
+size_t cjson_view_get_object_key_length(const cjson_view* v, size_t index) {
+    assert(v != NULL && v->type == CJSON_OBJECT);
+    assert(index < CJSON_VIEW_COUNT(v));
+    return cjson_view_get_string_length(&CJSON_VIEW_SLOTS(v)[2 * index]);
+}
+
+const cjson_view* cjson_view_get_object_value(const cjson_view* v, size_t index) {
+    assert(v != NULL && v->type == CJSON_OBJECT);
+    assert(index < CJSON_VIEW_COUNT(v));
+    return &CJSON_VIEW_SLOTS(v)[2 * index + 1];
+}
+
+/* Binary search over the sorted member table; among duplicate keys the first member wins. */
+size_t cjson_view_find_object_index(const cjson_view* v, const char* key, size_t klen) {
+    const cjson_view* slots;
+    const uint32_t* sorted;
+    size_t lo = 0, hi, n;
+    assert(v != NULL && v->type == CJSON_OBJECT && key != NULL);
+    n = hi = (size_t)CJSON_VIEW_COUNT(v);
+    slots = CJSON_VIEW_SLOTS(v);
+    sorted = (const uint32_t*)(slots + 2 * n);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const cjson_view* k = &slots[2 * sorted[mid]];
+        size_t len = cjson_view_get_string_length(k);
+        int ret = memcmp(cjson_view_get_string(k), key, len < klen ? len : klen);
+        if (ret < 0 || (ret == 0 && len < klen))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < n) {
+        const cjson_view* k = &slots[2 * sorted[lo]];
+        if (cjson_view_get_string_length(k) == klen && memcmp(cjson_view_get_string(k), key, klen) == 0)
+            return sorted[lo];
+    }
+    return CJSON_KEY_NOT_EXIST;
+}
+
+const cjson_view* cjson_view_find_object_value(const cjson_view* v, const char* key, size_t klen) {
+    size_t index = cjson_view_find_object_index(v, key, klen);
+    return index != CJSON_KEY_NOT_EXIST ? cjson_view_get_object_value(v, index) : NULL;
+}
+
+void cjson_copy_view(cjson_value* dst, const cjson_view* src) {
+    size_t n;
+    assert(dst != NULL && src != NULL);
+    switch (src->type) {
+        case CJSON_NULL:   cjson_set_null(dst); break;
+        case CJSON_FALSE:
+        case CJSON_TRUE:   cjson_set_boolean(dst, src->type == CJSON_TRUE); break;
+        case CJSON_NUMBER: cjson_set_number(dst, cjson_view_get_number(src)); break;
+        case CJSON_STRING: cjson_set_string(dst, cjson_view_get_string(src), cjson_view_get_string_length(src)); break;
+        case CJSON_ARRAY:
+            n = cjson_view_get_array_size(src);
+            cjson_set_array(dst, n);
+            for (size_t i = 0; i < n; i++)
+                cjson_copy_view(cjson_pushback_array_element(dst), cjson_view_get_array_element(src, i));
             break;
+        case CJSON_OBJECT:
+            n = cjson_view_get_object_size(src);
+            cjson_set_object(dst, n);
+            for (size_t i = 0; i < n; i++)
+                cjson_copy_view(cjson_set_object_value(dst, cjson_view_get_object_key(src, i), cjson_view_get_object_key_length(src, i)),
+                    cjson_view_get_object_value(src, i));
+            break;
+        default: assert(0 && "invalid type");
     }
 }
 
-void cjson_move(cjson_value* dst, cjson_value* src) {
-    assert(dst != NULL && src != NULL && src != dst);
-    cjson_free(dst);
-    memcpy(dst, src, sizeof(cjson_value));
-    cjson_init(src);
+// ==========================
+// ========== file ==========
+// ==========================
+
+#define CJSON_PARSE_FILE_CHUNK_SIZE 65536
+
+/* Reads the whole stream in chunks; used for pipes, devices and wherever mmap is unavailable. */
+static int cjson_parse_stream(cjson_value* v, FILE* fp, int flags) {
+    cjson_context c;
+    size_t n;
+    int ret;
+    cjson_context_init(&c);
+    do {
+        n = fread(cjson_context_push(&c, CJSON_PARSE_FILE_CHUNK_SIZE), 1, CJSON_PARSE_FILE_CHUNK_SIZE, fp);
+        c.top -= CJSON_PARSE_FILE_CHUNK_SIZE - n;
+    } while (n == CJSON_PARSE_FILE_CHUNK_SIZE);
+    if (ferror(fp))
+        ret = CJSON_PARSE_IO_ERROR;
+    else {
+        cjson_context_push_char(&c, '\0');
+        ret = cjson_parse_range(v, c.buffer, c.buffer + c.top - 1, flags);
+    }
+    cjson_context_free(&c);
+    return ret;
+}
+
+#ifndef _WIN32
+/* Maps a regular file read-only and parses it in place. The parser stops at a '\0', which
+ * the kernel provides for free: the tail of the last page past the end of the file is
+ * zero-filled, and when the file ends exactly on a page boundary it is mapped in front of
+ * an anonymous zero page instead. */
+static int cjson_parse_mapped(cjson_value* v, int fd, size_t size, int flags) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE), span = size;
+    char* p;
+    int ret;
+    if (size % page == 0) {
+        span = size + page;
+        p = (char*)mmap(NULL, span, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (p != MAP_FAILED && mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(p, span);
+            p = (char*)MAP_FAILED;
+        }
+    }
+    else
+        p = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return CJSON_PARSE_IO_ERROR;
+    posix_madvise(p, size, POSIX_MADV_SEQUENTIAL);
+    ret = cjson_parse_range(v, p, p + size, flags);
+    munmap(p, span);
+    return ret;
+}
+#endif
+
+int cjson_parse_file(cjson_value* v, const char* path, int flags) {
+    FILE* fp;
+    int ret;
+    assert(v != NULL && path != NULL);
+    cjson_init(v);
+#ifndef _WIN32
+    {
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return CJSON_PARSE_IO_ERROR;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return CJSON_PARSE_IO_ERROR;
+        }
+        if (S_ISREG(st.st_mode) && !(flags & CJSON_PARSE_FILE_NO_MMAP)) {
+            if ((unsigned long long)st.st_size >= (size_t)-1)
+                ret = CJSON_PARSE_IO_ERROR;    /* larger than the address space */
+            else if (st.st_size == 0)
+                ret = cjson_parse(v, "");
+            else
+                ret = cjson_parse_mapped(v, fd, (size_t)st.st_size, flags);
+            close(fd);
+            return ret;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        if ((fp = fdopen(fd, "rb")) == NULL) {
+            close(fd);
+            return CJSON_PARSE_IO_ERROR;
+        }
+    }
+#else
+    if ((fp = fopen(path, "rb")) == NULL)
+        return CJSON_PARSE_IO_ERROR;
+#endif
+    ret = cjson_parse_stream(v, fp, flags);
+    fclose(fp);
+    return ret;
+}
+
+// ==============================
+// ========== parallel ==========
+// ==============================
+
+const static size_t CJSON_PARALLEL_MIN_ELEMENTS = 4096;    /* smaller containers are not worth splitting */
+const static size_t CJSON_PARALLEL_CHUNKS_PER_THREAD = 4;  /* slack for uneven elements */
+#define CJSON_PARALLEL_MAX_THREADS 64
+
+typedef struct {
+    void (*run)(void* arg);
+    void* arg;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} cjson_thread;
+
+#ifdef _WIN32
+static unsigned __stdcall cjson_thread_main(void* t) {
+    ((cjson_thread*)t)->run(((cjson_thread*)t)->arg);
+    return 0;
+}
+
+static int cjson_thread_start(cjson_thread* t) {
+    t->handle = (HANDLE)_beginthreadex(NULL, 0, cjson_thread_main, t, 0, NULL);
+    return t->handle != 0;
+}
+
+static void cjson_thread_join(cjson_thread* t) {
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+}
+
+static void cjson_thread_detach(cjson_thread* t) {
+    CloseHandle(t->handle);
+}
+
+typedef SRWLOCK cjson_mutex;
+typedef CONDITION_VARIABLE cjson_cond;
+#define CJSON_MUTEX_INIT            SRWLOCK_INIT
+#define CJSON_COND_INIT             CONDITION_VARIABLE_INIT
+#define cjson_mutex_init(m)         InitializeSRWLock(m)
+#define cjson_mutex_destroy(m)      ((void)(m))
+#define cjson_mutex_lock(m)         AcquireSRWLockExclusive(m)
+#define cjson_mutex_unlock(m)       ReleaseSRWLockExclusive(m)
+#define cjson_cond_wait(c, m)       SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define cjson_cond_broadcast(c)     WakeAllConditionVariable(c)
+
+static unsigned cjson_parallel_cpus(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (unsigned)info.dwNumberOfProcessors;
+}
+#else
+static void* cjson_thread_main(void* t) {
+    ((cjson_thread*)t)->run(((cjson_thread*)t)->arg);
+    return NULL;
+}
+
+static int cjson_thread_start(cjson_thread* t) {
+    return pthread_create(&t->handle, NULL, cjson_thread_main, t) == 0;
+}
+
+static void cjson_thread_join(cjson_thread* t) {
+    pthread_join(t->handle, NULL);
+}
+
+static void cjson_thread_detach(cjson_thread* t) {
+    pthread_detach(t->handle);
+}
+
+typedef pthread_mutex_t cjson_mutex;
+typedef pthread_cond_t cjson_cond;
+#define CJSON_MUTEX_INIT            PTHREAD_MUTEX_INITIALIZER
+#define CJSON_COND_INIT             PTHREAD_COND_INITIALIZER
+#define cjson_mutex_init(m)         pthread_mutex_init(m, NULL)
+#define cjson_mutex_destroy(m)      pthread_mutex_destroy(m)
+#define cjson_mutex_lock(m)         pthread_mutex_lock(m)
+#define cjson_mutex_unlock(m)       pthread_mutex_unlock(m)
+#define cjson_cond_wait(c, m)       pthread_cond_wait(c, m)
+#define cjson_cond_broadcast(c)     pthread_cond_broadcast(c)
+
+static unsigned cjson_parallel_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
 }
+#endif
 
-void cjson_swap(cjson_value* lhs, cjson_value* rhs) {
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs != rhs) {
-        cjson_value temp;
-        memcpy(&temp, lhs, sizeof(cjson_value));
-        memcpy(lhs,   rhs, sizeof(cjson_value));
-        memcpy(rhs, &temp, sizeof(cjson_value));
+/* Runs run(arg) on the calling thread and threads - 1 helpers; a helper that fails to start is simply skipped. */
+static void cjson_parallel_run(unsigned threads, void (*run)(void* arg), void* arg) {
+    cjson_thread helpers[CJSON_PARALLEL_MAX_THREADS];
+    unsigned started = 0;
+    assert(threads <= CJSON_PARALLEL_MAX_THREADS);
+    for (unsigned i = 1; i < threads; i++) {
+        helpers[started].run = run;
+        helpers[started].arg = arg;
+        if (cjson_thread_start(&helpers[started]))
+            started++;
     }
+    run(arg);
+    for (unsigned i = 0; i < started; i++)
+        cjson_thread_join(&helpers[i]);
 }
 
-void cjson_free(cjson_value* v) {
-    assert(v != NULL);
-    switch (v->type) {
-        case CJSON_STRING:
-            free(v->data.str.s);
-            break;
-        case CJSON_ARRAY:
-            for (size_t i = 0; i < v->data.arr.size; ++i)
-                cjson_free(&v->data.arr.elem[i]);
-            free(v->data.arr.elem);
-            break;
-        case CJSON_OBJECT:
-            for (size_t i=0; i<v->data.obj.size; ++i) {
-                free(v->data.obj.memb[i].k);
-                cjson_free(&v->data.obj.memb[i].v);
-            }
-            free(v->data.obj.memb);
-            break;
-        default: break;
-    }
-    v->type = CJSON_NULL;
+/* 0 means one thread per online CPU. */
+static unsigned cjson_parallel_threads(unsigned threads, size_t jobs) {
+    if (threads == 0)
+        threads = cjson_parallel_cpus();
+    if (threads > CJSON_PARALLEL_MAX_THREADS)
+        threads = CJSON_PARALLEL_MAX_THREADS;
+    if (threads > jobs)
+        threads = jobs > 0 ? (unsigned)jobs : 1;
+    return threads;
 }
 
-cjson_type cjson_get_type(const cjson_value* v) {
-    assert(v != NULL);
-    return v->type;
+/* Any array or object, packed and frozen ones included. */
+static int cjson_parallel_is_large(const cjson_value* v) {
+    cjson_type type = cjson_get_type(v);
+    return (type == CJSON_ARRAY || type == CJSON_OBJECT) && cjson_walk_size(v) >= CJSON_PARALLEL_MIN_ELEMENTS;
 }
 
-int cjson_is_equal(const cjson_value* lhs, const cjson_value* rhs) {
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs->type != rhs->type)
-        return 0;
-    switch (lhs->type) {
-        case CJSON_STRING:
-            return lhs->data.str.len == rhs->data.str.len && 
-                memcmp(lhs->data.str.s, rhs->data.str.s, lhs->data.str.len) == 0;
-        case CJSON_NUMBER:
-            return lhs->data.num == rhs->data.num;
-        case CJSON_ARRAY:
-            if (lhs->data.arr.size != rhs->data.arr.size)
-                return 0;
-            for (size_t i = 0; i < lhs->data.arr.size; ++i)
-                if (!cjson_is_equal(&lhs->data.arr.elem[i], &rhs->data.arr.elem[i]))
-                    return 0;
-            return 1;
-        case CJSON_OBJECT:
-            if (lhs->data.obj.size != rhs->data.obj.size)
-                return 0;
-            for (size_t i = 0; i < lhs->data.obj.size; ++i){
-                size_t index = cjson_find_object_index(rhs, lhs->data.obj.memb[i].k, lhs->data.obj.memb[i].klen);
-                if (index == CJSON_KEY_NOT_EXIST || !cjson_is_equal(&lhs->data.obj.memb[i].v, &rhs->data.obj.memb[index].v))
-                    return 0;
-            }
-            return 1;
-        default:
-            return 1;
-    }
+typedef struct {
+    const cjson_value* v;   /* container whose elements [begin, end) this chunk renders, NULL for literal text */
+    size_t begin, end;
+    cjson_context out;
+} cjson_stringify_chunk;
+
+typedef struct {
+    cjson_context plan;     /* cjson_stringify_chunk[] in output order */
+    size_t count;
+    size_t next;            /* next chunk to claim, shared by the workers */
+    size_t elements;        /* elements per chunk */
+} cjson_stringify_job;
+
+#define CJSON_STRINGIFY_CHUNKS(job) ((cjson_stringify_chunk*)(job)->plan.buffer)
+
+static cjson_stringify_chunk* cjson_stringify_plan_push(cjson_stringify_job* job, const cjson_value* v, size_t begin, size_t end) {
+    cjson_stringify_chunk* chunk = (cjson_stringify_chunk*)cjson_context_push(&job->plan, sizeof(cjson_stringify_chunk));
+    chunk->v = v;
+    chunk->begin = begin;
+    chunk->end = end;
+    cjson_context_init(&chunk->out);
+    job->count++;
+    return chunk;
 }
 
-void cjson_set_null(cjson_value* v) {
-    cjson_free(v);
+/* Literal text is rendered right away, into the previous chunk when that one is text as well. */
+static cjson_context* cjson_stringify_plan_text(cjson_stringify_job* job) {
+    cjson_stringify_chunk* last = job->count > 0 ? &CJSON_STRINGIFY_CHUNKS(job)[job->count - 1] : NULL;
+    if (last == NULL || last->v != NULL)
+        last = cjson_stringify_plan_push(job, NULL, 0, 0);
+    return &last->out;
 }
 
-int cjson_get_boolean(const cjson_value* v) {
-    assert(v != NULL && (v->type == CJSON_TRUE || v->type == CJSON_FALSE));
-    return v->type == CJSON_TRUE;
+static void cjson_stringify_plan_run(cjson_stringify_job* job, const cjson_value* v, size_t begin, size_t end) {
+    while (begin < end) {
+        size_t n = end - begin < job->elements ? end - begin : job->elements;
+        cjson_stringify_plan_push(job, v, begin, begin + n);
+        begin += n;
+    }
 }
 
-void cjson_set_boolean(cjson_value* v, int b) {
-    cjson_free(v);
-    v->type = b ? CJSON_TRUE : CJSON_FALSE;
+/* Splits a large container into runs of small elements, descending into elements that are large themselves. */
+static void cjson_stringify_plan(cjson_stringify_job* job, const cjson_value* v) {
+    size_t size = cjson_walk_size(v), run = 0;
+    cjson_context_push_char(cjson_stringify_plan_text(job), v->type == CJSON_ARRAY ? '[' : '{');
+    for (size_t i = 0; i < size && CJSON_IS_CONTAINER(v); i++) {
+        const cjson_value* e = v->type == CJSON_ARRAY ? &v->data.arr.elem[i] : &v->data.obj.memb[i].v;
+        if (cjson_parallel_is_large(e)) {
+            cjson_context* text;
+            cjson_stringify_plan_run(job, v, run, i);
+            text = cjson_stringify_plan_text(job);
+            if (i > 0)
+                cjson_context_push_char(text, ',');
+            if (v->type == CJSON_OBJECT) {
+                cjson_stringify_string(text, v->data.obj.memb[i].k, v->data.obj.memb[i].klen);
+                cjson_context_push_char(text, ':');
+            }
+            cjson_stringify_plan(job, e);
+            run = i + 1;
+        }
+    }
+    cjson_stringify_plan_run(job, v, run, size);
+    cjson_context_push_char(cjson_stringify_plan_text(job), v->type == CJSON_ARRAY ? ']' : '}');
 }
 
-double cjson_get_number(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_NUMBER);
-    return v->data.num;
+static void cjson_stringify_worker(void* arg) {
+    cjson_stringify_job* job = (cjson_stringify_job*)arg;
+    size_t i;
+    while ((i = CJSON_ATOMIC_ADD(&job->next, 1) - 1) < job->count) {
+        cjson_stringify_chunk* chunk = &CJSON_STRINGIFY_CHUNKS(job)[i];
+        if (chunk->v != NULL && chunk->v->form == CJSON_NUMBER_ARRAY)
+            cjson_stringify_numbers(&chunk->out, chunk->v->data.nums.elem, chunk->begin, chunk->end);
+        else if (chunk->v != NULL)
+            cjson_stringify_elements(&chunk->out, chunk->v, chunk->begin, chunk->end);
+    }
 }
 
-void cjson_set_number(cjson_value* v, double n) {
-    cjson_free(v);
-    v->data.num = n;
-    v->type = CJSON_NUMBER;
+/* Returns 0 when v is too small to split, leaving the job empty. */
+static int cjson_stringify_job_run(cjson_stringify_job* job, const cjson_value* v, unsigned threads) {
+    cjson_context_init(&job->plan);
+    job->count = job->next = 0;
+    if (!cjson_parallel_is_large(v))
+        return 0;
+    threads = cjson_parallel_threads(threads, ~(size_t)0);
+    job->elements = cjson_walk_size(v) / (threads * CJSON_PARALLEL_CHUNKS_PER_THREAD) + 1;
+    cjson_stringify_plan(job, v);
+    cjson_parallel_run(cjson_parallel_threads(threads, job->count), cjson_stringify_worker, job);
+    return 1;
 }
 
-const char* cjson_get_string(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_STRING);
-    return v->data.str.s;
+static void cjson_stringify_job_free(cjson_stringify_job* job) {
+    for (size_t i = 0; i < job->count; i++)
+        cjson_context_free(&CJSON_STRINGIFY_CHUNKS(job)[i].out);
+    cjson_context_free(&job->plan);
 }
 
-size_t cjson_get_string_length(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_STRING);
-    return v->data.str.len;
+char* cjson_stringify_parallel(const cjson_value* v, size_t* len, unsigned threads) {
+    cjson_stringify_job job;
+    size_t total = 0;
+    char* json;
+    assert(v != NULL);
+    if (!cjson_stringify_job_run(&job, v, threads))
+        return cjson_stringify(v, len);
+    for (size_t i = 0; i < job.count; i++)
+        total += CJSON_STRINGIFY_CHUNKS(&job)[i].out.top;
+    json = (char*)cjson_heap_alloc(total + 1);
+    total = 0;
+    for (size_t i = 0; i < job.count; i++) {
+        const cjson_context* out = &CJSON_STRINGIFY_CHUNKS(&job)[i].out;
+        memcpy(json + total, out->buffer, out->top);
+        total += out->top;
+    }
+    json[total] = '\0';
+    CJSON_STATS_FREE(total + 1);    /* handed over like cjson_context_detach() */
+    cjson_stringify_job_free(&job);
+    if (len) *len = total;
+    return json;
 }
 
-void cjson_set_string(cjson_value* v, const char* s, size_t len) {
-    assert(v != NULL && (s != NULL || len == 0));
-    cjson_free(v);
-    v->data.str.s = (char*)malloc(len + 1);
-    memcpy(v->data.str.s, s, len);
-    v->data.str.s[len] = '\0';
-    v->data.str.len = len;
-    v->type = CJSON_STRING;
+#ifndef _WIN32
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* Gathers the chunks with writev(), resuming partial writes in the middle of a chunk. */
+static int cjson_stringify_gather(int fd, const cjson_stringify_job* job) {
+    struct iovec iov[IOV_MAX > 64 ? 64 : IOV_MAX];
+    size_t i = 0, skip = 0;
+    while (i < job->count) {
+        int n = 0;
+        ssize_t ret;
+        for (size_t j = i; j < job->count && n < (int)(sizeof(iov) / sizeof(iov[0])); j++) {
+            const cjson_context* out = &CJSON_STRINGIFY_CHUNKS(job)[j].out;
+            iov[n].iov_base = out->buffer + (j == i ? skip : 0);
+            iov[n].iov_len = out->top - (j == i ? skip : 0);
+            n++;
+        }
+        ret = writev(fd, iov, n);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        while (i < job->count && (size_t)ret >= CJSON_STRINGIFY_CHUNKS(job)[i].out.top - skip) {
+            ret -= (ssize_t)(CJSON_STRINGIFY_CHUNKS(job)[i].out.top - skip);
+            skip = 0;
+            i++;
+        }
+        skip += (size_t)ret;
+    }
+    return 1;
 }
+#else
+static int cjson_stringify_gather(int fd, const cjson_stringify_job* job) {
+    for (size_t i = 0; i < job->count; i++)
+        if (!cjson_write_all(fd, CJSON_STRINGIFY_CHUNKS(job)[i].out.buffer, CJSON_STRINGIFY_CHUNKS(job)[i].out.top))
+            return 0;
+    return 1;
+}
+#endif
 
-void cjson_set_array(cjson_value* v, size_t capacity) {
+int cjson_stringify_parallel_fd(const cjson_value* v, int fd, unsigned threads) {
+    cjson_stringify_job job;
+    int ok;
     assert(v != NULL);
-    cjson_free(v);
-    v->type = CJSON_ARRAY;
-    v->data.arr.size = 0;
-    v->data.arr.capacity = capacity;
-    v->data.arr.elem = capacity > 0 ? (cjson_value*)malloc(capacity * sizeof(cjson_value)) : NULL;
+    if (cjson_stringify_job_run(&job, v, threads))
+        ok = cjson_stringify_gather(fd, &job);
+    else {
+        cjson_context c;
+        size_t len;
+        cjson_context_init(&c);
+        cjson_stringify_context(&c, v, &len);
+        ok = cjson_write_all(fd, c.buffer, len);
+        cjson_context_free(&c);
+    }
+    cjson_stringify_job_free(&job);
+    return ok ? CJSON_STRINGIFY_OK : CJSON_STRINGIFY_IO_ERROR;
 }
 
-size_t cjson_get_array_size(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    return v->data.arr.size;
+typedef struct {
+    cjson_value* v;         /* container whose elements [begin, end) this task copies into or frees */
+    const cjson_value* src; /* container copied from, NULL when freeing */
+    size_t begin, end;
+} cjson_tree_task;
+
+typedef struct {
+    cjson_context tasks;    /* cjson_tree_task[] */
+    cjson_context blocks;   /* storage released once the tasks have freed its elements */
+    size_t count;
+    size_t next;            /* next task to claim, shared by the workers */
+    unsigned threads;
+} cjson_tree_job;
+
+#define CJSON_TREE_TASKS(job) ((cjson_tree_task*)(job)->tasks.buffer)
+
+static void cjson_tree_job_init(cjson_tree_job* job, unsigned threads) {
+    cjson_context_init(&job->tasks);
+    cjson_context_init(&job->blocks);
+    job->count = job->next = 0;
+    job->threads = cjson_parallel_threads(threads, ~(size_t)0);
 }
 
-size_t cjson_get_array_capacity(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    return v->data.arr.capacity;
+/* Elements of a container are split evenly whatever its size, so that a small root
+ * holding a few large children still spreads them over the threads. */
+static void cjson_tree_plan_run(cjson_tree_job* job, cjson_value* v, const cjson_value* src, size_t begin, size_t end) {
+    size_t elements = cjson_walk_size(src != NULL ? src : v) / (job->threads * CJSON_PARALLEL_CHUNKS_PER_THREAD) + 1;
+    while (begin < end) {
+        cjson_tree_task* task = (cjson_tree_task*)cjson_context_push(&job->tasks, sizeof(cjson_tree_task));
+        task->v = v;
+        task->src = src;
+        task->begin = begin;
+        task->end = end - begin < elements ? end : begin + elements;
+        begin = task->end;
+        job->count++;
+    }
 }
 
-void cjson_reserve_array(cjson_value* v, size_t capacity) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    if (v->data.arr.capacity < capacity) {
-        v->data.arr.capacity = capacity;
-        v->data.arr.elem = (cjson_value*)realloc(v->data.arr.elem, capacity * sizeof(cjson_value));
+/* Allocates the storage of dst and leaves its elements to tasks, copying large children in place. */
+static void cjson_copy_plan(cjson_tree_job* job, cjson_value* dst, const cjson_value* src) {
+    size_t size = cjson_walk_size(src), run = 0;
+    if (src->form == CJSON_NUMBER_ARRAY) {  /* the tasks copy ranges of numbers */
+        dst->type = CJSON_ARRAY;
+        dst->form = CJSON_NUMBER_ARRAY;
+        dst->data.nums.elem = (double*)cjson_block_alloc(size * sizeof(double));
+        dst->data.nums.size = dst->data.nums.capacity = size;
+        cjson_tree_plan_run(job, dst, src, 0, size);
+        return;
+    }
+    if (src->type == CJSON_ARRAY) {
+        cjson_set_array(dst, size);
+        dst->data.arr.size = size;
+    }
+    else {
+        cjson_set_object(dst, size);
+        dst->data.obj.size = size;
+        dst->form = src->form;  /* a frozen copy is sorted too */
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (src->type == CJSON_ARRAY && cjson_parallel_is_large(&src->data.arr.elem[i])) {
+            cjson_tree_plan_run(job, dst, src, run, i);
+            cjson_init(&dst->data.arr.elem[i]);
+            cjson_copy_plan(job, &dst->data.arr.elem[i], &src->data.arr.elem[i]);
+            run = i + 1;
+        }
+        else if (src->type == CJSON_OBJECT && cjson_parallel_is_large(&src->data.obj.memb[i].v)) {
+            cjson_member* m = &dst->data.obj.memb[i];
+            cjson_tree_plan_run(job, dst, src, run, i);
+            m->klen = src->data.obj.memb[i].klen;
+            m->k = cjson_string_dup(src->data.obj.memb[i].k, m->klen);
+            cjson_init(&m->v);
+            cjson_copy_plan(job, &m->v, &src->data.obj.memb[i].v);
+            run = i + 1;
+        }
     }
+    cjson_tree_plan_run(job, dst, src, run, size);
 }
 
-void cjson_shrink_array(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    if (v->data.arr.capacity > v->data.arr.size) {
-        v->data.arr.capacity = v->data.arr.size;
-        v->data.arr.elem = (cjson_value*)realloc(v->data.arr.elem, v->data.arr.capacity * sizeof(cjson_value));
+/* v holds the last reference to its storage; large children are descended into when they do too. */
+static void cjson_free_plan(cjson_tree_job* job, cjson_value* v) {
+    size_t size = cjson_walk_size(v), run = 0;
+    void* storage = cjson_storage(v);
+    for (size_t i = 0; i < size && CJSON_IS_CONTAINER(v); i++) {
+        cjson_value* e = v->type == CJSON_ARRAY ? &v->data.arr.elem[i] : &v->data.obj.memb[i].v;
+        if (cjson_parallel_is_large(e)) {
+            cjson_tree_plan_run(job, v, NULL, run, i);
+            if (v->type == CJSON_OBJECT)
+                cjson_string_release(v->data.obj.memb[i].k);
+            if (cjson_block_unref(cjson_storage(e)))
+                cjson_free_plan(job, e);
+            run = i + 1;
+        }
     }
+    if (CJSON_IS_CONTAINER(v))  /* packed numbers have nothing to free but their block */
+        cjson_tree_plan_run(job, v, NULL, run, size);
+    if (storage != NULL)
+        *(void**)cjson_context_push(&job->blocks, sizeof(void*)) = storage;
 }
 
-void cjson_clear_array(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    cjson_erase_array_element(v, 0, v->data.arr.size);
+static void cjson_tree_worker(void* arg) {
+    cjson_tree_job* job = (cjson_tree_job*)arg;
+    size_t i;
+    while ((i = CJSON_ATOMIC_ADD(&job->next, 1) - 1) < job->count) {
+        const cjson_tree_task* task = &CJSON_TREE_TASKS(job)[i];
+        if (task->src != NULL && task->src->form == CJSON_NUMBER_ARRAY) {
+            memcpy(task->v->data.nums.elem + task->begin, task->src->data.nums.elem + task->begin, (task->end - task->begin) * sizeof(double));
+            continue;
+        }
+        for (size_t j = task->begin; j < task->end; j++) {
+            if (task->src == NULL && task->v->type == CJSON_ARRAY)
+                cjson_free(&task->v->data.arr.elem[j]);
+            else if (task->src == NULL) {
+                cjson_string_release(task->v->data.obj.memb[j].k);
+                cjson_free(&task->v->data.obj.memb[j].v);
+            }
+            else if (task->src->type == CJSON_ARRAY) {
+                cjson_init(&task->v->data.arr.elem[j]);
+                cjson_copy(&task->v->data.arr.elem[j], &task->src->data.arr.elem[j]);
+            }
+            else {
+                cjson_member* m = &task->v->data.obj.memb[j];
+                m->klen = task->src->data.obj.memb[j].klen;
+                m->k = cjson_string_dup(task->src->data.obj.memb[j].k, m->klen);
+                cjson_init(&m->v);
+                cjson_copy(&m->v, &task->src->data.obj.memb[j].v);
+            }
+        }
+    }
 }
 
-cjson_value* cjson_get_array_element(cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    assert(index < v->data.arr.size);
-    return &v->data.arr.elem[index];
+static void cjson_tree_job_run(cjson_tree_job* job) {
+    cjson_parallel_run(cjson_parallel_threads(job->threads, job->count), cjson_tree_worker, job);
+    for (size_t i = 0; i < job->blocks.top / sizeof(void*); i++)
+        cjson_block_free(((void**)job->blocks.buffer)[i]);
+    cjson_context_free(&job->tasks);
+    cjson_context_free(&job->blocks);
 }
 
-cjson_value* cjson_pushback_array_element(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    if (v->data.arr.size == v->data.arr.capacity)
-        cjson_reserve_array(v, v->data.arr.capacity == 0 ? 1 : v->data.arr.capacity * 2);
-    cjson_init(&v->data.arr.elem[v->data.arr.size]);
-    return &v->data.arr.elem[v->data.arr.size++];
+void cjson_copy_parallel(cjson_value* dst, const cjson_value* src, unsigned threads) {
+    cjson_tree_job job;
+    assert(src != NULL && dst != NULL && src != dst);
+    if ((cjson_get_type(src) != CJSON_ARRAY && cjson_get_type(src) != CJSON_OBJECT) || cjson_walk_size(src) == 0) {
+        cjson_copy(dst, src);
+        return;
+    }
+    cjson_tree_job_init(&job, threads);
+    cjson_copy_plan(&job, dst, src);
+    cjson_tree_job_run(&job);
 }
 
-void cjson_popback_array_element(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_ARRAY && v->data.arr.size > 0);
-    cjson_free(&v->data.arr.elem[--v->data.arr.size]);
+void cjson_free_parallel(cjson_value* v, unsigned threads) {
+    cjson_tree_job job;
+    assert(v != NULL);
+    if (cjson_get_type(v) != CJSON_ARRAY && cjson_get_type(v) != CJSON_OBJECT) {
+        cjson_free(v);
+        return;
+    }
+    cjson_tree_job_init(&job, threads);
+    if (cjson_block_unref(cjson_storage(v)))
+        cjson_free_plan(&job, v);
+    cjson_tree_job_run(&job);
+    cjson_init(v);
 }
 
-cjson_value* cjson_insert_array_element(cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    assert(index <= v->data.arr.size);   /* if index == size, then this's equivalent to pushback*/
-    if (v->data.arr.size == v->data.arr.capacity) {
-        cjson_reserve_array(v, v->data.arr.capacity == 0 ? 1 : v->data.arr.capacity * 2);
+/* A single reclaimer thread, started on first use, frees the trees queued by cjson_free_background(). */
+static cjson_mutex cjson_reclaim_lock = CJSON_MUTEX_INIT;
+static cjson_cond cjson_reclaim_work = CJSON_COND_INIT;    /* queue became non-empty */
+static cjson_cond cjson_reclaim_idle = CJSON_COND_INIT;    /* queue drained and nothing being freed */
+static cjson_context cjson_reclaim_queue;                  /* cjson_value[] */
+static cjson_thread cjson_reclaimer;
+static int cjson_reclaim_state;     /* 0 not started, 1 running, -1 failed to start */
+static int cjson_reclaim_busy;
+
+static void cjson_reclaim_main(void* arg) {
+    cjson_context batch;
+    (void)arg;
+    cjson_context_init(&batch);
+    cjson_mutex_lock(&cjson_reclaim_lock);
+    for (;;) {
+        cjson_context swap;
+        while (cjson_reclaim_queue.top == 0) {
+            cjson_reclaim_busy = 0;
+            cjson_cond_broadcast(&cjson_reclaim_idle);
+            cjson_cond_wait(&cjson_reclaim_work, &cjson_reclaim_lock);
+        }
+        swap = batch;   /* take the whole queue, handing back an emptied buffer */
+        batch = cjson_reclaim_queue;
+        cjson_reclaim_queue = swap;
+        cjson_reclaim_busy = 1;
+        cjson_mutex_unlock(&cjson_reclaim_lock);
+        for (size_t i = 0; i < batch.top / sizeof(cjson_value); i++)
+            cjson_free((cjson_value*)batch.buffer + i);
+        batch.top = 0;
+        cjson_mutex_lock(&cjson_reclaim_lock);
     }
-    for(size_t i = v->data.arr.size++; i > index; --i) {
-        v->data.arr.elem[i] = v->data.arr.elem[i - 1];
+}
+
+void cjson_free_background(cjson_value* v) {
+    assert(v != NULL);
+    if (CJSON_IS_ARRAY(v) || CJSON_IS_OBJECT(v)) {
+        cjson_mutex_lock(&cjson_reclaim_lock);
+        if (cjson_reclaim_state == 0) {
+            cjson_reclaimer.run = cjson_reclaim_main;
+            cjson_reclaimer.arg = NULL;
+            cjson_reclaim_state = cjson_thread_start(&cjson_reclaimer) ? 1 : -1;
+            if (cjson_reclaim_state > 0)
+                cjson_thread_detach(&cjson_reclaimer);
+        }
+        if (cjson_reclaim_state > 0) {
+            memcpy(cjson_context_push(&cjson_reclaim_queue, sizeof(cjson_value)), v, sizeof(cjson_value));
+            cjson_init(v);
+            cjson_cond_broadcast(&cjson_reclaim_work);
+        }
+        cjson_mutex_unlock(&cjson_reclaim_lock);
     }
-    return &v->data.arr.elem[index]; 
+    cjson_free(v);  /* no-op once queued; scalars and strings are cheap to free here */
 }
 
-void cjson_erase_array_element(cjson_value* v, size_t index, size_t count) {
-    assert(v != NULL && v->type == CJSON_ARRAY);
-    assert(index + count <= v->data.arr.size);
-    if(!count) return;
-    for(size_t i = index; i < index + count; ++i) {
-        cjson_free(&v->data.arr.elem[i]);
-        v->data.arr.elem[i] = v->data.arr.elem[i + count];
+void cjson_free_background_wait(void) {
+    cjson_mutex_lock(&cjson_reclaim_lock);
+    while (cjson_reclaim_queue.top > 0 || cjson_reclaim_busy)
+        cjson_cond_wait(&cjson_reclaim_idle, &cjson_reclaim_lock);
+    cjson_mutex_unlock(&cjson_reclaim_lock);
+}
+
+// ===========================
+// ========== cache ==========
+// ===========================
+
+typedef struct cjson_parse_entry {
+    char* json;             /* input text, a string block */
+    size_t len, hash;
+    int flags;
+    cjson_value doc;        /* the cache's reference; callers get shared copies */
+    struct cjson_parse_entry *newer, *older;   /* recency list */
+    struct cjson_parse_entry* chain;            /* next in the bucket */
+} cjson_parse_entry;
+
+struct cjson_parse_cache_shard {
+    cjson_mutex lock;
+    cjson_parse_entry** buckets;
+    size_t mask;
+    cjson_parse_entry *newest, *oldest;
+    size_t size;
+};
+
+void cjson_parse_cache_init(cjson_parse_cache* pc, size_t capacity, unsigned shards) {
+    size_t buckets = 1;
+    assert(pc != NULL && capacity > 0 && shards > 0);
+    pc->shard_count = shards;
+    pc->capacity = (capacity + shards - 1) / shards;
+    pc->hits = pc->misses = pc->evictions = 0;
+    while (buckets < pc->capacity * 2)
+        buckets <<= 1;
+    pc->shards = (struct cjson_parse_cache_shard*)cjson_heap_alloc(shards * sizeof(struct cjson_parse_cache_shard));
+    for (unsigned i = 0; i < shards; i++) {
+        struct cjson_parse_cache_shard* s = &pc->shards[i];
+        cjson_mutex_init(&s->lock);
+        s->buckets = (cjson_parse_entry**)cjson_heap_alloc(buckets * sizeof(cjson_parse_entry*));
+        memset(s->buckets, 0, buckets * sizeof(cjson_parse_entry*));
+        s->mask = buckets - 1;
+        s->newest = s->oldest = NULL;
+        s->size = 0;
     }
-    for(size_t i = index + count; i < v->data.arr.size; ++i) {
-        v->data.arr.elem[i] = v->data.arr.elem[i + count];
+}
+
+static void cjson_parse_entry_free(cjson_parse_entry* e) {
+    cjson_free(&e->doc);
+    cjson_string_release(e->json);
+    cjson_heap_free(e, sizeof(cjson_parse_entry));
+}
+
+/* Documents already handed out stay valid; they hold their own references. */
+void cjson_parse_cache_free(cjson_parse_cache* pc) {
+    assert(pc != NULL);
+    for (unsigned i = 0; i < pc->shard_count; i++) {
+        struct cjson_parse_cache_shard* s = &pc->shards[i];
+        while (s->newest != NULL) {
+            cjson_parse_entry* e = s->newest;
+            s->newest = e->older;
+            cjson_parse_entry_free(e);
+        }
+        cjson_heap_free(s->buckets, (s->mask + 1) * sizeof(cjson_parse_entry*));
+        cjson_mutex_destroy(&s->lock);
     }
-    v->data.arr.size -= count;
+    cjson_heap_free(pc->shards, pc->shard_count * sizeof(struct cjson_parse_cache_shard));
+    pc->shards = NULL;
+    pc->shard_count = 0;
 }
 
-void cjson_set_object(cjson_value* v, size_t capacity) {
-    assert(v != NULL);
-    cjson_free(v);
-    v->type = CJSON_OBJECT;
-    v->data.obj.size = 0;
-    v->data.obj.capacity = capacity;
-    v->data.obj.memb = capacity > 0 ? (cjson_member*)malloc(capacity * sizeof(cjson_member)) : NULL;
+static cjson_parse_entry* cjson_parse_cache_find(struct cjson_parse_cache_shard* s, size_t slot, const char* json, size_t len, size_t hash, int flags) {
+    for (cjson_parse_entry* e = s->buckets[slot]; e != NULL; e = e->chain)
+        if (e->hash == hash && e->len == len && e->flags == flags && memcmp(e->json, json, len) == 0)
+            return e;
+    return NULL;
 }
 
-size_t cjson_get_object_size(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    return v->data.obj.size;
+static void cjson_parse_cache_unlink(struct cjson_parse_cache_shard* s, cjson_parse_entry* e) {
+    if (e->newer) e->newer->older = e->older; else s->newest = e->older;
+    if (e->older) e->older->newer = e->newer; else s->oldest = e->newer;
 }
 
-size_t cjson_get_object_capacity(const cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    return v->data.obj.capacity;
+static void cjson_parse_cache_push(struct cjson_parse_cache_shard* s, cjson_parse_entry* e) {
+    e->newer = NULL;
+    e->older = s->newest;
+    if (s->newest) s->newest->newer = e; else s->oldest = e;
+    s->newest = e;
 }
 
-void cjson_reserve_object(cjson_value* v, size_t capacity) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    if (v->data.obj.capacity < capacity) {
-        v->data.obj.capacity = capacity;
-        v->data.obj.memb = (cjson_member*)realloc(v->data.arr.elem, capacity * sizeof(cjson_member));
+/* Parses json, a null-terminated text, or shares the document parsed from the same text and flags
+ * before. Failed parses are not cached. */
+int cjson_parse_cached(cjson_parse_cache* pc, cjson_value* v, const char* json, int flags) {
+    size_t len, hash, slot;
+    struct cjson_parse_cache_shard* s;
+    cjson_parse_entry* e, *evicted = NULL;
+    cjson_value doc;
+    int ret;
+    assert(pc != NULL && v != NULL && json != NULL);
+    len = strlen(json);
+    hash = cjson_hash_mix(cjson_hash_bytes(json, len) + (size_t)flags);
+    s = &pc->shards[hash % pc->shard_count];
+    slot = (hash / pc->shard_count) & s->mask;
+    cjson_free(v);
+
+    cjson_mutex_lock(&s->lock);
+    if ((e = cjson_parse_cache_find(s, slot, json, len, hash, flags)) != NULL) {
+        cjson_parse_cache_unlink(s, e);
+        cjson_parse_cache_push(s, e);
+        cjson_copy_shared(v, &e->doc);
+        cjson_mutex_unlock(&s->lock);
+        CJSON_ATOMIC_ADD(&pc->hits, 1);
+        return CJSON_PARSE_OK;
     }
-}
+    cjson_mutex_unlock(&s->lock);
+    CJSON_ATOMIC_ADD(&pc->misses, 1);
 
-void cjson_shrink_object(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    if (v->data.obj.capacity > v->data.obj.size) {
-        v->data.obj.capacity = v->data.obj.size;
-        v->data.obj.memb = (cjson_member*)realloc(v->data.obj.memb, v->data.obj.size * sizeof(cjson_member));
+    {   /* parsed outside the lock; the document is shared across threads, so not from a pool */
+#ifdef CJSON_POOL
+        cjson_pool* pool = cjson_thread_pool;
+        cjson_thread_pool = NULL;
+#endif
+        ret = cjson_parse_flags(&doc, json, flags);
+        if (ret == CJSON_PARSE_OK) {
+            e = (cjson_parse_entry*)cjson_heap_alloc(sizeof(cjson_parse_entry));
+            e->json = cjson_string_dup(json, len);
+        }
+#ifdef CJSON_POOL
+        cjson_thread_pool = pool;
+#endif
     }
-}
+    if (ret != CJSON_PARSE_OK)
+        return ret;
+    e->len = len;
+    e->hash = hash;
+    e->flags = flags;
+    memcpy(&e->doc, &doc, sizeof(cjson_value));
 
-void cjson_clear_object(cjson_value* v) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    for(size_t i = 0; i < v->data.obj.size; ++i){
-        free(v->data.obj.memb[i].k);
-        cjson_free(&v->data.obj.memb[i].v);
+    cjson_mutex_lock(&s->lock);
+    {
+        cjson_parse_entry* raced = cjson_parse_cache_find(s, slot, json, len, hash, flags);
+        if (raced != NULL) {    /* another thread parsed the same text meanwhile */
+            cjson_copy_shared(v, &raced->doc);
+            evicted = e;
+            e->chain = NULL;
+        }
+        else {
+            e->chain = s->buckets[slot];
+            s->buckets[slot] = e;
+            cjson_parse_cache_push(s, e);
+            cjson_copy_shared(v, &e->doc);
+            if (++s->size > pc->capacity) {
+                cjson_parse_entry** p;
+                evicted = s->oldest;
+                cjson_parse_cache_unlink(s, evicted);
+                for (p = &s->buckets[(evicted->hash / pc->shard_count) & s->mask]; *p != evicted; p = &(*p)->chain)
+                    ;
+                *p = evicted->chain;
+                s->size--;
+                CJSON_ATOMIC_ADD(&pc->evictions, 1);
+            }
+        }
     }
-    v->data.obj.size = 0;
+    cjson_mutex_unlock(&s->lock);
+    if (evicted != NULL)    /* callers still holding its document keep it alive */
+        cjson_parse_entry_free(evicted);
+    return CJSON_PARSE_OK;
 }
 
-const char* cjson_get_object_key(const cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    assert(index < v->data.obj.size);
-    return v->data.obj.memb[index].k;
-}
+// ===========================
+// ========== stats ==========
+// ===========================
 
-size_t cjson_get_object_key_length(const cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    assert(index < v->data.obj.size);
-    return v->data.obj.memb[index].klen;
+void cjson_get_stats(cjson_stats* s) {
+    assert(s != NULL);
+#ifdef CJSON_STATS
+    *s = cjson_thread_stats;
+#else
+    memset(s, 0, sizeof(cjson_stats));
+#endif
 }
 
-cjson_value* cjson_get_object_value(cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_OBJECT);
-    assert(index < v->data.obj.size);
-    return &v->data.obj.memb[index].v;
+void cjson_reset_stats(void) {
+#ifdef CJSON_STATS
+    cjson_stats* s = &cjson_thread_stats;
+    s->allocs = s->frees = s->reallocs = s->stack_peak = 0;
+    s->bytes_peak = s->bytes_live;     /* what is still allocated stays accounted for */
+#endif
 }
 
-size_t cjson_find_object_index(const cjson_value* v, const char* key, size_t klen) {
-    assert(v != NULL && v->type == CJSON_OBJECT && key != NULL);
-    for (size_t i = 0; i < v->data.obj.size; ++i)
-        if (v->data.obj.memb[i].klen == klen && memcmp(v->data.obj.memb[i].k, key, klen) == 0)
-            return i;
-    return CJSON_KEY_NOT_EXIST;
+typedef struct {
+    const void** slots;
+    size_t size, mask;
+} cjson_pointer_set;
+
+/* Adds p to the set; returns zero if it was already there. */
+static int cjson_pointer_set_add(cjson_pointer_set* set, const void* p) {
+    size_t i;
+    if (set->slots == NULL || (set->size + 1) * 2 > set->mask + 1) {
+        const void** old = set->slots;
+        size_t capacity = set->slots == NULL ? 0 : set->mask + 1;
+        set->mask = capacity == 0 ? 63 : capacity * 2 - 1;
+        set->slots = (const void**)cjson_heap_alloc((set->mask + 1) * sizeof(const void*));
+        memset(set->slots, 0, (set->mask + 1) * sizeof(const void*));
+        for (size_t j = 0; j < capacity; ++j) {
+            if (old[j] == NULL)
+                continue;
+            for (i = cjson_hash_mix((size_t)old[j]) & set->mask; set->slots[i] != NULL; i = (i + 1) & set->mask)
+                ;
+            set->slots[i] = old[j];
+        }
+        cjson_heap_free(old, capacity * sizeof(const void*));
+    }
+    for (i = cjson_hash_mix((size_t)p) & set->mask; set->slots[i] != NULL; i = (i + 1) & set->mask)
+        if (set->slots[i] == p)
+            return 0;
+    set->slots[i] = p;
+    set->size++;
+    return 1;
 }
 
-cjson_value* cjson_find_object_value(cjson_value* v, const char* key, size_t klen) {
-    size_t index = cjson_find_object_index(v, key, klen);
-    return index != CJSON_KEY_NOT_EXIST ? &v->data.obj.memb[index].v : NULL;
+/* Storage reachable more than once, i.e. shared blocks, is counted the first time only. */
+static int cjson_memory_first_visit(cjson_pointer_set* seen, const void* p) {
+    return p != NULL && (!cjson_block_is_shared(p) || cjson_pointer_set_add(seen, p));
 }
 
-cjson_value* cjson_set_object_value(cjson_value* v, const char* key, size_t klen) {
-    assert(v != NULL && v->type == CJSON_OBJECT && key != NULL);
-    if (v->data.obj.size == v->data.obj.capacity)
-        cjson_reserve_object(v, v->data.obj.capacity == 0 ? 1 : v->data.obj.capacity * 2);
-    memcpy(v->data.obj.memb[v->data.obj.size].k = (char*)malloc(klen + 1), key, klen);
-    v->data.obj.memb[v->data.obj.size].k[klen] = '\0';
-    v->data.obj.memb[v->data.obj.size].klen = klen;
-    cjson_init(&(v->data.obj.memb[v->data.obj.size].v));
-    return &v->data.obj.memb[v->data.obj.size++].v;
+static size_t cjson_memory_usage_value(const cjson_value* v, cjson_pointer_set* seen) {
+    size_t size;
+    if (!cjson_memory_first_visit(seen, cjson_storage(v)))
+        return 0;
+    size = cjson_dedup_storage_size(v);
+    if (CJSON_FORM(v) == CJSON_ARRAY)
+        for (size_t i = 0; i < v->data.arr.size; ++i)
+            size += cjson_memory_usage_value(&v->data.arr.elem[i], seen);
+    else if (CJSON_IS_OBJECT(v))
+        for (size_t i = 0; i < v->data.obj.size; ++i) {
+            const cjson_member* m = &v->data.obj.memb[i];
+            if (cjson_memory_first_visit(seen, m->k))
+                size += sizeof(cjson_block) + m->klen + 1;
+            size += cjson_memory_usage_value(&m->v, seen);
+        }
+    return size;
 }
 
-void cjson_remove_object_value(cjson_value* v, size_t index) {
-    assert(v != NULL && v->type == CJSON_OBJECT && index < v->data.obj.size);
-    free(v->data.obj.memb[index].k);
-    cjson_free(&(v->data.obj.memb[index].v));
-    memmove(&v->data.obj.memb[index], &v->data.obj.memb[index+1], sizeof(cjson_member)*(v->data.obj.size-index-1));
-    v->data.obj.size--;
+size_t cjson_memory_usage(const cjson_value* v) {
+    cjson_pointer_set seen = {NULL, 0, 0};
+    size_t size;
+    assert(v != NULL);
+    size = cjson_memory_usage_value(v, &seen);
+    if (seen.slots != NULL)
+        cjson_heap_free(seen.slots, (seen.mask + 1) * sizeof(const void*));
+    return size;
 }
@@ -17,15 +17,18 @@ typedef enum {
 
 typedef struct cjson_value cjson_value;
 typedef struct cjson_member cjson_member;
+typedef struct cjson_view cjson_view;   /* read-only value inside a snapshot image */
 
 struct cjson_value {
     union {
         struct {cjson_member* memb; size_t size, capacity;} obj; /* object: members, member count, capacity */
         struct {cjson_value* elem; size_t size, capacity;} arr; /* array:  elements, element count, capacity */
-        struct {char* s; size_t len;} str;                   /* string: null-terminated string, string length */
+        struct {double* elem; size_t size, capacity;} nums;   /* packed number array: numbers, count, capacity */
+        struct {char* s; size_t len;} str;                   /* string or raw number: null-terminated text, length */
         double num;                                           /* number */
     } data;
     cjson_type type;
+    unsigned char form;     /* storage form, private to the library; data is laid out as type says only while it is 0 */
 };
 
 struct cjson_member {
@@ -47,22 +50,237 @@ enum {
     CJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
     CJSON_PARSE_MISS_KEY,
     CJSON_PARSE_MISS_COLON,
-    CJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    CJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    CJSON_PARSE_IO_ERROR,
+    CJSON_PARSE_AGAIN   /* cjson_parse_step() paused with input left */
 };
 
-#define cjson_init(v) do {(v)->type = CJSON_NULL;} while(0)
+#define CJSON_PARSE_FILE_NO_MMAP 0x1    /* read in chunks even when the file could be mapped */
+#define CJSON_PARSE_RAW_NUMBERS  0x2    /* keep number literals verbatim, decoded on first use; too-big numbers are not rejected */
+#define CJSON_PARSE_PACK_NUMBERS 0x4    /* store arrays holding only numbers as packed double[] */
+#define CJSON_PARSE_SHARE_KEYS   0x8    /* store equal keys once, so objects of one shape share their key storage */
+
+enum {
+    CJSON_STRINGIFY_OK = 0,
+    CJSON_STRINGIFY_BUFFER_TOO_SMALL,
+    CJSON_STRINGIFY_IO_ERROR
+};
+
+enum {
+    CJSON_PATCH_OK = 0,
+    CJSON_PATCH_INVALID_OPERATION,
+    CJSON_PATCH_INVALID_POINTER,
+    CJSON_PATCH_PATH_NOT_FOUND,
+    CJSON_PATCH_TEST_FAILED
+};
+
+enum {
+    CJSON_BINARY_OK = 0,
+    CJSON_BINARY_TRUNCATED,
+    CJSON_BINARY_INVALID_VALUE,
+    CJSON_BINARY_INVALID_KEY,
+    CJSON_BINARY_INVALID_NUMBER,
+    CJSON_BINARY_UNSUPPORTED_TYPE,
+    CJSON_BINARY_ROOT_NOT_SINGULAR,
+    CJSON_BINARY_TOO_DEEP
+};
+
+enum {
+    CJSON_SNAPSHOT_OK = 0,
+    CJSON_SNAPSHOT_IO_ERROR
+};
+
+#define cjson_init(v) do {(v)->type = CJSON_NULL; (v)->form = 0;} while(0)
+
+typedef struct {
+    const char* json;   /* parser input cursor */
+    char* buffer;       /* growable stack of temporaries / output bytes */
+    size_t size, top;   /* buffer capacity, bytes in use */
+    int flags;          /* CJSON_PARSE_* options of the parse in progress */
+    struct cjson_key_table* keys;   /* keys seen so far with CJSON_PARSE_SHARE_KEYS */
+} cjson_context;
+
+typedef struct {
+    size_t allocs, frees, reallocs; /* heap calls made by the library */
+    long long bytes_live;           /* bytes held; negative on a thread freeing what others allocated */
+    long long bytes_peak;           /* high-water mark of bytes_live */
+    size_t stack_peak;              /* deepest use of a cjson_context buffer */
+} cjson_stats;
+
+#define CJSON_POOL_CLASSES 6
+
+typedef struct {
+    void* free;     /* freed blocks, linked through their first word */
+    size_t size;    /* bytes per block, header included */
+    size_t live;    /* blocks handed out and not freed yet */
+} cjson_pool_class;
+
+/* Size-classed free lists for the storage of documents owned by one thread (builds with CJSON_POOL).
+ * Blocks of up to 1 KiB allocated while the pool is bound come from it and go back to it when freed,
+ * so its documents must be freed on that thread, not by cjson_free_parallel() or cjson_free_background().
+ * Everything holding its storage, documents, cjson_field_cache and cjson_stringify_cache alike, must be
+ * freed before the pool. */
+typedef struct {
+    cjson_pool_class classes[CJSON_POOL_CLASSES];  /* 32, 64, ... 1024 bytes */
+    void* slabs;            /* chunks the blocks are carved from, released by cjson_pool_free() */
+    char* next;             /* unused rest of the newest slab */
+    size_t left;
+    size_t reused, carved;  /* blocks handed out from free lists, from slabs */
+} cjson_pool;
+
+typedef enum {
+    CJSON_PHASE_WHITESPACE,
+    CJSON_PHASE_LITERAL,
+    CJSON_PHASE_NUMBER,
+    CJSON_PHASE_STRING,
+    CJSON_PHASE_ARRAY,          /* brackets, commas and element storage, not the elements */
+    CJSON_PHASE_OBJECT,         /* same for objects; keys count as CJSON_PHASE_STRING */
+    CJSON_PHASE_STRINGIFY,      /* literals and container punctuation */
+    CJSON_PHASE_STRINGIFY_NUMBER,
+    CJSON_PHASE_STRINGIFY_STRING,
+    CJSON_PHASE_COUNT
+} cjson_phase;
+
+typedef struct {
+    struct {
+        unsigned long long cycles;  /* time stamp counter ticks spent in the phase itself */
+        unsigned long long bytes;   /* input consumed (parse) or output produced (stringify) */
+        unsigned long long calls;
+    } phase[CJSON_PHASE_COUNT];
+} cjson_trace;
+
+typedef void (*cjson_trace_callback)(const char* operation, const cjson_trace* trace, size_t bytes, void* user);
+
+typedef struct {
+    cjson_value* entries;       /* open-addressing table of canonical values */
+    size_t size, capacity;      /* canonical values, table slots */
+    size_t hits;                /* values replaced by a canonical instance */
+    size_t bytes_saved;         /* storage released by those replacements */
+} cjson_dedup_pool;
+
+typedef enum {
+    CJSON_COLUMN_NUMBER,    /* double */
+    CJSON_COLUMN_INT,       /* long long, converted as cjson_get_int() does */
+    CJSON_COLUMN_STRING     /* bytes in the table's string heap */
+} cjson_column_type;
+
+typedef struct {
+    cjson_column_type type;
+    double* numbers;        /* CJSON_COLUMN_NUMBER: one per row, 0 where not valid */
+    long long* ints;        /* CJSON_COLUMN_INT: one per row, 0 where not valid */
+    size_t* offsets;        /* CJSON_COLUMN_STRING: row i is chars[offsets[i], offsets[i + 1]) */
+    const char* chars;      /* CJSON_COLUMN_STRING: this column's part of the string heap */
+    unsigned char* valid;   /* bit i % 8 of byte i / 8 set when row i holds a value of the column's type */
+} cjson_column;
+
+typedef struct {
+    cjson_column* columns;  /* in the order the fields were given */
+    size_t count, rows;     /* columns, records */
+    char* heap;             /* string bytes of all string columns, one column after another */
+    size_t heap_size;
+} cjson_columns;
+
+/* Remembers where a key was last found, for looking it up in many objects of one shape. */
+typedef struct {
+    const char* key;        /* key looked up, kept by the caller */
+    size_t klen;
+    size_t hash;
+    const char* k;          /* key storage of the last hit, referenced until cjson_field_cache_free() */
+    size_t index;           /* member index of the last hit */
+} cjson_field_cache;
+
+enum {
+    CJSON_WALK_CONTINUE = 0,
+    CJSON_WALK_SKIP,        /* from enter: do not descend into this value, nor leave it */
+    CJSON_WALK_STOP         /* end the walk */
+};
+
+/* Called for every value in document order, with its member key (NULL for array elements and
+ * the root) and its depth below the root; elements of packed arrays come as numbers. */
+typedef int (*cjson_walk_enter)(const cjson_value* v, const char* key, size_t klen, size_t depth, void* user);
+/* Called after the children of every value that enter continued on. */
+typedef int (*cjson_walk_leave)(const cjson_value* v, size_t depth, void* user);
+
+/* Text of the last cjson_stringify_cached() call and where each array and object went in it, so
+ * that the next call copies those not written since rather than generating them again. Writes are
+ * seen through pointers handed out after the last call: a pointer into the tree kept across a call
+ * must be fetched again from the root before it is written through. */
+typedef struct {
+    cjson_context out;      /* text of the last call */
+    cjson_context spare;    /* buffer the next call writes into */
+    struct cjson_stringify_slot* slots; /* arrays and objects in the text, by storage */
+    size_t size, mask;
+    size_t limit;           /* slots kept before the table is dropped and rebuilt */
+    size_t generation;      /* calls so far */
+    size_t bytes_reused;    /* bytes copied from a previous text, over all calls */
+    size_t elements_checked; /* elements of written containers compared with what they held, over all calls */
+} cjson_stringify_cache;
+
+/* Bounded LRU of parsed documents keyed by their input text, for inputs that recur byte for byte.
+ * Documents are handed out as cjson_copy_shared() copies, so writing to one unshares what it
+ * writes; the _const accessors read them without unsharing. Safe to use from several threads;
+ * each shard has its own lock. */
+typedef struct {
+    struct cjson_parse_cache_shard* shards;
+    size_t shard_count;
+    size_t capacity;                    /* documents kept per shard */
+    size_t hits, misses, evictions;     /* updated atomically */
+} cjson_parse_cache;
+
+/* Parse that pauses after a byte budget; the input must stay valid until it is done. */
+typedef struct {
+    cjson_context c;    /* input cursor and stack of pending values and open containers */
+    cjson_value* v;     /* receives the root */
+    size_t frame;       /* stack offset of the innermost open container */
+    int state;
+    int ret;            /* result once done */
+} cjson_parser;
+
+typedef struct {
+    cjson_context c;            /* output buffer, kept across resets */
+    unsigned char* stack;       /* state of each open container */
+    size_t depth, capacity;     /* open containers, stack capacity */
+} cjson_writer;
 
 int cjson_parse(cjson_value* v, const char* json);
+int cjson_parse_flags(cjson_value* v, const char* json, int flags);
+void cjson_parser_init(cjson_parser* p, cjson_value* v, const char* json, int flags);
+int cjson_parse_step(cjson_parser* p, size_t budget);
+void cjson_parser_free(cjson_parser* p);
+int cjson_parse_file(cjson_value* v, const char* path, int flags);
+void cjson_parse_cache_init(cjson_parse_cache* pc, size_t capacity, unsigned shards);
+void cjson_parse_cache_free(cjson_parse_cache* pc);
+int cjson_parse_cached(cjson_parse_cache* pc, cjson_value* v, const char* json, int flags);
 char* cjson_stringify(const cjson_value* v, size_t* length);
+size_t cjson_stringify_length(const cjson_value* v);
+int cjson_stringify_into(const cjson_value* v, char* buffer, size_t capacity, size_t* needed);
+
+void cjson_context_init(cjson_context* c);
+void cjson_context_free(cjson_context* c);
+const char* cjson_stringify_context(cjson_context* c, const cjson_value* v, size_t* length);
+void cjson_stringify_cache_init(cjson_stringify_cache* sc);
+void cjson_stringify_cache_free(cjson_stringify_cache* sc);
+const char* cjson_stringify_cached(cjson_stringify_cache* sc, const cjson_value* v, size_t* length);
+char* cjson_stringify_parallel(const cjson_value* v, size_t* length, unsigned threads);
+int cjson_stringify_parallel_fd(const cjson_value* v, int fd, unsigned threads);
 
 void cjson_copy(cjson_value* dst, const cjson_value* src);
+void cjson_copy_shared(cjson_value* dst, const cjson_value* src);
 void cjson_move(cjson_value* dst, cjson_value* src);
 void cjson_swap(cjson_value* lhs, cjson_value* rhs);
+void cjson_copy_parallel(cjson_value* dst, const cjson_value* src, unsigned threads);
+void cjson_compact(cjson_value* v);
 
 void cjson_free(cjson_value* v);
+void cjson_free_parallel(cjson_value* v, unsigned threads);
+void cjson_free_background(cjson_value* v);
+void cjson_free_background_wait(void);
 
 cjson_type cjson_get_type(const cjson_value* v);
 int cjson_is_equal(const cjson_value* lhs, const cjson_value* rhs);
+/* Cached on arrays and objects until written; pointers into v kept across a call must be fetched again before writing. */
+size_t cjson_hash(const cjson_value* v);
+int cjson_walk(const cjson_value* v, cjson_walk_enter enter, cjson_walk_leave leave, void* user);
 
 void cjson_set_null(cjson_value* v);
 
@@ -70,6 +288,8 @@ int cjson_get_boolean(const cjson_value* v);
 void cjson_set_boolean(cjson_value* v, int b);
 
 double cjson_get_number(const cjson_value* v);
+long long cjson_get_int(const cjson_value* v);
+const char* cjson_get_number_literal(const cjson_value* v, size_t* length);
 void cjson_set_number(cjson_value* v, double n);
 
 const char* cjson_get_string(const cjson_value* v);
@@ -78,12 +298,19 @@ void cjson_set_string(cjson_value* v, const char* s, size_t len);
 
 void cjson_set_array(cjson_value* v, size_t capacity);
 size_t cjson_get_array_size(const cjson_value* v);
+void cjson_set_number_array(cjson_value* v, const double* numbers, size_t count);
+int cjson_get_number_array(const cjson_value* v, const double** numbers, size_t* count);
 size_t cjson_get_array_capacity(const cjson_value* v);
 void cjson_reserve_array(cjson_value* v, size_t capacity);
 void cjson_shrink_array(cjson_value* v);
 void cjson_clear_array(cjson_value* v);
 cjson_value* cjson_get_array_element(cjson_value* v, size_t index);
+/* NULL in a packed array, see cjson_get_number_array(); cjson_get_array_number() reads both forms. */
+const cjson_value* cjson_get_array_element_const(const cjson_value* v, size_t index);
+double cjson_get_array_number(const cjson_value* v, size_t index);
+void cjson_set_array_number(cjson_value* v, size_t index, double n);
 cjson_value* cjson_pushback_array_element(cjson_value* v);
+void cjson_pushback_array_number(cjson_value* v, double n);
 void cjson_popback_array_element(cjson_value* v);
 cjson_value* cjson_insert_array_element(cjson_value* v, size_t index);
 void cjson_erase_array_element(cjson_value* v, size_t index, size_t count);
@@ -97,9 +324,81 @@ void cjson_clear_object(cjson_value* v);
 const char* cjson_get_object_key(const cjson_value* v, size_t index);
 size_t cjson_get_object_key_length(const cjson_value* v, size_t index);
 cjson_value* cjson_get_object_value(cjson_value* v, size_t index);
+const cjson_value* cjson_get_object_value_const(const cjson_value* v, size_t index);
 size_t cjson_find_object_index(const cjson_value* v, const char* key, size_t klen);
 cjson_value* cjson_find_object_value(cjson_value* v, const char* key, size_t klen);
+const cjson_value* cjson_find_object_value_const(const cjson_value* v, const char* key, size_t klen);
 cjson_value* cjson_set_object_value(cjson_value* v, const char* key, size_t klen);
+void cjson_field_cache_init(cjson_field_cache* fc, const char* key, size_t klen);
+void cjson_field_cache_free(cjson_field_cache* fc);
+size_t cjson_find_object_index_cached(const cjson_value* v, cjson_field_cache* fc);
+cjson_value* cjson_find_object_value_cached(cjson_value* v, cjson_field_cache* fc);
+const cjson_value* cjson_find_object_value_cached_const(const cjson_value* v, cjson_field_cache* fc);
 void cjson_remove_object_value(cjson_value* v, size_t index);
+void cjson_freeze(cjson_value* v);
+int cjson_is_frozen(const cjson_value* v);
+
+void cjson_writer_init(cjson_writer* w);
+void cjson_writer_reset(cjson_writer* w);
+void cjson_writer_free(cjson_writer* w);
+const char* cjson_writer_get_string(cjson_writer* w, size_t* length);
+void cjson_write_null(cjson_writer* w);
+void cjson_write_boolean(cjson_writer* w, int b);
+void cjson_write_number(cjson_writer* w, double n);
+void cjson_write_int(cjson_writer* w, long long n);
+void cjson_write_string(cjson_writer* w, const char* s, size_t len);
+void cjson_write_value(cjson_writer* w, const cjson_value* v);
+void cjson_write_begin_array(cjson_writer* w);
+void cjson_write_end_array(cjson_writer* w);
+void cjson_write_begin_object(cjson_writer* w);
+void cjson_write_key(cjson_writer* w, const char* key, size_t klen);
+void cjson_write_end_object(cjson_writer* w);
+
+void cjson_dedup_pool_init(cjson_dedup_pool* p);
+void cjson_dedup_pool_free(cjson_dedup_pool* p);
+void cjson_dedup_pool_insert(cjson_dedup_pool* p, cjson_value* v);
+void cjson_dedup_pool_trim(cjson_dedup_pool* p);
+
+void cjson_extract_columns(cjson_columns* t, const cjson_value* records, const char* const* fields, const cjson_column_type* types, size_t count);
+void cjson_columns_free(cjson_columns* t);
+
+int cjson_patch_apply(cjson_value* v, const cjson_value* patch);
+void cjson_merge_patch_apply(cjson_value* v, const cjson_value* patch);
+void cjson_diff(cjson_value* patch, const cjson_value* a, const cjson_value* b);
+
+char* cjson_to_cbor(const cjson_value* v, size_t* length);
+int cjson_from_cbor(cjson_value* v, const char* data, size_t length);
+char* cjson_to_msgpack(const cjson_value* v, size_t* length);
+int cjson_from_msgpack(cjson_value* v, const char* data, size_t length);
+
+int cjson_snapshot_write(const cjson_value* v, int fd);
+const cjson_view* cjson_snapshot_root(const void* data, size_t length);
+void cjson_copy_view(cjson_value* dst, const cjson_view* src);
+
+cjson_type cjson_view_get_type(const cjson_view* v);
+int cjson_view_get_boolean(const cjson_view* v);
+double cjson_view_get_number(const cjson_view* v);
+const char* cjson_view_get_string(const cjson_view* v);
+size_t cjson_view_get_string_length(const cjson_view* v);
+size_t cjson_view_get_array_size(const cjson_view* v);
+const cjson_view* cjson_view_get_array_element(const cjson_view* v, size_t index);
+size_t cjson_view_get_object_size(const cjson_view* v);
+const char* cjson_view_get_object_key(const cjson_view* v, size_t index);
+size_t cjson_view_get_object_key_length(const cjson_view* v, size_t index);
+const cjson_view* cjson_view_get_object_value(const cjson_view* v, size_t index);
+size_t cjson_view_find_object_index(const cjson_view* v, const char* key, size_t klen);
+const cjson_view* cjson_view_find_object_value(const cjson_view* v, const char* key, size_t klen);
+
+void cjson_get_trace(cjson_trace* t);
+void cjson_reset_trace(void);
+void cjson_set_trace_callback(cjson_trace_callback callback, void* user);
+
+void cjson_pool_init(cjson_pool* p);
+void cjson_pool_free(cjson_pool* p);   /* asserts that no block is still in use */
+void cjson_pool_bind(cjson_pool* p);
+
+void cjson_get_stats(cjson_stats* s);
+void cjson_reset_stats(void);
+size_t cjson_memory_usage(const cjson_value* v);
 
 #endif
@@ -342,6 +342,47 @@ static void test_stringify_object() {
     TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
 
+#define TEST_STRINGIFY_INTO(json)\
+    do {\
+        char buffer[sizeof(json)];\
+        size_t needed;\
+        cjson_value v;\
+        cjson_init(&v);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        EXPECT_EQ_SIZE_T(sizeof(json) - 1, cjson_stringify_length(&v));\
+        EXPECT_EQ_INT(CJSON_STRINGIFY_BUFFER_TOO_SMALL, cjson_stringify_into(&v, buffer, sizeof(json) - 1, &needed));\
+        EXPECT_EQ_SIZE_T(sizeof(json) - 1, needed);\
+        EXPECT_EQ_INT(CJSON_STRINGIFY_OK, cjson_stringify_into(&v, buffer, sizeof(buffer), &needed));\
+        EXPECT_EQ_STRING(json, buffer, needed);\
+        EXPECT_EQ_INT('\0', buffer[needed]);\
+        cjson_free(&v);\
+    } while(0)
+
+static void test_stringify_into() {
+    cjson_context c;
+    cjson_value v;
+    const char* json;
+    size_t len;
+
+    TEST_STRINGIFY_INTO("null");
+    TEST_STRINGIFY_INTO("-1.234e-20");
+    TEST_STRINGIFY_INTO("\"\\\" \\\\ / \\b \\f \\n \\r \\t \\u0001\"");
+    TEST_STRINGIFY_INTO("[]");
+    TEST_STRINGIFY_INTO("{}");
+    TEST_STRINGIFY_INTO("[null,false,true,123,\"abc\",[1,2,3]]");
+    TEST_STRINGIFY_INTO("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+
+    cjson_context_init(&c);
+    cjson_init(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "[1,\"abc\",{\"a\":[]}]"));
+    json = cjson_stringify_context(&c, &v, &len);
+    EXPECT_EQ_STRING("[1,\"abc\",{\"a\":[]}]", json, len);
+    json = cjson_stringify_context(&c, &v, &len);   /* buffer is reused */
+    EXPECT_EQ_STRING("[1,\"abc\",{\"a\":[]}]", json, len);
+    cjson_free(&v);
+    cjson_context_free(&c);
+}
+
 static void test_stringify() {
     TEST_ROUNDTRIP("null");
     TEST_ROUNDTRIP("false");
@@ -350,6 +391,7 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_into();
 }
 
 #define TEST_EQUAL(json1, json2, equality) \
@@ -390,6 +432,101 @@ static void test_equal() {
     TEST_EQUAL("{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":[]}}}", 0);
 }
 
+static void test_equal_large_object() {
+    cjson_value v1, v2;
+    char key[4] = "k00";
+    cjson_init(&v1);
+    cjson_init(&v2);
+    cjson_set_object(&v1, 0);
+    cjson_set_object(&v2, 0);
+    for (int i = 0; i < 40; i++) {
+        key[1] = '0' + i / 10;
+        key[2] = '0' + i % 10;
+        cjson_set_number(cjson_set_object_value(&v1, key, 3), i);
+        key[1] = '0' + (39 - i) / 10;
+        key[2] = '0' + (39 - i) % 10;
+        cjson_set_number(cjson_set_object_value(&v2, key, 3), 39 - i);
+    }
+    EXPECT_TRUE(cjson_is_equal(&v1, &v2));
+    EXPECT_TRUE(cjson_hash(&v1) == cjson_hash(&v2));
+    EXPECT_TRUE(cjson_is_equal(&v1, &v2));  /* with cached hashes */
+    cjson_set_number(cjson_find_object_value(&v2, "k17", 3), -1);
+    EXPECT_FALSE(cjson_is_equal(&v1, &v2));
+    cjson_remove_object_value(&v2, cjson_find_object_index(&v2, "k17", 3));
+    cjson_set_number(cjson_set_object_value(&v2, "k40", 3), 17);
+    EXPECT_FALSE(cjson_is_equal(&v1, &v2));
+    cjson_free(&v1);
+    cjson_free(&v2);
+}
+
+#define TEST_HASH(json1, json2, equality) \
+    do {\
+        cjson_value v1, v2;\
+        cjson_init(&v1);\
+        cjson_init(&v2);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, json1));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, json2));\
+        EXPECT_EQ_INT(equality, cjson_hash(&v1) == cjson_hash(&v2));\
+        cjson_free(&v1);\
+        cjson_free(&v2);\
+    } while(0)
+
+static void test_hash() {
+    cjson_value v1, v2;
+    size_t h;
+
+    TEST_HASH("null", "null", 1);
+    TEST_HASH("null", "false", 0);
+    TEST_HASH("0", "-0", 1);
+    TEST_HASH("1.5", "1.5", 1);
+    TEST_HASH("1.5", "2.5", 0);
+    TEST_HASH("\"abc\"", "\"abc\"", 1);
+    TEST_HASH("\"abc\"", "\"abd\"", 0);
+    TEST_HASH("[1,2,3]", "[1,2,3]", 1);
+    TEST_HASH("[1,2,3]", "[3,2,1]", 0);
+    TEST_HASH("[]", "{}", 0);
+    TEST_HASH("{\"a\":1,\"b\":[true]}", "{\"b\":[true],\"a\":1}", 1);
+    TEST_HASH("{\"a\":1,\"b\":2}", "{\"a\":2,\"b\":1}", 0);
+
+    /* cached hashes are dropped by writes, including writes to children */
+    cjson_init(&v1);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "{\"a\":{\"b\":[1,2]},\"c\":\"d\"}"));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "{\"a\":{\"b\":[1,3]},\"c\":\"d\"}"));
+    h = cjson_hash(&v1);
+    EXPECT_TRUE(h != cjson_hash(&v2));
+    cjson_set_number(cjson_get_array_element(cjson_find_object_value(cjson_find_object_value(&v1, "a", 1), "b", 1), 1), 3);
+    EXPECT_TRUE(h != cjson_hash(&v1));
+    EXPECT_TRUE(cjson_hash(&v1) == cjson_hash(&v2));
+    EXPECT_TRUE(cjson_is_equal(&v1, &v2));
+    cjson_free(&v1);
+    cjson_free(&v2);
+
+    /* and cached again once computed after a write, so that pointers kept across a hash write unseen */
+    {
+        cjson_value* x;
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "{\"x\":1,\"y\":[1,2]}"));
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "{\"x\":2,\"y\":[1,2]}"));
+        EXPECT_TRUE(cjson_hash(&v1) != cjson_hash(&v2));
+        cjson_set_number(cjson_find_object_value(&v1, "x", 1), 2);
+        EXPECT_TRUE(cjson_hash(&v1) == cjson_hash(&v2));
+        EXPECT_TRUE(cjson_is_equal(&v1, &v2));
+        cjson_set_number(cjson_pushback_array_element(cjson_find_object_value(&v1, "y", 1)), 3);
+        x = cjson_pushback_array_element(cjson_find_object_value(&v2, "y", 1));
+        cjson_set_number(x, 3);
+        h = cjson_hash(&v2);
+        EXPECT_TRUE(cjson_hash(&v1) == h);
+        EXPECT_TRUE(cjson_is_equal(&v1, &v2));
+        cjson_set_number(x, 4);     /* x was not fetched again */
+        EXPECT_TRUE(cjson_hash(&v2) == h);
+        cjson_set_number(cjson_get_array_element(cjson_find_object_value(&v2, "y", 1), 2), 4);
+        EXPECT_TRUE(cjson_hash(&v2) != h);
+        EXPECT_FALSE(cjson_is_equal(&v1, &v2));
+        cjson_free(&v1);
+        cjson_free(&v2);
+    }
+}
+
 static void test_copy() {
     cjson_value v1, v2;
     cjson_init(&v1);
@@ -401,6 +538,1703 @@ static void test_copy() {
     cjson_free(&v2);
 }
 
+static void test_copy_shared() {
+    cjson_value v1, v2, *a1, *a2;
+    const cjson_value* c1, *c2;
+    cjson_field_cache fc;
+    cjson_init(&v1);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "{\"s\":\"abc\",\"a\":{\"x\":\"y\"},\"b\":[1,2,[3]]}"));
+    cjson_copy_shared(&v2, &v1);
+    EXPECT_TRUE(cjson_is_equal(&v2, &v1));
+
+    /* reading through the const accessors leaves everything shared */
+    c1 = cjson_get_array_element_const(cjson_find_object_value_const(&v1, "b", 1), 2);
+    c2 = cjson_get_array_element_const(cjson_find_object_value_const(&v2, "b", 1), 2);
+    EXPECT_TRUE(c1 == c2);
+    EXPECT_TRUE(cjson_get_object_value_const(&v1, 1) == cjson_get_object_value_const(&v2, 1));
+    cjson_field_cache_init(&fc, "x", 1);
+    c1 = cjson_find_object_value_cached_const(cjson_find_object_value_const(&v1, "a", 1), &fc);
+    c2 = cjson_find_object_value_cached_const(cjson_find_object_value_const(&v2, "a", 1), &fc);
+    EXPECT_TRUE(c1 != NULL && c1 == c2);
+    EXPECT_TRUE(cjson_find_object_value_const(&v1, "z", 1) == NULL);
+    cjson_field_cache_free(&fc);
+
+    /* writing through the copy leaves the original untouched */
+    cjson_pushback_array_element(cjson_get_array_element(cjson_find_object_value(&v2, "b", 1), 2));
+    cjson_set_number(cjson_find_object_value(&v2, "s", 1), 1.0);
+    EXPECT_FALSE(cjson_is_equal(&v2, &v1));
+    EXPECT_EQ_SIZE_T(2, cjson_get_array_size(cjson_get_array_element(cjson_find_object_value(&v2, "b", 1), 2)));
+    EXPECT_EQ_SIZE_T(1, cjson_get_array_size(cjson_get_array_element(cjson_find_object_value(&v1, "b", 1), 2)));
+    EXPECT_EQ_STRING("abc", cjson_get_string(cjson_find_object_value(&v1, "s", 1)), 3);
+
+    /* untouched subtrees are still shared */
+    a1 = cjson_find_object_value(cjson_find_object_value(&v1, "a", 1), "x", 1);
+    a2 = cjson_find_object_value(cjson_find_object_value(&v2, "a", 1), "x", 1);
+    EXPECT_TRUE(a1 != a2);
+    EXPECT_TRUE(cjson_get_string(a1) == cjson_get_string(a2));
+
+    cjson_free(&v1);
+    EXPECT_EQ_STRING("y", cjson_get_string(a2), cjson_get_string_length(a2));
+    cjson_free(&v2);
+}
+
+static void test_dedup_pool() {
+    cjson_dedup_pool p;
+    cjson_value v1, v2, *a1, *a2;
+    cjson_dedup_pool_init(&p);
+    cjson_init(&v1);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "[{\"meta\":{\"kind\":\"enum\",\"v\":[1,2]}},\"enum\",{\"kind\":1}]"));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "{\"meta\":{\"kind\":\"enum\",\"v\":[1,2]},\"x\":\"enum\"}"));
+    cjson_dedup_pool_insert(&p, &v1);
+    EXPECT_TRUE(p.hits > 0);    /* "enum" string and "kind" key repeat within v1 */
+    cjson_dedup_pool_insert(&p, &v2);
+    EXPECT_TRUE(p.bytes_saved > 0);
+
+    a1 = cjson_find_object_value(cjson_get_array_element(&v1, 0), "meta", 4);
+    a2 = cjson_find_object_value(&v2, "meta", 4);
+    EXPECT_TRUE(cjson_is_equal(a1, a2));
+    EXPECT_TRUE(cjson_get_string(cjson_get_array_element(&v1, 1)) == cjson_get_string(cjson_find_object_value(&v2, "x", 1)));
+    EXPECT_TRUE(cjson_get_object_key(cjson_get_array_element(&v1, 2), 0) == cjson_get_object_key(a1, 0));
+
+    /* shared instances stay copy-on-write */
+    cjson_set_null(cjson_find_object_value(a2, "kind", 4));
+    EXPECT_FALSE(cjson_is_equal(a1, a2));
+    EXPECT_EQ_STRING("enum", cjson_get_string(cjson_find_object_value(a1, "kind", 4)), 4);
+
+    cjson_free(&v1);
+    cjson_free(&v2);
+    cjson_dedup_pool_trim(&p);
+    EXPECT_EQ_SIZE_T(0, p.size);
+
+    /* only byte-identical subtrees merge: member order, -0 and number spelling are kept */
+    {
+        char* out;
+        size_t saved;
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "[{\"a\":1,\"b\":\"s\"},[-0,\"t\"]]"));
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "[{\"b\":\"s\",\"a\":1},[0,\"t\"]]"));
+        cjson_dedup_pool_insert(&p, &v1);
+        cjson_dedup_pool_insert(&p, &v2);
+        out = cjson_stringify(&v2, NULL);
+        EXPECT_TRUE(strcmp("[{\"b\":\"s\",\"a\":1},[0,\"t\"]]", out) == 0);
+        free(out);
+        out = cjson_stringify(&v1, NULL);
+        EXPECT_TRUE(strcmp("[{\"a\":1,\"b\":\"s\"},[-0,\"t\"]]", out) == 0);
+        free(out);
+        cjson_free(&v1);
+        cjson_free(&v2);
+
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v1, "[[1.0,\"q\"]]", CJSON_PARSE_RAW_NUMBERS));
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v2, "[[1,\"q\"]]", CJSON_PARSE_RAW_NUMBERS));
+        cjson_dedup_pool_insert(&p, &v1);
+        cjson_dedup_pool_insert(&p, &v2);
+        out = cjson_stringify(&v2, NULL);
+        EXPECT_TRUE(strcmp("[[1,\"q\"]]", out) == 0);
+        free(out);
+        cjson_free(&v2);
+
+        /* identical documents still collapse onto one instance */
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v2, "[[1.0,\"q\"]]", CJSON_PARSE_RAW_NUMBERS));
+        saved = p.bytes_saved;
+        cjson_dedup_pool_insert(&p, &v2);
+        EXPECT_TRUE(p.bytes_saved > saved);
+        EXPECT_TRUE(cjson_is_equal(&v1, &v2));
+        cjson_free(&v1);
+        cjson_free(&v2);
+    }
+    cjson_dedup_pool_free(&p);
+}
+
+#define TEST_PATCH(expect, json, patch_json, error) \
+    do {\
+        cjson_value v, patch, e;\
+        cjson_init(&v);\
+        cjson_init(&patch);\
+        cjson_init(&e);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&patch, patch_json));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&e, expect));\
+        EXPECT_EQ_INT(error, cjson_patch_apply(&v, &patch));\
+        EXPECT_TRUE(cjson_is_equal(&e, &v));\
+        cjson_free(&v);\
+        cjson_free(&patch);\
+        cjson_free(&e);\
+    } while(0)
+
+static void test_patch() {
+    /* RFC 6902, appendix A */
+    TEST_PATCH("{\"baz\":\"qux\",\"foo\":\"bar\"}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":[\"bar\",\"baz\"]}", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"baz\":\"boo\",\"foo\":\"bar\"}", "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+        "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+        "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+        "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+        "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]", CJSON_PATCH_OK);
+    TEST_PATCH("{\"/\":9,\"~1\":10,\"x\":10}", "{\"/\":9,\"~1\":10}", "[{\"op\":\"copy\",\"from\":\"/~01\",\"path\":\"/x\"}]", CJSON_PATCH_OK);
+    TEST_PATCH("[1]", "{}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]", CJSON_PATCH_OK);
+
+    /* a failing patch leaves the document unchanged */
+    TEST_PATCH("{\"baz\":\"qux\"}", "{\"baz\":\"qux\"}", "[{\"op\":\"add\",\"path\":\"/a\",\"value\":1},{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", CJSON_PATCH_TEST_FAILED);
+    TEST_PATCH("{\"foo\":\"bar\"}", "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", CJSON_PATCH_PATH_NOT_FOUND);
+    TEST_PATCH("[1,2]", "[1,2]", "[{\"op\":\"remove\",\"path\":\"/01\"}]", CJSON_PATCH_PATH_NOT_FOUND);
+    TEST_PATCH("[1,2]", "[1,2]", "[{\"op\":\"add\",\"path\":\"/3\",\"value\":3}]", CJSON_PATCH_PATH_NOT_FOUND);
+    TEST_PATCH("{\"a\":1}", "{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"a\"}]", CJSON_PATCH_INVALID_POINTER);
+    TEST_PATCH("{\"a\":1}", "{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"/~2\"}]", CJSON_PATCH_INVALID_POINTER);
+    TEST_PATCH("{\"a\":1}", "{\"a\":1}", "[{\"op\":\"frob\",\"path\":\"/a\"}]", CJSON_PATCH_INVALID_OPERATION);
+    TEST_PATCH("{\"a\":1}", "{\"a\":1}", "[{\"op\":\"add\",\"path\":\"/b\"}]", CJSON_PATCH_INVALID_OPERATION);
+    TEST_PATCH("{\"a\":{\"b\":1}}", "{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/c\"}]", CJSON_PATCH_INVALID_OPERATION);
+}
+
+#define TEST_MERGE_PATCH(expect, json, patch_json) \
+    do {\
+        cjson_value v, patch, e;\
+        cjson_init(&v);\
+        cjson_init(&patch);\
+        cjson_init(&e);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&patch, patch_json));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&e, expect));\
+        cjson_merge_patch_apply(&v, &patch);\
+        EXPECT_TRUE(cjson_is_equal(&e, &v));\
+        cjson_free(&v);\
+        cjson_free(&patch);\
+        cjson_free(&e);\
+    } while(0)
+
+static void test_merge_patch() {
+    /* RFC 7386, appendix A */
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":[\"b\"]}");
+    TEST_MERGE_PATCH("{\"a\":{\"b\":\"d\"}}", "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}");
+    TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("[\"c\",\"d\"]", "[\"a\",\"b\"]", "[\"c\",\"d\"]");
+    TEST_MERGE_PATCH("[\"c\"]", "{\"a\":\"b\"}", "[\"c\"]");
+    TEST_MERGE_PATCH("null", "{\"a\":\"foo\"}", "null");
+    TEST_MERGE_PATCH("\"bar\"", "{\"a\":\"foo\"}", "\"bar\"");
+    TEST_MERGE_PATCH("{\"e\":null,\"a\":1}", "{\"e\":null}", "{\"a\":1}");
+    TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}");
+}
+
+#define TEST_DIFF(json1, json2, operations) \
+    do {\
+        cjson_value v1, v2, patch;\
+        cjson_init(&v1);\
+        cjson_init(&v2);\
+        cjson_init(&patch);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, json1));\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, json2));\
+        cjson_diff(&patch, &v1, &v2);\
+        EXPECT_EQ_SIZE_T(operations, cjson_get_array_size(&patch));\
+        EXPECT_EQ_INT(CJSON_PATCH_OK, cjson_patch_apply(&v1, &patch));\
+        EXPECT_TRUE(cjson_is_equal(&v1, &v2));\
+        cjson_free(&v1);\
+        cjson_free(&v2);\
+        cjson_free(&patch);\
+    } while(0)
+
+static void test_diff() {
+    cjson_value v1, v2, patch;
+    char* json;
+    size_t len;
+
+    TEST_DIFF("null", "null", 0);
+    TEST_DIFF("null", "1", 1);
+    TEST_DIFF("{\"a\":1,\"b\":[1,2]}", "{\"b\":[1,2],\"a\":1}", 0);
+    TEST_DIFF("{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":3}", 2);
+    TEST_DIFF("{\"a/b\":{\"~\":1}}", "{\"a/b\":{\"~\":2}}", 1);
+    TEST_DIFF("[1,2,3,4,5]", "[1,2,9,3,4,5]", 1);
+    TEST_DIFF("[1,2,3,4,5]", "[1,2,4,5]", 1);
+    TEST_DIFF("[1,2,3,4,5]", "[1,7,8,5]", 3);
+    TEST_DIFF("[[1,{\"x\":[]}],2]", "[[1,{\"x\":[0]}],2,3]", 2);
+    TEST_DIFF("{\"a\":[1,2]}", "{\"a\":{\"0\":1}}", 1);
+    TEST_DIFF("{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19}",
+        "{\"k20\":20,\"k19\":19,\"k18\":18,\"k17\":17,\"k16\":16,\"k15\":15,\"k14\":14,\"k13\":13,\"k12\":12,\"k11\":11,\"k10\":10,\"k9\":9,\"k8\":8,\"k7\":70,\"k6\":6,\"k5\":5,\"k4\":4,\"k3\":3,\"k2\":2,\"k1\":1}", 3);
+
+    cjson_init(&v1);
+    cjson_init(&v2);
+    cjson_init(&patch);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v1, "{\"cfg\":{\"a\":[1,2,3],\"b\":{\"c\":\"d\"}},\"n\":1}"));
+    cjson_copy_shared(&v2, &v1);
+    cjson_set_string(cjson_find_object_value(cjson_find_object_value(cjson_find_object_value(&v2, "cfg", 3), "b", 1), "c", 1), "e", 1);
+    cjson_diff(&patch, &v1, &v2);
+    json = cjson_stringify(&patch, &len);
+    EXPECT_EQ_STRING("[{\"op\":\"replace\",\"path\":\"/cfg/b/c\",\"value\":\"e\"}]", json, len);
+    free(json);
+    cjson_free(&v1);
+    cjson_free(&v2);
+    cjson_free(&patch);
+}
+
+#define TEST_BINARY(encode, decode, json, bytes) \
+    do {\
+        cjson_value v, v2;\
+        char* data;\
+        size_t length;\
+        cjson_init(&v);\
+        cjson_init(&v2);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        data = encode(&v, &length);\
+        EXPECT_EQ_SIZE_T(sizeof(bytes) - 1, length);\
+        EXPECT_TRUE(length == sizeof(bytes) - 1 && memcmp(bytes, data, length) == 0);\
+        EXPECT_EQ_INT(CJSON_BINARY_OK, decode(&v2, data, length));\
+        EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+        free(data);\
+        cjson_free(&v);\
+        cjson_free(&v2);\
+    } while(0)
+
+#define TEST_BINARY_DECODE(decode, json, bytes) \
+    do {\
+        cjson_value v, v2;\
+        cjson_init(&v);\
+        cjson_init(&v2);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        EXPECT_EQ_INT(CJSON_BINARY_OK, decode(&v2, bytes, sizeof(bytes) - 1));\
+        EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+        cjson_free(&v);\
+        cjson_free(&v2);\
+    } while(0)
+
+#define TEST_BINARY_ERROR(decode, error, bytes) \
+    do {\
+        cjson_value v;\
+        cjson_init(&v);\
+        EXPECT_EQ_INT(error, decode(&v, bytes, sizeof(bytes) - 1));\
+        EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v));\
+        cjson_free(&v);\
+    } while(0)
+
+/* count copies of the head bytes of a container or tag, then tail */
+static int test_binary_nested(int (*decode)(cjson_value*, const char*, size_t), const char* head, size_t count, const char* tail) {
+    size_t hlen = strlen(head), tlen = strlen(tail);
+    char* data = (char*)malloc(hlen * count + tlen);
+    cjson_value v;
+    int ret;
+    for (size_t i = 0; i < count; i++)
+        memcpy(data + i * hlen, head, hlen);
+    memcpy(data + hlen * count, tail, tlen);
+    cjson_init(&v);
+    ret = decode(&v, data, hlen * count + tlen);
+    if (ret != CJSON_BINARY_OK)
+        EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v));
+    cjson_free(&v);
+    free(data);
+    return ret;
+}
+
+static void test_cbor() {
+    /* RFC 8949, appendix A */
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "0", "\x00");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "23", "\x17");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "24", "\x18\x18");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1000", "\x19\x03\xe8");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1000000", "\x1a\x00\x0f\x42\x40");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1000000000000", "\x1b\x00\x00\x00\xe8\xd4\xa5\x10\x00");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "18446744073709549568", "\x1b\xff\xff\xff\xff\xff\xff\xf8\x00");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "-1", "\x20");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "-100", "\x38\x63");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "-1000", "\x39\x03\xe7");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1.1", "\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "-0.0", "\xfb\x80\x00\x00\x00\x00\x00\x00\x00");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1e300", "\xfb\x7e\x37\xe4\x3c\x88\x00\x75\x9c");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "1e20", "\xfb\x44\x15\xaf\x1d\x78\xb5\x8c\x40");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "false", "\xf4");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "true", "\xf5");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "null", "\xf6");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "\"\"", "\x60");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "\"IETF\"", "\x64IETF");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "\"\\u00fc\"", "\x62\xc3\xbc");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "\"a\\u0000b\"", "\x63" "a\0b");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "[]", "\x80");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "[1,[2,3],[4,5]]", "\x83\x01\x82\x02\x03\x82\x04\x05");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "{}", "\xa0");
+    TEST_BINARY(cjson_to_cbor, cjson_from_cbor, "{\"a\":1,\"b\":[2,3]}", "\xa2\x61" "a\x01\x61" "b\x82\x02\x03");
+
+    TEST_BINARY_DECODE(cjson_from_cbor, "1.5", "\xf9\x3e\x00");
+    TEST_BINARY_DECODE(cjson_from_cbor, "65504", "\xf9\x7b\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "-0.0", "\xf9\x80\x00");
+    TEST_BINARY_DECODE(cjson_from_cbor, "5.960464477539063e-8", "\xf9\x00\x01");
+    TEST_BINARY_DECODE(cjson_from_cbor, "100000.0", "\xfa\x47\xc3\x50\x00");
+    TEST_BINARY_DECODE(cjson_from_cbor, "-18446744073709551616", "\x3b\xff\xff\xff\xff\xff\xff\xff\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "1363896240", "\xc1\x1a\x51\x4b\x67\xb0");
+    TEST_BINARY_DECODE(cjson_from_cbor, "null", "\xf7");
+    TEST_BINARY_DECODE(cjson_from_cbor, "\"streaming\"", "\x7f\x65strea\x64ming\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "\"\"", "\x7f\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "[]", "\x9f\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "[1,[2,3],[4,5]]", "\x9f\x01\x82\x02\x03\x9f\x04\x05\xff\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "{\"Fun\":true,\"Amt\":-2}", "\xbf\x63" "Fun\xf5\x63" "Amt\x21\xff");
+    TEST_BINARY_DECODE(cjson_from_cbor, "{\"ab\":[]}", "\xbf\x7f\x61" "a\x61" "b\xff\x80\xff");
+
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\x19\x03");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\x64IET");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\x83\x01\x02");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\x9b\xff\xff\xff\xff\xff\xff\xff\xff\x01");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\x9f\x01\x02");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_TRUNCATED, "\xa1\x61" "a");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_VALUE, "\x1c");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_VALUE, "\x1f");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_VALUE, "\xff");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_VALUE, "\x7f\x01\xff");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_VALUE, "\x82\x01\xff");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_KEY, "\xa1\x01\x02");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_NUMBER, "\xf9\x7c\x00");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_INVALID_NUMBER, "\xfb\x7f\xf8\x00\x00\x00\x00\x00\x00");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_UNSUPPORTED_TYPE, "\x44\x01\x02\x03\x04");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_UNSUPPORTED_TYPE, "\xf0");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_UNSUPPORTED_TYPE, "\x82\x01\xf8\xff");
+    TEST_BINARY_ERROR(cjson_from_cbor, CJSON_BINARY_ROOT_NOT_SINGULAR, "\x01\x02");
+    /* nesting is capped rather than recursed into until the stack runs out */
+    EXPECT_EQ_INT(CJSON_BINARY_OK, test_binary_nested(cjson_from_cbor, "\x81", 1000, "\x01"));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_cbor, "\x81", 1001, "\x01"));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_cbor, "\x81", 2 << 20, ""));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_cbor, "\xa1\x60", 1 << 20, ""));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_cbor, "\x81\xc6", 1 << 20, ""));
+}
+
+static void test_msgpack() {
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "0", "\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "127", "\x7f");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "128", "\xcc\x80");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "256", "\xcd\x01\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "65536", "\xce\x00\x01\x00\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "4294967296", "\xcf\x00\x00\x00\x01\x00\x00\x00\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-1", "\xff");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-32", "\xe0");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-33", "\xd0\xdf");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-129", "\xd1\xff\x7f");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-32769", "\xd2\xff\xff\x7f\xff");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-2147483649", "\xd3\xff\xff\xff\xff\x7f\xff\xff\xff");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-9223372036854775808", "\xd3\x80\x00\x00\x00\x00\x00\x00\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "-1e19", "\xcb\xc3\xe1\x58\xe4\x60\x91\x3d\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "1.5", "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "null", "\xc0");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "false", "\xc2");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "true", "\xc3");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "\"\"", "\xa0");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "\"abc\"", "\xa3" "abc");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "\"0123456789abcdef0123456789abcdef\"", "\xd9\x20" "0123456789abcdef0123456789abcdef");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "[]", "\x90");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "[1,[2,3]]", "\x92\x01\x92\x02\x03");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]",
+        "\xdc\x00\x10\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "{}", "\x80");
+    TEST_BINARY(cjson_to_msgpack, cjson_from_msgpack, "{\"a\":1,\"b\":[2,3]}", "\x82\xa1" "a\x01\xa1" "b\x92\x02\x03");
+
+    TEST_BINARY_DECODE(cjson_from_msgpack, "1.5", "\xca\x3f\xc0\x00\x00");
+    TEST_BINARY_DECODE(cjson_from_msgpack, "1", "\xcf\x00\x00\x00\x00\x00\x00\x00\x01");
+    TEST_BINARY_DECODE(cjson_from_msgpack, "-1", "\xd3\xff\xff\xff\xff\xff\xff\xff\xff");
+    TEST_BINARY_DECODE(cjson_from_msgpack, "\"ab\"", "\xdb\x00\x00\x00\x02" "ab");
+    TEST_BINARY_DECODE(cjson_from_msgpack, "[1]", "\xdd\x00\x00\x00\x01\x01");
+    TEST_BINARY_DECODE(cjson_from_msgpack, "{\"a\":null}", "\xde\x00\x01\xa1" "a\xc0");
+
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "\xcd\x01");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "\xa3" "ab");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "\x93\x01\x02");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "\xdd\xff\xff\xff\xff\x01");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_TRUNCATED, "\x81\xa1" "a");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_INVALID_VALUE, "\xc1");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_INVALID_KEY, "\x81\x01\x02");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_INVALID_NUMBER, "\xca\x7f\xc0\x00\x00");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_UNSUPPORTED_TYPE, "\xc4\x01\x00");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_UNSUPPORTED_TYPE, "\xd4\x01\x00");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_UNSUPPORTED_TYPE, "\x92\x01\xc7\x00\x01");
+    TEST_BINARY_ERROR(cjson_from_msgpack, CJSON_BINARY_ROOT_NOT_SINGULAR, "\xc0\xc0");
+    EXPECT_EQ_INT(CJSON_BINARY_OK, test_binary_nested(cjson_from_msgpack, "\x91", 1000, "\x01"));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_msgpack, "\x91", 2 << 20, ""));
+    EXPECT_EQ_INT(CJSON_BINARY_TOO_DEEP, test_binary_nested(cjson_from_msgpack, "\x81\xa0", 1 << 20, ""));
+}
+
+static void test_binary_roundtrip() {
+    const char* json = "{\"id\":12345,\"name\":\"sensor \\\"7\\\"\",\"ok\":true,\"ratio\":0.25,\"neg\":-70000,"
+        "\"tags\":[\"a\",\"b\",null,false],\"nested\":{\"empty\":{},\"list\":[[],[1.5e-10,-0.5]]}}";
+    cjson_value v, v2;
+    char* data;
+    size_t length;
+    cjson_init(&v);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));
+    data = cjson_to_cbor(&v, &length);
+    EXPECT_TRUE(length < strlen(json));
+    EXPECT_EQ_INT(CJSON_BINARY_OK, cjson_from_cbor(&v2, data, length));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    free(data);
+    cjson_free(&v2);
+    data = cjson_to_msgpack(&v, &length);
+    EXPECT_TRUE(length < strlen(json));
+    EXPECT_EQ_INT(CJSON_BINARY_OK, cjson_from_msgpack(&v2, data, length));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    free(data);
+    cjson_free(&v);
+    cjson_free(&v2);
+}
+
+/* Writes v through a temporary file and reads the image back into a heap buffer. */
+static char* snapshot_image(const cjson_value* v, size_t* length) {
+    FILE* fp = tmpfile();
+    char* data;
+    EXPECT_TRUE(fp != NULL);
+    EXPECT_EQ_INT(CJSON_SNAPSHOT_OK, cjson_snapshot_write(v, fileno(fp)));
+    fseek(fp, 0, SEEK_END);
+    *length = (size_t)ftell(fp);
+    rewind(fp);
+    data = (char*)malloc(*length);
+    EXPECT_EQ_SIZE_T(*length, fread(data, 1, *length, fp));
+    fclose(fp);
+    return data;
+}
+
+#define TEST_SNAPSHOT_ROUNDTRIP(json) \
+    do {\
+        cjson_value v, v2;\
+        char* data;\
+        size_t length;\
+        cjson_init(&v);\
+        cjson_init(&v2);\
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));\
+        data = snapshot_image(&v, &length);\
+        EXPECT_TRUE(cjson_snapshot_root(data, length) != NULL);\
+        cjson_copy_view(&v2, cjson_snapshot_root(data, length));\
+        EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+        free(data);\
+        cjson_free(&v);\
+        cjson_free(&v2);\
+    } while(0)
+
+static void test_snapshot() {
+    const char* json = "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"z\":\"a\\u0000b\","
+        "\"a\":[1,2,[3,{\"x\":\"y\"}]],\"o\":{\"zz\":1,\"b\":2,\"a\":3,\"\":4,\"ab\":5,\"b\":6}}";
+    cjson_value v;
+    const cjson_view *root, *e;
+    char* data;
+    size_t length;
+
+    TEST_SNAPSHOT_ROUNDTRIP("null");
+    TEST_SNAPSHOT_ROUNDTRIP("-0.5");
+    TEST_SNAPSHOT_ROUNDTRIP("\"\"");
+    TEST_SNAPSHOT_ROUNDTRIP("[]");
+    TEST_SNAPSHOT_ROUNDTRIP("{}");
+    TEST_SNAPSHOT_ROUNDTRIP("[[[[]]],{\"a\":{\"b\":{}}}]");
+
+    cjson_init(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));
+    data = snapshot_image(&v, &length);
+    root = cjson_snapshot_root(data, length);
+    EXPECT_TRUE(root != NULL);
+    EXPECT_EQ_INT(CJSON_OBJECT, cjson_view_get_type(root));
+    EXPECT_EQ_SIZE_T(8, cjson_view_get_object_size(root));
+    EXPECT_EQ_STRING("n", cjson_view_get_object_key(root, 0), cjson_view_get_object_key_length(root, 0));
+    EXPECT_EQ_STRING("o", cjson_view_get_object_key(root, 7), cjson_view_get_object_key_length(root, 7));
+    EXPECT_EQ_INT(CJSON_NULL, cjson_view_get_type(cjson_view_get_object_value(root, 0)));
+    EXPECT_FALSE(cjson_view_get_boolean(cjson_view_find_object_value(root, "f", 1)));
+    EXPECT_TRUE(cjson_view_get_boolean(cjson_view_find_object_value(root, "t", 1)));
+    EXPECT_EQ_DOUBLE(123.0, cjson_view_get_number(cjson_view_find_object_value(root, "i", 1)));
+    e = cjson_view_find_object_value(root, "s", 1);
+    EXPECT_EQ_STRING("abc", cjson_view_get_string(e), cjson_view_get_string_length(e));
+    EXPECT_EQ_INT('\0', cjson_view_get_string(e)[3]);
+    e = cjson_view_find_object_value(root, "z", 1);
+    EXPECT_EQ_STRING("a\0b", cjson_view_get_string(e), cjson_view_get_string_length(e));
+    e = cjson_view_find_object_value(root, "a", 1);
+    EXPECT_EQ_SIZE_T(3, cjson_view_get_array_size(e));
+    EXPECT_EQ_DOUBLE(2.0, cjson_view_get_number(cjson_view_get_array_element(e, 1)));
+    e = cjson_view_get_array_element(cjson_view_get_array_element(e, 2), 1);
+    e = cjson_view_find_object_value(e, "x", 1);
+    EXPECT_EQ_STRING("y", cjson_view_get_string(e), cjson_view_get_string_length(e));
+
+    e = cjson_view_find_object_value(root, "o", 1);
+    EXPECT_EQ_SIZE_T(0, cjson_view_find_object_index(e, "zz", 2));
+    EXPECT_EQ_SIZE_T(1, cjson_view_find_object_index(e, "b", 1));
+    EXPECT_EQ_SIZE_T(2, cjson_view_find_object_index(e, "a", 1));
+    EXPECT_EQ_SIZE_T(3, cjson_view_find_object_index(e, "", 0));
+    EXPECT_EQ_SIZE_T(4, cjson_view_find_object_index(e, "ab", 2));
+    EXPECT_EQ_SIZE_T(CJSON_KEY_NOT_EXIST, cjson_view_find_object_index(e, "z", 1));
+    EXPECT_EQ_SIZE_T(CJSON_KEY_NOT_EXIST, cjson_view_find_object_index(e, "zzz", 3));
+    EXPECT_TRUE(cjson_view_find_object_value(root, "missing", 7) == NULL);
+
+    EXPECT_TRUE(cjson_snapshot_root(data, length - 8) == NULL);
+    EXPECT_TRUE(cjson_snapshot_root(data, 16) == NULL);
+    data[0] = 'X';
+    EXPECT_TRUE(cjson_snapshot_root(data, length) == NULL);
+    free(data);
+    cjson_free(&v);
+}
+
+static void write_file(const char* path, const char* data, size_t length) {
+    FILE* fp = fopen(path, "wb");
+    EXPECT_TRUE(fp != NULL);
+    EXPECT_EQ_SIZE_T(length, fwrite(data, 1, length, fp));
+    fclose(fp);
+}
+
+#define TEST_PARSE_FILE(error, json, length) \
+    do {\
+        cjson_value v, v2;\
+        cjson_init(&v);\
+        cjson_init(&v2);\
+        write_file("cjson_test.tmp", json, length);\
+        EXPECT_EQ_INT(error, cjson_parse_file(&v, "cjson_test.tmp", 0));\
+        EXPECT_EQ_INT(error, cjson_parse_file(&v2, "cjson_test.tmp", CJSON_PARSE_FILE_NO_MMAP));\
+        EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+        if (error == CJSON_PARSE_OK) {\
+            cjson_free(&v2);\
+            EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, json));\
+            EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+        }\
+        else\
+            EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v));\
+        remove("cjson_test.tmp");\
+        cjson_free(&v);\
+        cjson_free(&v2);\
+    } while(0)
+
+static void test_parse_file() {
+    char* json;
+    cjson_value v;
+    size_t page = 4096;
+
+    TEST_PARSE_FILE(CJSON_PARSE_OK, "{\"a\":[1,2,{\"b\":null}],\"c\":\"d\"}\n", 30);
+    TEST_PARSE_FILE(CJSON_PARSE_OK, " 123 ", 5);
+    TEST_PARSE_FILE(CJSON_PARSE_EXPECT_VALUE, "", 0);
+    TEST_PARSE_FILE(CJSON_PARSE_ROOT_NOT_SINGULAR, "[1]\0[2]", 7);
+    TEST_PARSE_FILE(CJSON_PARSE_MISS_QUOTATION_MARK, "\"abc\0\"", 6);
+    TEST_PARSE_FILE(CJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1,2", 4);
+
+    /* a file ending exactly on a page boundary has no zero-filled tail to terminate it */
+    json = (char*)malloc(page * 2 + 1);
+    for (size_t size = page; size <= page * 2; size += page) {
+        memset(json, 'a', size);
+        json[0] = json[size - 1] = '"';
+        json[size] = '\0';
+        TEST_PARSE_FILE(CJSON_PARSE_OK, json, size);
+        json[size - 1] = 'a';
+        TEST_PARSE_FILE(CJSON_PARSE_MISS_QUOTATION_MARK, json, size);
+    }
+    free(json);
+
+    cjson_init(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_IO_ERROR, cjson_parse_file(&v, "cjson_test_missing.tmp", 0));
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v));
+}
+
+/* Records with a large array, a large object and a shared subtree nested among them. */
+static void build_large_tree(cjson_value* v, const cjson_value* shared) {
+    char key[32];
+    cjson_set_array(v, 0);
+    for (int i = 0; i < 20000; i++) {
+        cjson_value* e = cjson_pushback_array_element(v);
+        if (i == 7 || i == 12345) {
+            cjson_set_array(e, 0);
+            for (int j = 0; j < 5000; j++)
+                cjson_set_number(cjson_pushback_array_element(e), j * 0.5);
+        }
+        else if (i == 19999) {
+            cjson_set_object(e, 0);
+            for (int j = 0; j < 5000; j++) {
+                sprintf(key, "k\t%d", j);
+                cjson_set_string(cjson_set_object_value(e, key, strlen(key)), "v\"", 2);
+            }
+        }
+        else if (i == 100 && shared != NULL)
+            cjson_copy_shared(e, shared);
+        else {
+            cjson_set_object(e, 0);
+            cjson_set_number(cjson_set_object_value(e, "id", 2), i);
+            cjson_set_string(cjson_set_object_value(e, "name", 4), "record", 6);
+            cjson_set_boolean(cjson_set_object_value(e, "ok", 2), i % 2);
+        }
+    }
+}
+
+#define TEST_PARSE_STEP_FLAGS(error, json, flags) \
+    do {\
+        static const size_t budgets[] = {0, 1, 3, 64};\
+        cjson_value v, v2;\
+        cjson_parser p;\
+        cjson_init(&v);\
+        EXPECT_EQ_INT(error, cjson_parse_flags(&v, json, flags));\
+        for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {\
+            int ret;\
+            cjson_init(&v2);\
+            cjson_parser_init(&p, &v2, json, flags);\
+            while ((ret = cjson_parse_step(&p, budgets[i])) == CJSON_PARSE_AGAIN)\
+                ;\
+            EXPECT_EQ_INT(error, ret);\
+            EXPECT_EQ_INT(error, cjson_parse_step(&p, budgets[i]));\
+            EXPECT_TRUE(cjson_is_equal(&v, &v2));\
+            cjson_parser_free(&p);\
+            cjson_free(&v2);\
+        }\
+        cjson_free(&v);\
+    } while(0)
+
+#define TEST_PARSE_STEP(error, json) \
+    do {\
+        TEST_PARSE_STEP_FLAGS(error, json, 0);\
+        TEST_PARSE_STEP_FLAGS(error, json, CJSON_PARSE_RAW_NUMBERS | CJSON_PARSE_PACK_NUMBERS | CJSON_PARSE_SHARE_KEYS);\
+    } while(0)
+
+static void test_parse_step() {
+    cjson_value v, v2;
+    cjson_parser p;
+    char* json;
+    size_t len, steps = 0;
+
+    TEST_PARSE_STEP(CJSON_PARSE_OK, " null ");
+    TEST_PARSE_STEP(CJSON_PARSE_OK, "-1.5e3");
+    TEST_PARSE_STEP(CJSON_PARSE_OK, "\"Hello\\u0000\\uD834\\uDD1E\"");
+    TEST_PARSE_STEP(CJSON_PARSE_OK, "[ ]");
+    TEST_PARSE_STEP(CJSON_PARSE_OK, "{ }");
+    TEST_PARSE_STEP(CJSON_PARSE_OK, "[ null , false , true , 123 , \"abc\", [ [ ] , [ 0 ] , [ 0 , 1 ] ] ]");
+    TEST_PARSE_STEP(CJSON_PARSE_OK,
+        " { "
+        "\"n\" : null , "
+        "\"a\" : [ 1, 2, 3 ], "
+        "\"o\" : { \"1\" : 1, \"2\" : {}, \"3\" : [] }"
+        " } ");
+    TEST_PARSE_STEP(CJSON_PARSE_EXPECT_VALUE, " ");
+    TEST_PARSE_STEP(CJSON_PARSE_EXPECT_VALUE, "[1,");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_VALUE, "[1,]");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_VALUE, "{\"a\":[nul]}");
+    TEST_PARSE_STEP(CJSON_PARSE_ROOT_NOT_SINGULAR, "[1] x");
+    TEST_PARSE_STEP(CJSON_PARSE_ROOT_NOT_SINGULAR, "0123");
+    TEST_PARSE_STEP_FLAGS(CJSON_PARSE_NUMBER_TOO_BIG, "[[1e309]]", 0);
+    TEST_PARSE_STEP(CJSON_PARSE_MISS_QUOTATION_MARK, "{\"a\":\"b");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_STRING_ESCAPE, "[\"\\v\"]");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_STRING_CHAR, "\"\x01\"");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_UNICODE_HEX, "{\"\\u00G0\":1}");
+    TEST_PARSE_STEP(CJSON_PARSE_INVALID_UNICODE_SURROGATE, "[\"\\uD800\\uE000\"]");
+    TEST_PARSE_STEP(CJSON_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[1}]");
+    TEST_PARSE_STEP(CJSON_PARSE_MISS_KEY, "{\"a\":1,2:3}");
+    TEST_PARSE_STEP(CJSON_PARSE_MISS_COLON, "{\"a\":{\"b\" 1}}");
+    TEST_PARSE_STEP(CJSON_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "[{\"a\":1]");
+
+    /* Flags store numbers and keys as cjson_parse_flags() does. */
+    {
+        static const char flagged[] = "[{\"id\":1.50,\"xs\":[1,2]},{\"id\":2,\"xs\":[]}]";
+        const double* nums;
+        cjson_init(&v);
+        cjson_parser_init(&p, &v, flagged, CJSON_PARSE_PACK_NUMBERS | CJSON_PARSE_SHARE_KEYS);
+        while (cjson_parse_step(&p, 8) == CJSON_PARSE_AGAIN)
+            ;
+        EXPECT_EQ_INT(CJSON_PARSE_OK, p.ret);
+        cjson_parser_free(&p);
+        EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value_const(cjson_get_array_element_const(&v, 0), "xs", 2), &nums, &len));
+        EXPECT_EQ_SIZE_T(2, len);
+        EXPECT_TRUE(cjson_get_object_key(cjson_get_array_element_const(&v, 0), 0) == cjson_get_object_key(cjson_get_array_element_const(&v, 1), 0));
+        cjson_free(&v);
+        cjson_parser_init(&p, &v, flagged, CJSON_PARSE_RAW_NUMBERS);
+        while (cjson_parse_step(&p, 8) == CJSON_PARSE_AGAIN)
+            ;
+        EXPECT_EQ_INT(CJSON_PARSE_OK, p.ret);
+        cjson_parser_free(&p);
+        json = cjson_stringify(&v, &len);
+        EXPECT_EQ_STRING(flagged, json, len);
+        free(json);
+        cjson_free(&v);
+    }
+
+    /* A large document pauses roughly every budget bytes. */
+    cjson_init(&v);
+    cjson_init(&v2);
+    build_large_tree(&v, NULL);
+    json = cjson_stringify(&v, &len);
+    cjson_parser_init(&p, &v2, json, 0);
+    while (cjson_parse_step(&p, 4096) == CJSON_PARSE_AGAIN)
+        steps++;
+    EXPECT_EQ_INT(CJSON_PARSE_OK, p.ret);
+    EXPECT_TRUE(steps >= len / 4096 - 1 && steps <= len / 4096 + 1);
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    cjson_parser_free(&p);
+    cjson_free(&v2);
+
+    /* Abandoned halfway, everything parsed so far is released. */
+    cjson_parser_init(&p, &v2, json, 0);
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v2));
+    EXPECT_EQ_INT(CJSON_PARSE_AGAIN, cjson_parse_step(&p, len / 2));
+    cjson_parser_free(&p);
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v2));
+    free(json);
+    cjson_free(&v);
+}
+
+static void test_stringify_parallel_value(const cjson_value* v) {
+    static const unsigned threads[] = {1, 3, 0};
+    size_t expect_len, len;
+    char* expect = cjson_stringify(v, &expect_len);
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        FILE* fp = tmpfile();
+        char* json = cjson_stringify_parallel(v, &len, threads[i]);
+        EXPECT_EQ_SIZE_T(expect_len, len);
+        EXPECT_TRUE(memcmp(expect, json, len + 1) == 0);
+        free(json);
+
+        EXPECT_TRUE(fp != NULL);
+        EXPECT_EQ_INT(CJSON_STRINGIFY_OK, cjson_stringify_parallel_fd(v, fileno(fp), threads[i]));
+        fseek(fp, 0, SEEK_END);
+        EXPECT_EQ_SIZE_T(expect_len, (size_t)ftell(fp));
+        rewind(fp);
+        json = (char*)malloc(expect_len);
+        EXPECT_EQ_SIZE_T(expect_len, fread(json, 1, expect_len, fp));
+        EXPECT_TRUE(memcmp(expect, json, expect_len) == 0);
+        free(json);
+        fclose(fp);
+    }
+    free(expect);
+}
+
+static void test_parallel_packed(cjson_value* v, size_t n) {
+    double* nums = (double*)malloc(n * sizeof(double));
+    for (size_t i = 0; i < n; i++)
+        nums[i] = i * 0.5;
+    cjson_set_number_array(v, nums, n);
+    free(nums);
+}
+
+static void test_stringify_parallel() {
+    cjson_value v, *big;
+    char key[32];
+    cjson_init(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "[1,\"two\",{\"three\":[3]}]"));
+    test_stringify_parallel_value(&v);     /* too small to split */
+
+    build_large_tree(&v, NULL);
+    test_stringify_parallel_value(&v);
+
+    /* A large object whose first member is itself large. */
+    big = (cjson_value*)malloc(sizeof(cjson_value));
+    cjson_init(big);
+    cjson_move(big, &v);
+    cjson_set_object(&v, 0);
+    cjson_move(cjson_set_object_value(&v, "rows", 4), big);
+    for (int j = 0; j < 4096; j++) {
+        sprintf(key, "%d", j);
+        cjson_set_null(cjson_set_object_value(&v, key, strlen(key)));
+    }
+    test_stringify_parallel_value(&v);
+
+    /* Frozen objects and packed arrays split like the plain forms. */
+    cjson_freeze(&v);
+    test_stringify_parallel_value(&v);
+    cjson_free(&v);
+    free(big);
+    test_parallel_packed(&v, 10000);
+    test_stringify_parallel_value(&v);
+    cjson_free(&v);
+}
+
+static void test_copy_free_parallel() {
+    cjson_value v, copy, shared, *big;
+    cjson_init(&v);
+    cjson_init(&copy);
+    cjson_init(&shared);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&shared, "{\"a\":[1,2,{\"b\":\"c\"}]}"));
+    build_large_tree(&v, &shared);
+
+    cjson_copy_parallel(&copy, &v, 3);
+    EXPECT_TRUE(cjson_is_equal(&copy, &v));
+    cjson_free_parallel(&copy, 3);
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&copy));
+
+    /* Shared storage survives a parallel free of one of its owners. */
+    cjson_copy_shared(&copy, &v);
+    cjson_free_parallel(&v, 0);
+    EXPECT_EQ_INT(CJSON_OBJECT, cjson_get_type(cjson_get_array_element(&copy, 100)));
+    EXPECT_TRUE(cjson_is_equal(cjson_get_array_element(&copy, 100), &shared));
+    cjson_copy_parallel(&v, &copy, 0);
+    cjson_free_parallel(&copy, 2);
+    cjson_free(&shared);
+    EXPECT_EQ_SIZE_T(20000, cjson_get_array_size(&v));
+
+    /* A small root holding a large child. */
+    big = (cjson_value*)malloc(sizeof(cjson_value));
+    cjson_init(big);
+    cjson_move(big, &v);
+    cjson_set_object(&v, 0);
+    cjson_set_string(cjson_set_object_value(&v, "name", 4), "export", 6);
+    cjson_move(cjson_set_object_value(&v, "rows", 4), big);
+    free(big);
+    cjson_copy_parallel(&copy, &v, 4);
+    EXPECT_TRUE(cjson_is_equal(&copy, &v));
+
+    /* A frozen root stays frozen; a large packed member is copied in ranges. */
+    test_parallel_packed(cjson_set_object_value(&v, "xs", 2), 10000);
+    cjson_freeze(&v);
+    cjson_free(&copy);
+    cjson_copy_parallel(&copy, &v, 4);
+    EXPECT_TRUE(cjson_is_frozen(&copy));
+    EXPECT_TRUE(cjson_is_equal(&copy, &v));
+    EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value(&copy, "xs", 2), NULL, NULL));
+    cjson_free_parallel(&copy, 4);
+    test_parallel_packed(&shared, 10000);
+    cjson_copy_parallel(&copy, &shared, 3);
+    EXPECT_TRUE(cjson_is_equal(&copy, &shared));
+    cjson_free_parallel(&shared, 3);
+    cjson_free_parallel(&copy, 3);
+    cjson_copy_parallel(&copy, &v, 4);
+
+    cjson_free_background(&copy);
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&copy));
+    cjson_copy(&copy, &v);
+    cjson_free_background(&copy);
+    cjson_free_background(&v);
+    cjson_set_string(&v, "scalar", 6);
+    cjson_free_background(&v);
+    EXPECT_EQ_INT(CJSON_NULL, cjson_get_type(&v));
+    cjson_free_background_wait();
+}
+
+static void test_raw_number() {
+    const char* json = "[1.0,-0,3.14159265358979323846264338327950288,9007199254740993,1e400,{\"n\":12345678901234567890123}]";
+    cjson_value v, v2;
+    char* out;
+    size_t len;
+    const char* lit;
+    cjson_init(&v);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v, json, CJSON_PARSE_RAW_NUMBERS));
+    out = cjson_stringify(&v, &len);
+    EXPECT_EQ_SIZE_T(strlen(json), len);
+    EXPECT_TRUE(strcmp(json, out) == 0);    /* emitted verbatim */
+    EXPECT_EQ_SIZE_T(len, cjson_stringify_length(&v));
+    free(out);
+
+    EXPECT_EQ_INT(CJSON_NUMBER, cjson_get_type(cjson_get_array_element(&v, 0)));
+    EXPECT_EQ_INT(CJSON_NUMBER, cjson_get_array_element(&v, 0)->type);   /* the form is not part of the type */
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(cjson_get_array_element(&v, 0)));
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(cjson_get_array_element(&v, 0)));  /* cached */
+    EXPECT_EQ_DOUBLE(3.141592653589793, cjson_get_number(cjson_get_array_element(&v, 2)));
+    EXPECT_TRUE(cjson_get_int(cjson_get_array_element(&v, 3)) == 9007199254740993LL);
+    EXPECT_TRUE(cjson_get_number(cjson_get_array_element(&v, 4)) > 1e308);  /* not rejected as too big */
+    lit = cjson_get_number_literal(cjson_get_array_element(&v, 1), &len);
+    EXPECT_EQ_STRING("-0", lit, len);
+
+    /* Raw and decoded numbers compare and hash by value. */
+    EXPECT_EQ_INT(CJSON_PARSE_NUMBER_TOO_BIG, cjson_parse(&v2, json));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "[1,0,3.141592653589793,9007199254740992,1e300,{\"n\":1.2345678901234568e+22}]"));
+    EXPECT_FALSE(cjson_is_equal(&v, &v2));
+    cjson_set_number(cjson_get_array_element(&v2, 4), cjson_get_number(cjson_get_array_element(&v, 4)));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    EXPECT_TRUE(cjson_hash(&v) == cjson_hash(&v2));
+    EXPECT_TRUE(cjson_get_number_literal(cjson_get_array_element(&v2, 0), NULL) == NULL);
+    EXPECT_TRUE(cjson_get_int(cjson_get_array_element(&v2, 3)) == 9007199254740992LL);
+
+    /* Copies keep the literal. */
+    cjson_copy(&v2, &v);
+    out = cjson_stringify(&v2, NULL);
+    EXPECT_TRUE(strcmp(json, out) == 0);
+    free(out);
+    cjson_free(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v2, "[1.00,1.0]", CJSON_PARSE_RAW_NUMBERS));
+    {
+        cjson_dedup_pool p;
+        cjson_dedup_pool_init(&p);
+        cjson_dedup_pool_insert(&p, &v2);
+        cjson_dedup_pool_free(&p);
+    }
+    out = cjson_stringify(&v2, NULL);
+    EXPECT_TRUE(strcmp("[1.00,1.0]", out) == 0);
+    free(out);
+
+    cjson_free(&v);
+    cjson_free(&v2);
+}
+
+static void test_number_array() {
+    const char* json = "{\"xs\":[1,-2.5,1e+100,0],\"mixed\":[1,\"a\"],\"empty\":[]}";
+    const double nums[] = {4, 5, 6};
+    const double *p, *q;
+    cjson_value v, v2, *xs;
+    char* data;
+    size_t len, count;
+    cjson_init(&v);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v, json, CJSON_PARSE_PACK_NUMBERS));
+    xs = cjson_find_object_value(&v, "xs", 2);
+    EXPECT_EQ_INT(CJSON_ARRAY, cjson_get_type(xs));
+    EXPECT_EQ_INT(CJSON_ARRAY, xs->type);
+    EXPECT_EQ_SIZE_T(4, cjson_get_array_size(xs));
+    EXPECT_TRUE(cjson_get_number_array(xs, &p, &count));
+    EXPECT_EQ_SIZE_T(4, count);
+    EXPECT_EQ_DOUBLE(-2.5, p[1]);
+    EXPECT_EQ_DOUBLE(1e100, p[2]);
+    /* Const reads leave it packed; only cjson_get_array_number() reads its elements. */
+    EXPECT_TRUE(cjson_get_array_element_const(xs, 1) == NULL);
+    EXPECT_EQ_DOUBLE(-2.5, cjson_get_array_number(xs, 1));
+    EXPECT_TRUE(cjson_get_number_array(xs, NULL, NULL));
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_array_number(cjson_find_object_value_const(&v, "mixed", 5), 0));
+    EXPECT_FALSE(cjson_get_number_array(cjson_find_object_value(&v, "mixed", 5), NULL, NULL));
+    EXPECT_FALSE(cjson_get_number_array(cjson_find_object_value(&v, "empty", 5), NULL, NULL));
+    data = cjson_stringify(&v, &len);
+    EXPECT_TRUE(strcmp(json, data) == 0);
+    EXPECT_EQ_SIZE_T(len, cjson_stringify_length(&v));
+    free(data);
+
+    /* Packed and generic arrays compare and hash alike, and take less memory. */
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, json));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    EXPECT_TRUE(cjson_is_equal(&v2, &v));
+    EXPECT_TRUE(cjson_hash(&v) == cjson_hash(&v2));
+    EXPECT_TRUE(cjson_memory_usage(&v) < cjson_memory_usage(&v2));
+
+    /* Copies, deep and shared, stay packed. */
+    cjson_copy(&v2, &v);
+    EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value(&v2, "xs", 2), NULL, NULL));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    cjson_copy_shared(&v2, &v);
+    EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value(&v2, "xs", 2), &q, NULL));
+    EXPECT_TRUE(cjson_get_number_array(xs, &p, NULL));
+    EXPECT_TRUE(p == q);    /* shared storage */
+    xs = cjson_find_object_value(&v, "xs", 2);  /* v no longer owns the old one alone */
+
+    /* Numbers stored by value keep it packed, and so does taking elements away. */
+    cjson_pushback_array_number(xs, 7);
+    cjson_set_array_number(xs, 0, 8);
+    EXPECT_TRUE(cjson_get_number_array(xs, &p, &count));
+    EXPECT_EQ_SIZE_T(5, count);
+    EXPECT_EQ_DOUBLE(8.0, p[0]);
+    EXPECT_EQ_DOUBLE(7.0, p[4]);
+    EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value(&v2, "xs", 2), &q, NULL));
+    EXPECT_EQ_DOUBLE(1.0, q[0]);
+    cjson_popback_array_element(xs);
+    cjson_set_array_number(xs, 0, 1);
+    cjson_reserve_array(xs, 16);
+    cjson_shrink_array(xs);
+    EXPECT_TRUE(cjson_get_number_array(xs, NULL, NULL));
+    EXPECT_EQ_SIZE_T(4, cjson_get_array_capacity(xs));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+
+    /* Handing out or adding an element turns the array generic; shared copies are unaffected. */
+    EXPECT_EQ_DOUBLE(-2.5, cjson_get_number(cjson_get_array_element(xs, 1)));
+    EXPECT_FALSE(cjson_get_number_array(xs, NULL, NULL));
+    EXPECT_TRUE(cjson_get_number_array(cjson_find_object_value(&v2, "xs", 2), NULL, NULL));
+    cjson_set_string(cjson_pushback_array_element(xs), "b", 1);
+    EXPECT_EQ_SIZE_T(5, cjson_get_array_size(xs));
+    EXPECT_FALSE(cjson_is_equal(&v, &v2));
+    cjson_popback_array_element(xs);
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+
+    /* Setting from a packed array's own numbers. */
+    cjson_set_number_array(xs, nums, 3);
+    EXPECT_TRUE(cjson_get_number_array(xs, &p, &count));
+    cjson_set_number_array(xs, p + 1, count - 1);
+    data = cjson_stringify(xs, NULL);
+    EXPECT_TRUE(strcmp("[5,6]", data) == 0);
+    free(data);
+    cjson_erase_array_element(xs, 0, 1);
+    EXPECT_EQ_DOUBLE(6.0, cjson_get_array_number(xs, 0));
+    cjson_clear_array(xs);
+    EXPECT_TRUE(cjson_get_number_array(xs, NULL, &count));
+    EXPECT_EQ_SIZE_T(0, count);
+    cjson_pushback_array_number(xs, 9);
+    data = cjson_stringify(xs, NULL);
+    EXPECT_TRUE(strcmp("[9]", data) == 0);
+    free(data);
+    cjson_set_number_array(xs, NULL, 0);
+    EXPECT_EQ_SIZE_T(0, cjson_get_array_size(xs));
+
+    /* Binary encodings write packed arrays as ordinary ones. */
+    cjson_set_number_array(&v, nums, 3);
+    cjson_free(&v2);
+    data = cjson_to_cbor(&v, &len);
+    EXPECT_EQ_INT(CJSON_BINARY_OK, cjson_from_cbor(&v2, data, len));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    free(data);
+    cjson_free(&v2);
+    data = cjson_to_msgpack(&v, &len);
+    EXPECT_EQ_INT(CJSON_BINARY_OK, cjson_from_msgpack(&v2, data, len));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    free(data);
+    data = snapshot_image(&v, &len);
+    cjson_copy_view(&v2, cjson_snapshot_root(data, len));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    free(data);
+
+    /* Patches reach into packed arrays. */
+    cjson_free(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, "[{\"op\":\"replace\",\"path\":\"/1\",\"value\":\"x\"}]"));
+    EXPECT_EQ_INT(CJSON_PATCH_OK, cjson_patch_apply(&v, &v2));
+    data = cjson_stringify(&v, NULL);
+    EXPECT_TRUE(strcmp("[4,\"x\",6]", data) == 0);
+    free(data);
+
+    cjson_free(&v);
+    cjson_free(&v2);
+}
+
+static void test_field_cache() {
+    const char* json = "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"name\":\"c\",\"id\":3},{\"name\":\"d\"},5]";
+    cjson_value v, v2, *r;
+    cjson_field_cache id, name;
+    char* out;
+    cjson_init(&v);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v, json, CJSON_PARSE_SHARE_KEYS));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v2, json));
+    EXPECT_TRUE(cjson_get_object_key(cjson_get_array_element(&v, 0), 1) == cjson_get_object_key(cjson_get_array_element(&v, 2), 0));
+    EXPECT_TRUE(cjson_get_object_key(cjson_get_array_element(&v2, 0), 1) != cjson_get_object_key(cjson_get_array_element(&v2, 2), 0));
+    EXPECT_TRUE(cjson_memory_usage(&v) < cjson_memory_usage(&v2));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    out = cjson_stringify(&v, NULL);
+    EXPECT_TRUE(strcmp(json, out) == 0);
+    free(out);
+
+    /* Hits, reorders and misses, with shared keys and without. */
+    cjson_field_cache_init(&id, "id", 2);
+    cjson_field_cache_init(&name, "name", 4);
+    for (size_t i = 0; i < 4; i++) {
+        r = cjson_get_array_element(&v, i);
+        EXPECT_TRUE(cjson_find_object_value_cached(r, &name) == cjson_find_object_value(r, "name", 4));
+        EXPECT_TRUE(cjson_find_object_value_cached(r, &id) == cjson_find_object_value(r, "id", 2));
+        r = cjson_get_array_element(&v2, i);
+        EXPECT_EQ_SIZE_T(cjson_find_object_index(r, "id", 2), cjson_find_object_index_cached(r, &id));
+    }
+    EXPECT_EQ_SIZE_T(CJSON_KEY_NOT_EXIST, cjson_find_object_index_cached(cjson_get_array_element(&v, 3), &id));
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 0), &id)));
+
+    /* The cache keeps the key it last saw alive, so a freed document cannot alias it. */
+    cjson_free(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v, "{\"ix\":0,\"id\":7}", CJSON_PARSE_SHARE_KEYS));
+    EXPECT_EQ_DOUBLE(7.0, cjson_get_number(cjson_find_object_value_cached(&v, &id)));
+    cjson_field_cache_free(&id);
+    cjson_field_cache_free(&name);
+
+    /* With duplicate keys, the first one wins, as it does without the cache. */
+    cjson_field_cache_init(&id, "k", 1);
+    cjson_free(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "[{\"z\":0,\"k\":1},{\"k\":2,\"k\":3},{\"j\":4,\"k\":5,\"k\":6}]"));
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 0), &id)));
+    EXPECT_EQ_DOUBLE(2.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 1), &id)));
+    EXPECT_EQ_DOUBLE(5.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 2), &id)));
+    EXPECT_EQ_DOUBLE(2.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 1), &id)));
+    cjson_freeze(&v);
+    EXPECT_EQ_DOUBLE(5.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 2), &id)));
+    EXPECT_EQ_DOUBLE(2.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 1), &id)));
+    EXPECT_EQ_DOUBLE(5.0, cjson_get_number(cjson_find_object_value_cached(cjson_get_array_element(&v, 2), &id)));
+    cjson_field_cache_free(&id);
+
+    cjson_free(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_MISS_COLON, cjson_parse_flags(&v, "[{\"a\":1},{\"a\":2,\"a\"}]", CJSON_PARSE_SHARE_KEYS));
+    cjson_free(&v2);
+}
+
+static void test_freeze() {
+    const char* json = "{\"b\":1,\"ab\":2,\"\":3,\"a\":{\"z\":[{\"y\":1,\"x\":2}],\"b\":true},\"b\":4,\"abc\":null}";
+    const char* keys[] = {"", "a", "ab", "abc", "b", "ba", "0", "~"};
+    cjson_value v, v2, v3;
+    char* out;
+    cjson_init(&v);
+    cjson_init(&v2);
+    cjson_init(&v3);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));
+    cjson_copy(&v2, &v);
+    cjson_freeze(&v);
+    EXPECT_TRUE(cjson_is_frozen(&v));
+    EXPECT_FALSE(cjson_is_frozen(&v2));
+    EXPECT_EQ_INT(CJSON_OBJECT, cjson_get_type(&v));
+    EXPECT_EQ_INT(CJSON_OBJECT, v.type);
+    out = cjson_stringify(&v, NULL);    /* sorted, duplicates in their original order */
+    EXPECT_TRUE(strcmp("{\"\":3,\"a\":{\"b\":true,\"z\":[{\"x\":2,\"y\":1}]},\"ab\":2,\"abc\":null,\"b\":1,\"b\":4}", out) == 0);
+    free(out);
+
+    /* Lookups agree with a linear search, the first duplicate included. */
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        cjson_value* a = cjson_find_object_value(&v, keys[i], strlen(keys[i]));
+        cjson_value* b = cjson_find_object_value(&v2, keys[i], strlen(keys[i]));
+        EXPECT_TRUE((a == NULL) == (b == NULL));
+        if (a != NULL)
+            EXPECT_TRUE(cjson_is_equal(a, b));
+    }
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(cjson_find_object_value(&v, "b", 1)));
+    EXPECT_TRUE(cjson_is_frozen(cjson_get_array_element(cjson_find_object_value(cjson_find_object_value(&v, "a", 1), "z", 1), 0)));
+
+    /* Equality across frozen and unfrozen objects, and between frozen ones; duplicate
+     * keys never compare equal, so the second "b" goes first (removal keeps the order). */
+    cjson_remove_object_value(&v, 5);
+    cjson_remove_object_value(&v2, 4);
+    EXPECT_TRUE(cjson_is_frozen(&v));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    EXPECT_TRUE(cjson_is_equal(&v2, &v));
+    EXPECT_TRUE(cjson_hash(&v) == cjson_hash(&v2));
+    cjson_copy(&v3, &v);
+    EXPECT_TRUE(cjson_is_frozen(&v3));
+    EXPECT_TRUE(cjson_is_equal(&v, &v3));
+    cjson_set_number(cjson_find_object_value(&v3, "ab", 2), 5);
+    EXPECT_TRUE(cjson_is_frozen(&v3));
+    EXPECT_FALSE(cjson_is_equal(&v, &v3));
+    EXPECT_FALSE(cjson_is_equal(&v3, &v2));
+
+    /* Adding a member thaws the object. */
+    cjson_set_number(cjson_set_object_value(&v3, "aa", 2), 6);
+    EXPECT_FALSE(cjson_is_frozen(&v3));
+    EXPECT_EQ_DOUBLE(6.0, cjson_get_number(cjson_find_object_value(&v3, "aa", 2)));
+    EXPECT_EQ_DOUBLE(5.0, cjson_get_number(cjson_find_object_value(&v3, "ab", 2)));
+    cjson_freeze(&v3);
+    EXPECT_EQ_DOUBLE(6.0, cjson_get_number(cjson_find_object_value(&v3, "aa", 2)));
+    EXPECT_EQ_STRING("aa", cjson_get_object_key(&v3, 2), cjson_get_object_key_length(&v3, 2));
+
+    cjson_free(&v);
+    cjson_free(&v2);
+    cjson_free(&v3);
+}
+
+/* The cached text must always match a fresh cjson_stringify(). */
+static size_t expect_stringify_cached(cjson_stringify_cache* sc, const cjson_value* v) {
+    size_t len, cached_len, before = sc->bytes_reused;
+    char* json = cjson_stringify(v, &len);
+    const char* cached = cjson_stringify_cached(sc, v, &cached_len);
+    EXPECT_EQ_SIZE_T(len, cached_len);
+    EXPECT_TRUE(strcmp(json, cached) == 0);
+    free(json);
+    return sc->bytes_reused - before;
+}
+
+static void test_stringify_cached() {
+    cjson_stringify_cache sc;
+    cjson_value v, x;
+    cjson_value *users, *meta, *e;
+    size_t len, checked;
+    cjson_init(&v);
+    cjson_init(&x);
+    cjson_stringify_cache_init(&sc);
+    cjson_set_object(&v, 0);
+    users = cjson_set_object_value(&v, "users", 5);
+    cjson_set_array(users, 0);
+    for (int i = 0; i < 50; i++) {
+        e = cjson_pushback_array_element(users);
+        cjson_set_object(e, 0);
+        cjson_set_number(cjson_set_object_value(e, "id", 2), i);
+        cjson_set_string(cjson_set_object_value(e, "name", 4), "user \"name\"", 11);
+        cjson_set_array(cjson_set_object_value(e, "tags", 4), 0);
+    }
+    meta = cjson_set_object_value(&v, "meta", 4);
+    cjson_set_object(meta, 0);
+    cjson_set_boolean(cjson_set_object_value(meta, "a", 1), 1);
+    cjson_set_null(cjson_set_object_value(meta, "b", 1));
+
+    EXPECT_EQ_SIZE_T(0, expect_stringify_cached(&sc, &v));
+    cjson_stringify_cached(&sc, &v, &len);
+    EXPECT_EQ_SIZE_T(len, expect_stringify_cached(&sc, &v));  /* unchanged: copied whole */
+
+    /* A write deep down regenerates its path and copies the rest. */
+    users = cjson_find_object_value(&v, "users", 5);
+    cjson_set_number(cjson_find_object_value(cjson_get_array_element(users, 7), "id", 2), 99);
+    EXPECT_TRUE(expect_stringify_cached(&sc, &v) > len * 9 / 10);
+    cjson_set_string(cjson_pushback_array_element(cjson_find_object_value(cjson_get_array_element(cjson_find_object_value(&v, "users", 5), 8), "tags", 4)), "x", 1);
+    expect_stringify_cached(&sc, &v);
+
+    /* Reordered members hash the same, which must not pass for unchanged. */
+    meta = cjson_find_object_value(&v, "meta", 4);
+    cjson_remove_object_value(meta, 0);
+    cjson_set_boolean(cjson_set_object_value(meta, "a", 1), 1);
+    cjson_hash(&v);
+    expect_stringify_cached(&sc, &v);
+
+    /* Subtrees moved, swapped, shared or replaced. */
+    users = cjson_find_object_value(&v, "users", 5);
+    cjson_swap(cjson_get_array_element(users, 0), cjson_get_array_element(users, 1));
+    expect_stringify_cached(&sc, &v);
+    users = cjson_find_object_value(&v, "users", 5);    /* pointers from before a call are stale */
+    cjson_copy_shared(&x, cjson_get_array_element(users, 2));
+    cjson_copy_shared(cjson_get_array_element(users, 3), &x);
+    cjson_copy_shared(cjson_pushback_array_element(users), &x);
+    expect_stringify_cached(&sc, &v);
+    cjson_move(cjson_set_object_value(&v, "moved", 5), cjson_get_array_element(cjson_find_object_value(&v, "users", 5), 4));
+    expect_stringify_cached(&sc, &v);
+    for (int i = 0; i < 300; i++) {   /* enough dead slots to drop the table */
+        meta = cjson_find_object_value(&v, "meta", 4);
+        cjson_set_object(meta, 0);
+        cjson_set_array(cjson_set_object_value(meta, "n", 1), 0);
+        cjson_set_number(cjson_pushback_array_element(cjson_find_object_value(meta, "n", 1)), i);
+        expect_stringify_cached(&sc, &v);
+    }
+
+    /* Pointers kept across a call are fetched again before writing; an unchanged tree is not rescanned. */
+    expect_stringify_cached(&sc, &v);
+    cjson_set_number(cjson_find_object_value(cjson_find_object_value(&v, "meta", 4), "n", 1), 7);
+    expect_stringify_cached(&sc, &v);
+    cjson_set_string(cjson_pushback_array_element(cjson_find_object_value(&v, "users", 5)), "y", 1);
+    expect_stringify_cached(&sc, &v);
+    cjson_popback_array_element(cjson_find_object_value(&v, "users", 5));
+    expect_stringify_cached(&sc, &v);
+    checked = sc.elements_checked;
+    cjson_stringify_cached(&sc, &v, &len);
+    EXPECT_EQ_SIZE_T(len, expect_stringify_cached(&sc, &v));
+    EXPECT_EQ_SIZE_T(checked, sc.elements_checked);
+
+    /* Parsed subtrees not written to are copied; the path to a write is compared and regenerated. */
+    cjson_free(&x);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&x, "{\"o\":{\"k\":1,\"s\":[\"a\",{\"b\":-0}]},\"p\":[[1,2],{\"q\":null}]}"));
+    expect_stringify_cached(&sc, &x);
+    cjson_stringify_cached(&sc, &x, &len);
+    EXPECT_EQ_SIZE_T(len, expect_stringify_cached(&sc, &x));
+    cjson_set_number(cjson_find_object_value(cjson_find_object_value(&x, "o", 1), "k", 1), 2);
+    EXPECT_TRUE(expect_stringify_cached(&sc, &x) >= strlen("[[1,2],{\"q\":null}]") + strlen("[\"a\",{\"b\":-0}]"));
+    cjson_set_number(cjson_find_object_value(cjson_find_object_value(&x, "o", 1), "k", 1), 3);
+    expect_stringify_cached(&sc, &x);
+
+    /* Another root, then a scalar one, then back. */
+    expect_stringify_cached(&sc, &x);
+    cjson_set_number(&x, 1.5);
+    expect_stringify_cached(&sc, &x);
+    cjson_stringify_cached(&sc, &v, &len);
+    EXPECT_EQ_SIZE_T(len, expect_stringify_cached(&sc, &v));
+    cjson_stringify_cache_free(&sc);
+    cjson_free(&v);
+    cjson_free(&x);
+}
+
+static void test_pool() {
+    cjson_pool pool;
+    cjson_value v, v2;
+    cjson_value *session, *items, *e;
+    size_t live;
+    cjson_init(&v);
+    cjson_init(&v2);
+    cjson_pool_init(&pool);
+    cjson_pool_bind(&pool);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "{\"session\":{\"user\":\"abc\",\"items\":[1,2,3]}}"));
+    session = cjson_find_object_value(&v, "session", 7);
+    for (int i = 0; i < 1000; i++) {
+        char key[16];
+        sprintf(key, "k%d", i % 10);
+        if ((e = cjson_find_object_value(session, key, strlen(key))) == NULL)
+            e = cjson_set_object_value(session, key, strlen(key));
+        cjson_set_string(e, "some session state", 18);
+        items = cjson_find_object_value(session, "items", 5);
+        cjson_set_number(cjson_pushback_array_element(items), i);  /* outgrows the largest class */
+        if (i % 3 == 0)
+            cjson_remove_object_value(session, cjson_find_object_index(session, key, strlen(key)));
+        if (i % 2 == 0)
+            cjson_popback_array_element(items);
+    }
+    cjson_pool_bind(NULL);
+#ifdef CJSON_POOL
+    EXPECT_TRUE(pool.carved > 0);
+    EXPECT_TRUE(pool.reused > 1000);
+#endif
+    EXPECT_EQ_SIZE_T(8, cjson_get_object_size(session));
+    items = cjson_find_object_value(session, "items", 5);
+    EXPECT_EQ_SIZE_T(503, cjson_get_array_size(items));
+    EXPECT_EQ_DOUBLE(999.0, cjson_get_number(cjson_get_array_element(items, 502)));
+    EXPECT_EQ_STRING("some session state", cjson_get_string(cjson_find_object_value(session, "k1", 2)), 18);
+
+    /* Unbound, new storage comes from the heap; pooled storage still returns to the pool. */
+    cjson_copy(&v2, &v);
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    cjson_copy_shared(cjson_set_object_value(&v2, "shared", 6), session);
+    cjson_free(&v);
+    EXPECT_EQ_SIZE_T(8, cjson_get_object_size(cjson_find_object_value(&v2, "shared", 6)));
+    live = 0;
+    for (int i = 0; i < CJSON_POOL_CLASSES; i++)
+        live += pool.classes[i].live;
+#ifdef CJSON_POOL
+    EXPECT_TRUE(live > 0);  /* the shared session still holds pooled blocks */
+#endif
+    cjson_free(&v2);
+    for (int i = 0; i < CJSON_POOL_CLASSES; i++)
+        EXPECT_EQ_SIZE_T(0, pool.classes[i].live);
+    cjson_pool_free(&pool);
+    EXPECT_TRUE(pool.slabs == NULL);
+}
+
+typedef struct {
+    char trace[256];
+    size_t len, max_depth;
+    const cjson_value* last;
+    int skip_type, stop_type;
+} walk_state;
+
+static int walk_enter(const cjson_value* v, const char* key, size_t klen, size_t depth, void* user) {
+    walk_state* w = (walk_state*)user;
+    if (w->len + klen + 2 < sizeof(w->trace)) {
+        if (key) {
+            memcpy(w->trace + w->len, key, klen);
+            w->len += klen;
+            w->trace[w->len++] = ':';
+        }
+        w->trace[w->len++] = "nftNsao"[cjson_get_type(v)];
+        w->trace[w->len] = '\0';
+    }
+    if (depth > w->max_depth)
+        w->max_depth = depth;
+    w->last = v;
+    if ((int)cjson_get_type(v) == w->stop_type)
+        return CJSON_WALK_STOP;
+    return (int)cjson_get_type(v) == w->skip_type ? CJSON_WALK_SKIP : CJSON_WALK_CONTINUE;
+}
+
+static int walk_leave(const cjson_value* v, size_t depth, void* user) {
+    walk_state* w = (walk_state*)user;
+    (void)depth;
+    if (w->len + 1 < sizeof(w->trace) && (cjson_get_type(v) == CJSON_ARRAY || cjson_get_type(v) == CJSON_OBJECT)) {
+        w->trace[w->len++] = ')';
+        w->trace[w->len] = '\0';
+    }
+    return CJSON_WALK_CONTINUE;
+}
+
+static void walk_reset(walk_state* w, int skip_type, int stop_type) {
+    memset(w, 0, sizeof(walk_state));
+    w->skip_type = skip_type;
+    w->stop_type = stop_type;
+}
+
+static void test_walk() {
+    cjson_value v, v2;
+    walk_state w;
+    cjson_value* e;
+    char* json;
+    size_t len;
+    const size_t depth = 200000;
+    cjson_init(&v);
+    cjson_init(&v2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "{\"a\":[1,true,{\"b\":null}],\"c\":\"x\",\"d\":{}}"));
+    walk_reset(&w, -1, -1);
+    EXPECT_EQ_INT(CJSON_WALK_CONTINUE, cjson_walk(&v, walk_enter, walk_leave, &w));
+    EXPECT_EQ_STRING("oa:aNtob:n))c:sd:o))", w.trace, w.len);
+    EXPECT_EQ_SIZE_T(3, w.max_depth);
+
+    walk_reset(&w, CJSON_ARRAY, -1);
+    EXPECT_EQ_INT(CJSON_WALK_CONTINUE, cjson_walk(&v, walk_enter, walk_leave, &w));
+    EXPECT_EQ_STRING("oa:ac:sd:o))", w.trace, w.len);
+
+    walk_reset(&w, -1, CJSON_STRING);
+    EXPECT_EQ_INT(CJSON_WALK_STOP, cjson_walk(&v, walk_enter, NULL, &w));
+    EXPECT_EQ_STRING("oa:aNtob:nc:s", w.trace, w.len);
+
+    cjson_free(&v);
+    walk_reset(&w, -1, -1);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v, "[[1.5,2],3]", CJSON_PARSE_PACK_NUMBERS));
+    EXPECT_EQ_INT(CJSON_WALK_CONTINUE, cjson_walk(&v, walk_enter, walk_leave, &w));
+    EXPECT_EQ_STRING("aaNN)N)", w.trace, w.len);
+    EXPECT_EQ_DOUBLE(3.0, cjson_get_number(w.last));
+
+    /* Nesting far beyond what recursion on the call stack would survive. */
+    e = &v;
+    for (size_t i = 0; i < depth; i++) {
+        if (i % 2) {
+            cjson_set_object(e, 0);
+            e = cjson_set_object_value(e, "k", 1);
+        }
+        else {
+            cjson_set_array(e, 0);
+            e = cjson_pushback_array_element(e);
+        }
+    }
+    cjson_set_number(e, 1.0);
+    cjson_copy(&v2, &v);
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    walk_reset(&w, -1, -1);
+    EXPECT_EQ_INT(CJSON_WALK_CONTINUE, cjson_walk(&v2, walk_enter, NULL, &w));
+    EXPECT_EQ_SIZE_T(depth, w.max_depth);
+    EXPECT_EQ_DOUBLE(1.0, cjson_get_number(w.last));
+    cjson_set_number((cjson_value*)w.last, 2.0);
+    EXPECT_FALSE(cjson_is_equal(&v, &v2));
+    json = cjson_stringify(&v, &len);
+    EXPECT_EQ_SIZE_T(len, cjson_stringify_length(&v));
+    EXPECT_EQ_SIZE_T(depth / 2 * 8 + 1, len);
+    EXPECT_TRUE(strncmp(json, "[{\"k\":[{\"k\":", 12) == 0);
+    EXPECT_TRUE(strstr(json, "1}]}]") == json + depth / 2 * 6);
+    free(json);
+    cjson_free(&v);
+    cjson_free(&v2);
+}
+
+static void test_compact() {
+    cjson_value v, v2, shared;
+    size_t before;
+    char *out, *out2;
+    cjson_init(&v);
+    cjson_init(&v2);
+    cjson_init(&shared);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&shared, "{\"big\":[1,2,3,4,5,6,7,8]}"));
+    cjson_set_object(&v, 0);
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        cjson_value* e;
+        sprintf(key, "k%d", i);
+        e = cjson_set_object_value(&v, key, strlen(key));
+        cjson_set_array(e, 0);
+        for (int j = 0; j < i % 7; j++)
+            cjson_set_number(cjson_pushback_array_element(e), j);
+        cjson_set_string(cjson_pushback_array_element(e), "abc", 3);
+    }
+    cjson_copy_shared(cjson_set_object_value(&v, "shared", 6), &shared);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&v2, "[12345678901234567890,{}]", CJSON_PARSE_RAW_NUMBERS));
+    EXPECT_EQ_DOUBLE(12345678901234567890.0, cjson_get_number(cjson_get_array_element(&v2, 0)));
+    cjson_move(cjson_set_object_value(&v, "raw", 3), &v2);
+    out = cjson_stringify(&v, NULL);
+    cjson_hash(&v);
+    cjson_copy(&v2, &v);
+
+    before = cjson_memory_usage(&v);
+    cjson_compact(&v);
+    EXPECT_TRUE(cjson_memory_usage(&v) < before);
+    EXPECT_EQ_SIZE_T(cjson_get_object_size(&v), cjson_get_object_capacity(&v));
+    EXPECT_EQ_SIZE_T(2, cjson_get_array_capacity(cjson_find_object_value(&v, "k1", 2)));
+    EXPECT_TRUE(cjson_is_equal(&v, &v2));
+    EXPECT_TRUE(cjson_hash(&v) == cjson_hash(&v2));
+    out2 = cjson_stringify(&v, NULL);
+    EXPECT_TRUE(strcmp(out, out2) == 0);
+    free(out);
+    free(out2);
+
+    /* Shared subtrees stay shared, and the result stays mutable. */
+    EXPECT_TRUE(cjson_is_equal(cjson_find_object_value(&v, "shared", 6), &shared));
+    EXPECT_TRUE(cjson_get_object_key(cjson_find_object_value(&v, "shared", 6), 0) == cjson_get_object_key(&shared, 0));
+    cjson_set_number(cjson_pushback_array_element(cjson_find_object_value(&v, "k1", 2)), 9);
+    EXPECT_EQ_SIZE_T(3, cjson_get_array_size(cjson_find_object_value(&v, "k1", 2)));
+    cjson_set_string(cjson_set_object_value(&v, "new", 3), "x", 1);
+    EXPECT_FALSE(cjson_is_equal(&v, &v2));
+    cjson_set_null(cjson_find_object_value(cjson_find_object_value(&v, "shared", 6), "big", 3));
+    EXPECT_EQ_SIZE_T(8, cjson_get_array_size(cjson_find_object_value(&shared, "big", 3)));
+
+    cjson_free(&v);
+    cjson_free(&v2);
+    cjson_free(&shared);
+}
+
+static void test_parse_cache() {
+    cjson_parse_cache pc;
+    cjson_value v, v2, direct;
+    char json[32];
+    cjson_init(&v);
+    cjson_init(&v2);
+    cjson_init(&direct);
+    cjson_parse_cache_init(&pc, 4, 2);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, "{\"a\":[1,2,3],\"b\":\"x\"}", 0));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v2, "{\"a\":[1,2,3],\"b\":\"x\"}", 0));
+    EXPECT_EQ_SIZE_T(1, pc.misses);
+    EXPECT_EQ_SIZE_T(1, pc.hits);
+    EXPECT_TRUE(cjson_find_object_value_const(&v, "a", 1) == cjson_find_object_value_const(&v2, "a", 1));   /* still shared */
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&direct, "{\"a\":[1,2,3],\"b\":\"x\"}"));
+    EXPECT_TRUE(cjson_is_equal(&v, &direct));
+    EXPECT_TRUE(cjson_is_equal(&v2, &direct));
+
+    /* Writes unshare; the cached document keeps its value. */
+    cjson_set_number(cjson_get_array_element(cjson_find_object_value(&v, "a", 1), 0), 9.0);
+    EXPECT_FALSE(cjson_is_equal(&v, &direct));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, "{\"a\":[1,2,3],\"b\":\"x\"}", 0));
+    EXPECT_TRUE(cjson_is_equal(&v, &direct));
+    EXPECT_EQ_SIZE_T(2, pc.hits);
+
+    /* Flags are part of the key. */
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, "{\"a\":[1,2,3],\"b\":\"x\"}", CJSON_PARSE_PACK_NUMBERS));
+    EXPECT_EQ_SIZE_T(2, pc.misses);
+    EXPECT_TRUE(cjson_is_equal(&v, &direct));
+
+    /* Failures are returned, not cached. */
+    EXPECT_EQ_INT(CJSON_PARSE_MISS_COLON, cjson_parse_cached(&pc, &v, "{\"a\" 1}", 0));
+    EXPECT_EQ_INT(CJSON_PARSE_MISS_COLON, cjson_parse_cached(&pc, &v, "{\"a\" 1}", 0));
+    EXPECT_EQ_SIZE_T(4, pc.misses);
+    EXPECT_EQ_SIZE_T(2, pc.hits);
+
+    /* Beyond capacity the least recently used go; documents handed out stay valid. */
+    for (int i = 0; i < 20; i++) {
+        sprintf(json, "[%d]", i);
+        EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, json, 0));
+    }
+    EXPECT_EQ_SIZE_T(24, pc.misses);
+    EXPECT_TRUE(pc.evictions >= 18);
+    EXPECT_EQ_DOUBLE(19.0, cjson_get_number(cjson_get_array_element(&v, 0)));
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, "[19]", 0));
+    EXPECT_EQ_SIZE_T(3, pc.hits);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_cached(&pc, &v, "[0]", 0));
+    EXPECT_EQ_SIZE_T(25, pc.misses);
+    EXPECT_TRUE(cjson_is_equal(&v2, &direct));
+
+    cjson_parse_cache_free(&pc);
+    EXPECT_EQ_DOUBLE(0.0, cjson_get_number(cjson_get_array_element(&v, 0)));
+    cjson_free(&v);
+    cjson_free(&v2);
+    cjson_free(&direct);
+}
+
+static void test_columns() {
+    const char* json = "[{\"ts\":1,\"v\":0.5,\"tag\":\"ab\"},{\"tag\":\"\",\"v\":-2,\"ts\":9007199254740993},"
+        "{\"ts\":null,\"v\":\"x\"},7,{\"ts\":3,\"v\":1e3,\"tag\":\"cde\",\"extra\":[]}]";
+    const char* fields[] = {"ts", "v", "tag", "missing"};
+    const cjson_column_type types[] = {CJSON_COLUMN_INT, CJSON_COLUMN_NUMBER, CJSON_COLUMN_STRING, CJSON_COLUMN_NUMBER};
+    const cjson_column *ts, *v, *tag;
+    cjson_columns t;
+    cjson_value records;
+    cjson_init(&records);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse_flags(&records, json, CJSON_PARSE_RAW_NUMBERS));
+    cjson_extract_columns(&t, &records, fields, types, 4);
+    EXPECT_EQ_SIZE_T(4, t.count);
+    EXPECT_EQ_SIZE_T(5, t.rows);
+    ts = &t.columns[0];
+    v = &t.columns[1];
+    tag = &t.columns[2];
+
+    EXPECT_TRUE(ts->ints[0] == 1 && ts->ints[1] == 9007199254740993LL && ts->ints[4] == 3);
+    EXPECT_EQ_INT(0x13, ts->valid[0]);     /* rows 0, 1 and 4 */
+    EXPECT_EQ_DOUBLE(0.5, v->numbers[0]);
+    EXPECT_EQ_DOUBLE(-2.0, v->numbers[1]);
+    EXPECT_EQ_DOUBLE(0.0, v->numbers[2]);
+    EXPECT_EQ_DOUBLE(1000.0, v->numbers[4]);
+    EXPECT_EQ_INT(0x13, v->valid[0]);
+    EXPECT_EQ_INT(0x13, tag->valid[0]);
+    EXPECT_EQ_STRING("ab", tag->chars + tag->offsets[0], tag->offsets[1] - tag->offsets[0]);
+    EXPECT_EQ_SIZE_T(tag->offsets[1], tag->offsets[2]);    /* empty string */
+    EXPECT_EQ_SIZE_T(tag->offsets[2], tag->offsets[4]);    /* not valid */
+    EXPECT_EQ_STRING("cde", tag->chars + tag->offsets[4], tag->offsets[5] - tag->offsets[4]);
+    EXPECT_EQ_SIZE_T(5, t.heap_size);
+    EXPECT_EQ_INT(0, t.columns[3].valid[0]);
+    cjson_columns_free(&t);
+
+    cjson_set_array(&records, 0);
+    cjson_extract_columns(&t, &records, fields, types, 3);
+    EXPECT_EQ_SIZE_T(0, t.rows);
+    EXPECT_TRUE(t.heap == NULL);
+    cjson_columns_free(&t);
+    cjson_free(&records);
+}
+
+static void test_memory_usage() {
+    cjson_value v, s, t;
+    size_t empty, one, two;
+    cjson_init(&v);
+    cjson_init(&s);
+    cjson_init(&t);
+
+    EXPECT_EQ_SIZE_T(0, cjson_memory_usage(&v));
+    cjson_set_number(&v, 1.0);
+    EXPECT_EQ_SIZE_T(0, cjson_memory_usage(&v));
+    cjson_set_array(&v, 0);
+    EXPECT_EQ_SIZE_T(0, cjson_memory_usage(&v));
+    cjson_set_string(&s, "abc", 3);
+    cjson_set_string(&t, "abcd", 4);
+    EXPECT_EQ_SIZE_T(cjson_memory_usage(&s) + 1, cjson_memory_usage(&t));
+
+    /* capacity slack is part of the footprint */
+    cjson_set_array(&v, 1);
+    one = cjson_memory_usage(&v);
+    cjson_reserve_array(&v, 2);
+    two = cjson_memory_usage(&v);
+    EXPECT_EQ_SIZE_T(one + sizeof(cjson_value), two);
+    cjson_set_object(&v, 2);
+    empty = cjson_memory_usage(&v);
+    cjson_set_number(cjson_set_object_value(&v, "abc", 3), 1.0);
+    EXPECT_EQ_SIZE_T(empty + cjson_memory_usage(&s), cjson_memory_usage(&v));
+
+    /* storage shared inside one tree is counted once */
+    cjson_set_array(&v, 2);
+    cjson_copy(cjson_pushback_array_element(&v), &s);
+    cjson_copy(cjson_pushback_array_element(&v), &s);
+    two = cjson_memory_usage(&v);
+    cjson_set_array(&v, 2);
+    cjson_copy_shared(cjson_pushback_array_element(&v), &s);
+    cjson_copy_shared(cjson_pushback_array_element(&v), &s);
+    EXPECT_EQ_SIZE_T(two - cjson_memory_usage(&s), cjson_memory_usage(&v));
+    cjson_copy_shared(&t, &v);
+    EXPECT_EQ_SIZE_T(two - cjson_memory_usage(&s), cjson_memory_usage(&t));
+
+    cjson_free(&v);
+    cjson_free(&s);
+    cjson_free(&t);
+}
+
+#ifdef CJSON_STATS
+static void test_stats() {
+    cjson_value v;
+    cjson_stats st;
+    long long live;     /* buffers handed across threads by earlier tests leave this nonzero */
+    char* json;
+    cjson_init(&v);
+    cjson_reset_stats();
+    cjson_get_stats(&st);
+    EXPECT_EQ_SIZE_T(0, st.allocs);
+    EXPECT_TRUE(st.bytes_peak == st.bytes_live);
+    live = st.bytes_live;
+
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "{\"a\":[1,2,3],\"b\":\"text\"}"));
+    cjson_get_stats(&st);
+    EXPECT_TRUE(st.allocs >= 4);    /* parse stack, member block, key, array, string */
+    EXPECT_TRUE(st.stack_peak > 0);
+    EXPECT_TRUE(st.bytes_live - live == (long long)cjson_memory_usage(&v));
+    EXPECT_TRUE(st.bytes_peak >= st.bytes_live);
+
+    json = cjson_stringify(&v, NULL);
+    cjson_get_stats(&st);
+    EXPECT_TRUE(st.bytes_live - live == (long long)cjson_memory_usage(&v));  /* the returned buffer is the caller's */
+    free(json);
+
+    cjson_free(&v);
+    cjson_get_stats(&st);
+    EXPECT_TRUE(st.bytes_live == live);
+    EXPECT_EQ_SIZE_T(st.allocs, st.frees);
+}
+#endif
+
+#ifdef CJSON_TRACE
+static size_t trace_documents = 0;
+static unsigned long long trace_bytes = 0;
+
+static void trace_callback(const char* operation, const cjson_trace* trace, size_t bytes, void* user) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < CJSON_PHASE_COUNT; i++)
+        sum += trace->phase[i].bytes;
+    EXPECT_TRUE(strcmp(operation, "parse") == 0 || strcmp(operation, "stringify") == 0);
+    EXPECT_TRUE(sum == bytes);
+    EXPECT_TRUE(user == &trace_documents);
+    trace_documents++;
+    trace_bytes += bytes;
+}
+
+static void test_trace() {
+    const char* json = " {\"a\" : [1, 2.5, \"x\"], \"b\": {\"c\": true, \"d\": null}} ";
+    cjson_value v;
+    cjson_trace t;
+    char* out;
+    size_t len;
+    cjson_init(&v);
+    cjson_reset_trace();
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, json));
+    cjson_get_trace(&t);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_STRING].calls == 5);    /* four keys and "x" */
+    EXPECT_TRUE(t.phase[CJSON_PHASE_STRING].bytes == 15);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_NUMBER].calls == 2);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_NUMBER].bytes == 4);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_LITERAL].bytes == 8);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_ARRAY].calls == 1);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_OBJECT].calls == 2);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_WHITESPACE].bytes == 11);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_WHITESPACE].bytes + t.phase[CJSON_PHASE_LITERAL].bytes
+        + t.phase[CJSON_PHASE_NUMBER].bytes + t.phase[CJSON_PHASE_STRING].bytes
+        + t.phase[CJSON_PHASE_ARRAY].bytes + t.phase[CJSON_PHASE_OBJECT].bytes == strlen(json));
+
+    cjson_reset_trace();
+    cjson_set_trace_callback(trace_callback, &trace_documents);
+    out = cjson_stringify(&v, &len);
+    cjson_get_trace(&t);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_STRINGIFY_STRING].calls == 5);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_STRINGIFY_NUMBER].calls == 2);
+    EXPECT_TRUE(t.phase[CJSON_PHASE_STRINGIFY].bytes + t.phase[CJSON_PHASE_STRINGIFY_NUMBER].bytes
+        + t.phase[CJSON_PHASE_STRINGIFY_STRING].bytes == len);
+    cjson_free(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, out));
+    EXPECT_EQ_SIZE_T(2, trace_documents);
+    EXPECT_TRUE(trace_bytes == 2 * len);
+    cjson_set_trace_callback(NULL, NULL);
+    free(out);
+    cjson_free(&v);
+}
+#endif
+
 static void test_move() {
     cjson_value v1, v2, v3;
     cjson_init(&v1);
@@ -429,6 +2263,62 @@ static void test_swap() {
     cjson_free(&v2);
 }
 
+static void test_writer() {
+    cjson_writer w;
+    cjson_value v;
+    const char* json;
+    char* json2;
+    size_t len, len2;
+
+    cjson_writer_init(&w);
+    cjson_write_begin_object(&w);
+    cjson_write_key(&w, "n", 1);
+    cjson_write_null(&w);
+    cjson_write_key(&w, "f", 1);
+    cjson_write_boolean(&w, 0);
+    cjson_write_key(&w, "t", 1);
+    cjson_write_boolean(&w, 1);
+    cjson_write_key(&w, "i", 1);
+    cjson_write_int(&w, -123);
+    cjson_write_key(&w, "d", 1);
+    cjson_write_number(&w, 1.5);
+    cjson_write_key(&w, "s", 1);
+    cjson_write_string(&w, "a\nb", 3);
+    cjson_write_key(&w, "a", 1);
+    cjson_write_begin_array(&w);
+    cjson_write_begin_array(&w);
+    cjson_write_end_array(&w);
+    cjson_write_begin_object(&w);
+    cjson_write_end_object(&w);
+    cjson_write_int(&w, 3);
+    cjson_write_end_array(&w);
+    cjson_write_end_object(&w);
+    json = cjson_writer_get_string(&w, &len);
+    EXPECT_EQ_STRING("{\"n\":null,\"f\":false,\"t\":true,\"i\":-123,\"d\":1.5,\"s\":\"a\\nb\",\"a\":[[],{},3]}", json, len);
+    EXPECT_EQ_INT('\0', json[len]);
+
+    /* buffer is reused after reset; DOM values can be embedded */
+    cjson_writer_reset(&w);
+    cjson_init(&v);
+    EXPECT_EQ_INT(CJSON_PARSE_OK, cjson_parse(&v, "{\"a\":[1,2,{\"b\":\"c\"}]}"));
+    cjson_write_begin_array(&w);
+    cjson_write_value(&w, &v);
+    cjson_write_value(&w, &v);
+    cjson_write_end_array(&w);
+    json = cjson_writer_get_string(&w, &len);
+    json2 = cjson_stringify(&v, &len2);
+    EXPECT_EQ_SIZE_T(len2 * 2 + 3, len);
+    EXPECT_EQ_STRING("[{\"a\":[1,2,{\"b\":\"c\"}]},{\"a\":[1,2,{\"b\":\"c\"}]}]", json, len);
+    free(json2);
+    cjson_free(&v);
+
+    cjson_writer_reset(&w);
+    cjson_write_string(&w, "Hello", 5);
+    json = cjson_writer_get_string(&w, &len);
+    EXPECT_EQ_STRING("\"Hello\"", json, len);
+    cjson_writer_free(&w);
+}
+
 static void test_access_null() {
     cjson_value v;
     cjson_init(&v);
@@ -707,9 +2597,42 @@ int main() {
     test_parse();
     test_stringify();
     test_equal();
+    test_equal_large_object();
+    test_hash();
     test_copy();
+    test_copy_shared();
+    test_dedup_pool();
+    test_patch();
+    test_merge_patch();
+    test_diff();
+    test_cbor();
+    test_msgpack();
+    test_binary_roundtrip();
+    test_snapshot();
+    test_parse_file();
+    test_parse_step();
+    test_raw_number();
+    test_number_array();
+    test_field_cache();
+    test_freeze();
+    test_compact();
+    test_walk();
+    test_pool();
+    test_stringify_cached();
+    test_parse_cache();
+    test_columns();
+    test_memory_usage();
+    test_stringify_parallel();
+    test_copy_free_parallel();
+#ifdef CJSON_STATS
+    test_stats();
+#endif
+#ifdef CJSON_TRACE
+    test_trace();
+#endif
     test_move();
     test_swap();
+    test_writer();
     test_access();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;